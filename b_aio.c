@@ -0,0 +1,330 @@
+/**************************************************************
+* Class::  CSC-415-0# Spring 2024
+* Name::
+* Student IDs::
+* GitHub-Name::
+* Group-Name::
+* Project:: Basic File System
+*
+* File:: b_aio.c
+*
+* Description:: Asynchronous b_read/b_write.  Each fd keeps a
+*   FIFO of pending requests so that requests sharing a file
+*   position run in order.  Fds with pending work wait in a
+*   ring that the worker threads take turns serving.  The
+*   requests themselves go through b_read and b_write, which
+*   serialize on b_ioLock, so the workers overlap the I/O with
+*   the submitter's work and with callbacks, not with each
+*   other.
+*
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include "b_io.h"
+
+#define B_AIO_WORKERS 4
+
+#define B_AIO_READ	0
+#define B_AIO_WRITE	1
+
+struct b_aio_request
+	{
+	int op;				//B_AIO_READ or B_AIO_WRITE
+	b_io_fd fd;
+	char * buffer;
+	int count;
+	b_aio_callback callback;
+	void * context;
+	int result;			//bytes transferred or -1
+	int done;
+	struct b_aio_request * next;	//fd queue while pending, completion list when done
+	};
+
+typedef struct b_aio_fdqueue
+	{
+	struct b_aio_request * head;
+	struct b_aio_request * tail;
+	int scheduled;		//fd is in the ring or being served by a worker
+	} b_aio_fdqueue;
+
+static pthread_mutex_t aioLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t workReady = PTHREAD_COND_INITIALIZER;	//ring gained an fd
+static pthread_cond_t workDone = PTHREAD_COND_INITIALIZER;	//a request finished
+
+static b_aio_fdqueue fdQueues[MAXFCBS];
+static int ring[MAXFCBS];		//fds waiting for a worker
+static int ringHead = 0;
+static int ringCount = 0;
+
+static struct b_aio_request * completedHead = NULL;
+static struct b_aio_request * completedTail = NULL;
+
+static pthread_t workers[B_AIO_WORKERS];
+static int running = 0;
+static int stopping = 0;
+static int eventFd = -1;
+
+//Worker thread: serve one request of the next fd in the ring, then put
+//the fd back at the end of the ring if it still has work
+static void * b_aio_worker (void * arg)
+	{
+	pthread_mutex_lock (&aioLock);
+	while (1)
+		{
+		while ((ringCount == 0) && !stopping)
+			pthread_cond_wait (&workReady, &aioLock);
+		if (ringCount == 0)
+			break;					//stopping and nothing left
+
+		int fd = ring[ringHead];
+		ringHead = (ringHead + 1) % MAXFCBS;
+		ringCount--;
+
+		b_aio_fdqueue * queue = &fdQueues[fd];
+		struct b_aio_request * request = queue->head;
+		queue->head = request->next;
+		if (queue->head == NULL)
+			queue->tail = NULL;
+		pthread_mutex_unlock (&aioLock);
+
+		if (request->op == B_AIO_READ)
+			request->result = b_read (request->fd, request->buffer, request->count);
+		else
+			request->result = b_write (request->fd, request->buffer, request->count);
+
+		int pollable = (request->callback == NULL);
+		pthread_mutex_lock (&aioLock);
+		if (queue->head != NULL)
+			{
+			ring[(ringHead + ringCount) % MAXFCBS] = fd;
+			ringCount++;
+			pthread_cond_signal (&workReady);
+			}
+		else
+			{
+			queue->scheduled = 0;
+			}
+
+		if (pollable)
+			{
+			request->done = 1;
+			request->next = NULL;
+			if (completedTail != NULL)
+				completedTail->next = request;
+			else
+				completedHead = request;
+			completedTail = request;
+
+			uint64_t one = 1;
+			write (eventFd, &one, sizeof (one));
+			}
+		pthread_cond_broadcast (&workDone);
+
+		//the request is off its queue before the callback runs, so the
+		//callback may close the fd or queue more work on it
+		if (!pollable)
+			{
+			pthread_mutex_unlock (&aioLock);
+			request->callback (request, request->result, request->context);
+			free (request);
+			pthread_mutex_lock (&aioLock);
+			}
+		}
+	pthread_mutex_unlock (&aioLock);
+	return (NULL);
+	}
+
+//Starts the eventfd and the worker threads, called with aioLock held
+static int b_aio_start ()
+	{
+	if (running)
+		return (0);
+
+	eventFd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (eventFd < 0)
+		return (-1);
+
+	stopping = 0;
+	for (int i = 0; i < B_AIO_WORKERS; i++)
+		pthread_create (&workers[i], NULL, b_aio_worker, NULL);
+	running = 1;
+	return (0);
+	}
+
+static b_aio_handle b_aio_submit (int op, b_io_fd fd, char * buffer, int count,
+		b_aio_callback callback, void * context)
+	{
+	if ((fd < 0) || (fd >= MAXFCBS) || (count < 0))
+		return (NULL);
+
+	struct b_aio_request * request = malloc (sizeof (struct b_aio_request));
+	if (request == NULL)
+		return (NULL);
+	request->op = op;
+	request->fd = fd;
+	request->buffer = buffer;
+	request->count = count;
+	request->callback = callback;
+	request->context = context;
+	request->result = -1;
+	request->done = 0;
+	request->next = NULL;
+
+	pthread_mutex_lock (&aioLock);
+	if (b_aio_start () != 0)
+		{
+		pthread_mutex_unlock (&aioLock);
+		free (request);
+		return (NULL);
+		}
+
+	b_aio_fdqueue * queue = &fdQueues[fd];
+	if (queue->tail != NULL)
+		queue->tail->next = request;
+	else
+		queue->head = request;
+	queue->tail = request;
+
+	if (!queue->scheduled)
+		{
+		queue->scheduled = 1;
+		ring[(ringHead + ringCount) % MAXFCBS] = fd;
+		ringCount++;
+		pthread_cond_signal (&workReady);
+		}
+	pthread_mutex_unlock (&aioLock);
+	return (request);
+	}
+
+// Queue a read of count bytes at the fd's position when the request runs
+b_aio_handle b_read_async (b_io_fd fd, char * buffer, int count,
+		b_aio_callback callback, void * context)
+	{
+	return (b_aio_submit (B_AIO_READ, fd, buffer, count, callback, context));
+	}
+
+// Queue a write of count bytes at the fd's position when the request runs
+b_aio_handle b_write_async (b_io_fd fd, char * buffer, int count,
+		b_aio_callback callback, void * context)
+	{
+	return (b_aio_submit (B_AIO_WRITE, fd, buffer, count, callback, context));
+	}
+
+int b_aio_eventfd ()
+	{
+	pthread_mutex_lock (&aioLock);
+	int result = (b_aio_start () == 0) ? eventFd : -1;
+	pthread_mutex_unlock (&aioLock);
+	return (result);
+	}
+
+int b_aio_reap (b_aio_handle * done, int max)
+	{
+	int count = 0;
+	pthread_mutex_lock (&aioLock);
+	while ((count < max) && (completedHead != NULL))
+		{
+		done[count++] = completedHead;
+		completedHead = completedHead->next;
+		}
+	if (completedHead == NULL)
+		{
+		completedTail = NULL;
+		if (eventFd >= 0)
+			{
+			uint64_t pending;
+			read (eventFd, &pending, sizeof (pending));	//reset readiness
+			}
+		}
+	pthread_mutex_unlock (&aioLock);
+	return (count);
+	}
+
+int b_aio_wait (b_aio_handle request)
+	{
+	if ((request == NULL) || (request->callback != NULL))
+		return (-1);		//callback requests are freed by the worker
+
+	pthread_mutex_lock (&aioLock);
+	while (!request->done)
+		pthread_cond_wait (&workDone, &aioLock);
+
+	//unlink from the completion list, if nobody reaped it yet
+	struct b_aio_request * prev = NULL;
+	for (struct b_aio_request * cur = completedHead; cur != NULL; cur = cur->next)
+		{
+		if (cur == request)
+			{
+			if (prev != NULL)
+				prev->next = cur->next;
+			else
+				completedHead = cur->next;
+			if (completedTail == cur)
+				completedTail = prev;
+			break;
+			}
+		prev = cur;
+		}
+	pthread_mutex_unlock (&aioLock);
+
+	int result = request->result;
+	free (request);
+	return (result);
+	}
+
+int b_aio_result (b_aio_handle request)
+	{
+	return (request->result);
+	}
+
+void * b_aio_context (b_aio_handle request)
+	{
+	return (request->context);
+	}
+
+void b_aio_release (b_aio_handle request)
+	{
+	free (request);
+	}
+
+//Blocks until no request for fd is queued or running, used by b_close
+void b_aio_drain (b_io_fd fd)
+	{
+	pthread_mutex_lock (&aioLock);
+	while (fdQueues[fd].scheduled)
+		pthread_cond_wait (&workDone, &aioLock);
+	pthread_mutex_unlock (&aioLock);
+	}
+
+void b_aio_shutdown ()
+	{
+	pthread_mutex_lock (&aioLock);
+	if (!running)
+		{
+		pthread_mutex_unlock (&aioLock);
+		return;
+		}
+	stopping = 1;
+	pthread_cond_broadcast (&workReady);
+	pthread_mutex_unlock (&aioLock);
+
+	for (int i = 0; i < B_AIO_WORKERS; i++)
+		pthread_join (workers[i], NULL);
+
+	//unreaped completions are freed along with the pool
+	while (completedHead != NULL)
+		{
+		struct b_aio_request * next = completedHead->next;
+		free (completedHead);
+		completedHead = next;
+		}
+	completedTail = NULL;
+	close (eventFd);
+	eventFd = -1;
+	running = 0;
+	}
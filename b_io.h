@@ -16,6 +16,8 @@
 #define _B_IO_H
 #include <fcntl.h>
 
+#define MAXFCBS 20
+
 typedef int b_io_fd;
 
 b_io_fd b_open (char * filename, int flags);
@@ -24,5 +26,29 @@ int b_write (b_io_fd fd, char * buffer, int count);
 int b_seek (b_io_fd fd, off_t offset, int whence);
 int b_close (b_io_fd fd);
 
+// Asynchronous reads and writes.  Requests are run by a pool of worker
+// threads; requests on the same fd run in the order they were submitted.
+// With a callback the request is handed to the callback on a worker
+// thread and freed when it returns.  Without one the finished request is
+// queued for b_aio_reap or b_aio_wait and b_aio_eventfd becomes readable.
+// A callback runs once its request has left the fd's queue, so it may call
+// any b_ function on that fd, including b_close and further async requests.
+// It must not call b_aio_shutdown, which waits for the worker running it.
+// Callbacks of one fd may overlap when it has more requests queued.
+typedef struct b_aio_request * b_aio_handle;
+typedef void (*b_aio_callback) (b_aio_handle request, int result, void * context);
+
+b_aio_handle b_read_async (b_io_fd fd, char * buffer, int count,
+	b_aio_callback callback, void * context);
+b_aio_handle b_write_async (b_io_fd fd, char * buffer, int count,
+	b_aio_callback callback, void * context);
+int b_aio_eventfd ();		// pollable, readable while completions are queued
+int b_aio_reap (b_aio_handle * done, int max);	// takes finished requests, never blocks
+int b_aio_wait (b_aio_handle request);	// blocks until done, returns result and frees
+int b_aio_result (b_aio_handle request);	// byte count or -1 of a reaped request
+void * b_aio_context (b_aio_handle request);
+void b_aio_release (b_aio_handle request);	// frees a reaped request
+void b_aio_shutdown ();		// waits for all requests and stops the workers
+
 #endif
 
@@ -0,0 +1,247 @@
+/**************************************************************
+* Class::  CSC-415-0# Spring 2024
+* Name::
+* Student IDs::
+* GitHub-Name::
+* Group-Name::
+* Project:: Basic File System
+*
+* File:: fsAlloc.c
+*
+* Description:: Free space summaries for the block allocator.
+*   The volume is split into groups of ALLOC_GROUP_BLOCKS; each
+*   keeps its free count and a bound on its longest free run, so
+*   a first-fit search steps over full groups, takes wholly free
+*   ones in one step, and only reads the FAT entries of groups
+*   that could hold the run.  The summaries are written at a
+*   clean unmount and loaded in one read at the next mount; a
+*   volume that was not unmounted cleanly is scanned instead.
+*
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mfs.h"
+#include "vcb.h"
+#include "fsLow.h"
+
+extern struct VolumeControlBlock* vcb;
+extern struct FATEntry* fat;
+
+int allocateBlocks(int numBlocks, struct VolumeControlBlock *vcb);
+void releaseChain(uint64_t firstBlock);
+int writeFAT();
+void discardNote(uint64_t block);
+
+static struct allocGroup *groups = NULL;   // NULL until the volume has them
+
+static uint64_t groupEnd(uint64_t group) {
+    uint64_t end = (group + 1) * ALLOC_GROUP_BLOCKS;
+    return (end < vcb->totalBlocks) ? end : vcb->totalBlocks;
+}
+
+static uint64_t summaryBlocks() {
+    return (vcb->allocGroups * sizeof(struct allocGroup) + vcb->blockSize - 1) / vcb->blockSize;
+}
+
+// Recounts every group from the FAT and corrects the volume's free count
+static void scanGroups() {
+    uint64_t totalFree = 0;
+    for (uint64_t g = 0; g < vcb->allocGroups; g++) {
+        uint32_t free = 0, run = 0, largest = 0;
+        for (uint64_t block = g * ALLOC_GROUP_BLOCKS; block < groupEnd(g); block++) {
+            if (block >= vcb->dataStart && fat[block].nextBlock == FAT_FREE) {
+                free++;
+                run++;
+                largest = (run > largest) ? run : largest;
+            } else {
+                run = 0;
+            }
+        }
+        groups[g].freeBlocks = free;
+        groups[g].largestFree = largest;
+        totalFree += free;
+    }
+    vcb->freeBlocks = totalFree;
+}
+
+// First block of the lowest run of numBlocks free blocks, or -1
+int allocFindRun(uint64_t numBlocks) {
+    if (numBlocks == 0) {
+        return -1;
+    }
+    uint64_t first = 0;
+    uint64_t count = 0;
+    uint64_t block = vcb->dataStart;
+    while (block < vcb->totalBlocks) {
+        uint64_t g = block / ALLOC_GROUP_BLOCKS;
+        uint64_t end = groupEnd(g);
+        int wholeGroup = (block == g * ALLOC_GROUP_BLOCKS);
+
+        if (groups != NULL && wholeGroup) {
+            if (groups[g].freeBlocks == 0) {
+                count = 0;
+                block = end;
+                continue;
+            }
+            if (groups[g].freeBlocks == end - block) {
+                first = (count == 0) ? block : first;
+                count += end - block;
+                if (count >= numBlocks) {
+                    return first;
+                }
+                block = end;
+                continue;
+            }
+            // No run long enough starts here or carries on past the end
+            if (count == 0 && groups[g].largestFree < numBlocks && fat[end - 1].nextBlock != FAT_FREE) {
+                block = end;
+                continue;
+            }
+        }
+
+        uint32_t run = 0, largest = 0;
+        for (; block < end; block++) {
+            if (fat[block].nextBlock == FAT_FREE) {
+                first = (count == 0) ? block : first;
+                if (++count >= numBlocks) {
+                    return first;
+                }
+                run++;
+                largest = (run > largest) ? run : largest;
+            } else {
+                count = 0;
+                run = 0;
+            }
+        }
+        if (groups != NULL && wholeGroup) {
+            groups[g].largestFree = largest; // Exact now that it was read
+        }
+    }
+    return -1;
+}
+
+// Records that blocks [start, start + count) were allocated
+void allocNoteUsed(uint64_t start, uint64_t count) {
+    if (groups == NULL) {
+        return;
+    }
+    for (uint64_t block = start; block < start + count; ) {
+        uint64_t g = block / ALLOC_GROUP_BLOCKS;
+        uint64_t end = groupEnd(g);
+        uint64_t used = ((start + count < end) ? start + count : end) - block;
+        groups[g].freeBlocks -= used;
+        block += used;
+    }
+}
+
+// Records that block was freed.  The longest run is no longer known, so
+// the group is read again the next time a search reaches it.
+void allocNoteFreed(uint64_t block) {
+    discardNote(block);
+    if (groups == NULL) {
+        return;
+    }
+    uint64_t g = block / ALLOC_GROUP_BLOCKS;
+    groups[g].freeBlocks++;
+    groups[g].largestFree = groupEnd(g) - g * ALLOC_GROUP_BLOCKS;
+}
+
+static int allocateGroups() {
+    vcb->allocGroups = (vcb->totalBlocks + ALLOC_GROUP_BLOCKS - 1) / ALLOC_GROUP_BLOCKS;
+    groups = calloc(summaryBlocks(), vcb->blockSize);
+    if (groups == NULL) {
+        printf("Error: Failed to allocate free space summaries\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Reserves the summaries of a new volume, or of one formatted before them,
+// marks them in the FAT and records them in the VCB for the caller to write
+int allocSummaryCreate() {
+    if (allocateGroups() != 0) {
+        return -1;
+    }
+    struct allocGroup *pending = groups;
+    groups = NULL; // Its own blocks come from a plain scan
+    int start = allocateBlocks(summaryBlocks(), vcb);
+    groups = pending;
+    if (start == -1) {
+        printf("Error: Failed to allocate blocks for the free space summaries\n");
+        free(groups);
+        groups = NULL;
+        return -1;
+    }
+    vcb->allocSummaryStart = start;
+    scanGroups();
+    return writeFAT();
+}
+
+// Loads the summaries at mount.  They are only trusted after a clean
+// unmount; otherwise the FAT is scanned to rebuild them.  The volume is
+// marked in use until the next clean unmount, for the caller to write.
+int allocSummaryLoad() {
+    if (vcb->allocSummaryStart == 0) {
+        vcb->cleanUnmount = 0;
+        return allocSummaryCreate();
+    }
+    if (allocateGroups() != 0) {
+        return -1;
+    }
+    if (!vcb->cleanUnmount ||
+            LBAread(groups, summaryBlocks(), vcb->allocSummaryStart) != summaryBlocks()) {
+        printf("Volume was not unmounted cleanly, rescanning free space\n");
+        scanGroups();
+    }
+    vcb->cleanUnmount = 0;
+    return 0;
+}
+
+// Resizes the summaries after the volume grew, moving them if they need
+// more blocks, and recounts the free space.  Called with the new size in
+// the VCB and a FAT that covers it.  The old blocks of moved summaries are
+// left allocated and returned in oldStart, for the caller to free once the
+// move has committed.
+int allocSummaryGrow(uint64_t *oldStart) {
+    uint64_t oldBlocks = summaryBlocks();
+    uint32_t oldGroups = vcb->allocGroups;
+    vcb->allocGroups = (vcb->totalBlocks + ALLOC_GROUP_BLOCKS - 1) / ALLOC_GROUP_BLOCKS;
+    struct allocGroup *grown = realloc(groups, summaryBlocks() * vcb->blockSize);
+    if (grown == NULL) {
+        vcb->allocGroups = oldGroups;
+        return -1;
+    }
+    groups = grown;
+    scanGroups();
+    if (summaryBlocks() > oldBlocks) {
+        int start = allocateBlocks(summaryBlocks(), vcb);
+        if (start == -1) {
+            printf("Error: Failed to allocate blocks for the free space summaries\n");
+            return -1;
+        }
+        *oldStart = vcb->allocSummaryStart;
+        vcb->allocSummaryStart = start;
+    }
+    return 0;
+}
+
+// Writes the summaries and marks the volume clean, for the caller to write
+// the VCB after them
+int allocSummarySave() {
+    if (groups == NULL) {
+        return 0;
+    }
+    if (LBAwrite(groups, summaryBlocks(), vcb->allocSummaryStart) != summaryBlocks()) {
+        printf("Error: Failed to write free space summaries\n");
+        return -1;
+    }
+    vcb->cleanUnmount = 1;
+    return 0;
+}
+
+void allocSummaryClose() {
+    free(groups);
+    groups = NULL;
+}
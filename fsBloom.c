@@ -0,0 +1,168 @@
+/**************************************************************
+* Class::  CSC-415-0# Spring 2024
+* Name::
+* Student IDs::
+* GitHub-Name::
+* Group-Name::
+* Project:: Basic File System
+*
+* File:: fsBloom.c
+*
+* Description:: In-memory Bloom filters over the names of
+*   recently loaded directories.  A name the filter has never
+*   seen is certainly absent, so most failed lookups and the
+*   existence checks done before a create return without
+*   probing the directory, or without loading it at all when it
+*   is not in memory.  Names are added as entries are created;
+*   deleted names stay set until the filter is rebuilt from the
+*   directory the next time it is loaded.
+*
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "mfs.h"
+#include "vcb.h"
+
+#define BLOOM_DIRS 256          // Power of two
+#define BLOOM_BITS_PER_NAME 16
+#define BLOOM_MIN_BITS 1024     // Power of two
+#define BLOOM_HASHES 4
+
+struct bloom {
+    uint64_t dirBlock;          // First block of the directory, 0 when unused
+    uint32_t mask;              // Size of bits in bits, minus one
+    uint32_t names;             // Names added since the last build
+    uint32_t removed;           // Names removed since then, still set in bits
+    uint8_t *bits;
+};
+
+static struct bloom filters[BLOOM_DIRS];
+static pthread_mutex_t bloomLock = PTHREAD_MUTEX_INITIALIZER;
+
+uint32_t dirNameHash(const char *name);
+
+static struct bloom *filterFor(uint64_t dirBlock) {
+    return &filters[(dirBlock * 2654435761u) & (BLOOM_DIRS - 1)];
+}
+
+// Bit positions come from double hashing the name's FNV-1a hash
+static void bitsOf(const char *name, uint32_t positions[BLOOM_HASHES]) {
+    uint32_t h1 = dirNameHash(name);
+    uint32_t h2 = h1 * 0x9E3779B1u;
+    h2 ^= h2 >> 15;
+    h2 |= 1;
+    for (int i = 0; i < BLOOM_HASHES; i++) {
+        positions[i] = h1 + i * h2;
+    }
+}
+
+static void setName(struct bloom *filter, const char *name) {
+    uint32_t positions[BLOOM_HASHES];
+    bitsOf(name, positions);
+    for (int i = 0; i < BLOOM_HASHES; i++) {
+        uint32_t bit = positions[i] & filter->mask;
+        filter->bits[bit / 8] |= 1 << (bit % 8);
+    }
+    filter->names++;
+}
+
+// Empties every filter, called when a volume is mounted
+void bloomClear() {
+    pthread_mutex_lock(&bloomLock);
+    for (int i = 0; i < BLOOM_DIRS; i++) {
+        free(filters[i].bits);
+        filters[i].bits = NULL;
+        filters[i].dirBlock = 0;
+    }
+    pthread_mutex_unlock(&bloomLock);
+}
+
+// Builds the filter of a loaded directory from scratch, replacing whatever
+// filter held its place
+void bloomBuild(struct DirectoryEntry *dir) {
+    int numEntries = dir[0].fileSize / sizeof(struct DirectoryEntry);
+    uint64_t bits = BLOOM_MIN_BITS;
+    while (bits < (uint64_t)numEntries * BLOOM_BITS_PER_NAME) {
+        bits *= 2;
+    }
+
+    pthread_mutex_lock(&bloomLock);
+    struct bloom *filter = filterFor(dir[0].firstBlockIndex);
+    if (filter->bits == NULL || filter->mask + 1 != bits) {
+        free(filter->bits);
+        filter->bits = malloc(bits / 8);
+        if (filter->bits == NULL) {
+            filter->dirBlock = 0;
+            pthread_mutex_unlock(&bloomLock);
+            return;
+        }
+    }
+    memset(filter->bits, 0, bits / 8);
+    filter->dirBlock = dir[0].firstBlockIndex;
+    filter->mask = bits - 1;
+    filter->names = 0;
+    filter->removed = 0;
+    for (int i = 0; i < numEntries; i++) {
+        if (dir[i].inUse) {
+            setName(filter, dir[i].filename);
+        }
+    }
+    pthread_mutex_unlock(&bloomLock);
+}
+
+// Called with each directory loaded from disk.  The filter is built if the
+// directory has none, or rebuilt once deletes or growth have made it
+// answer "maybe" too often.
+void bloomLoad(struct DirectoryEntry *dir) {
+    pthread_mutex_lock(&bloomLock);
+    struct bloom *filter = filterFor(dir[0].firstBlockIndex);
+    int current = filter->dirBlock == dir[0].firstBlockIndex &&
+            filter->removed * 4 <= filter->names &&
+            (uint64_t)filter->names * BLOOM_BITS_PER_NAME <= (uint64_t)filter->mask + 1;
+    pthread_mutex_unlock(&bloomLock);
+    if (!current) {
+        bloomBuild(dir);
+    }
+}
+
+// Records a name created in the directory at dirBlock
+void bloomAdd(uint64_t dirBlock, const char *name) {
+    pthread_mutex_lock(&bloomLock);
+    struct bloom *filter = filterFor(dirBlock);
+    if (filter->dirBlock == dirBlock) {
+        setName(filter, name);
+    }
+    pthread_mutex_unlock(&bloomLock);
+}
+
+// Notes a name removed from the directory at dirBlock
+void bloomRemove(uint64_t dirBlock) {
+    pthread_mutex_lock(&bloomLock);
+    struct bloom *filter = filterFor(dirBlock);
+    if (filter->dirBlock == dirBlock) {
+        filter->removed++;
+    }
+    pthread_mutex_unlock(&bloomLock);
+}
+
+// Returns 0 if name is certainly not in the directory at dirBlock, 1 if it
+// may be or the directory has no filter
+int bloomMayContain(uint64_t dirBlock, const char *name) {
+    uint32_t positions[BLOOM_HASHES];
+    bitsOf(name, positions);
+
+    pthread_mutex_lock(&bloomLock);
+    struct bloom *filter = filterFor(dirBlock);
+    int result = 1;
+    if (filter->dirBlock == dirBlock) {
+        for (int i = 0; i < BLOOM_HASHES && result; i++) {
+            uint32_t bit = positions[i] & filter->mask;
+            result = (filter->bits[bit / 8] >> (bit % 8)) & 1;
+        }
+    }
+    pthread_mutex_unlock(&bloomLock);
+    return result;
+}
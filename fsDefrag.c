@@ -0,0 +1,486 @@
+/**************************************************************
+* Class::  CSC-415-0# Spring 2024
+* Name::
+* Student IDs::
+* GitHub-Name::
+* Group-Name::
+* Project:: Basic File System
+*
+* File:: fsDefrag.c
+*
+* Description:: Background defragmenter.  A pass walks the
+*   tree, scores each file by the extents in its FAT chain, and
+*   moves fragmented files into a contiguous run, and files
+*   that fit lower down to the lowest run that holds them, so
+*   free space gathers at the end of the volume.  A move copies
+*   the data into newly allocated blocks a few at a time,
+*   throttled, and then switches the entry to the copy and
+*   frees the old chain in one journal transaction.  The switch
+*   is abandoned if the entry's directory changed or the file
+*   was opened while it was copied.  Between steps the service
+*   gives up the volume lock so the shell keeps running.
+*
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "mfs.h"
+#include "vcb.h"
+#include "fsLow.h"
+
+#define DEFRAG_CHUNK 64             // Blocks copied per hold of the volume lock
+#define DEFRAG_DEFAULT_RATE 1024    // Blocks a second when none is given
+#define DEFRAG_IDLE_SECONDS 5       // Wait before a pass after one moved nothing
+
+extern struct VolumeControlBlock* vcb;
+extern struct FATEntry* fat;
+extern uint16_t *blockRefs;
+extern pthread_mutex_t b_ioLock;
+
+int allocateBlocks(int numBlocks, struct VolumeControlBlock *vcb);
+int allocFindRun(uint64_t numBlocks);
+void releaseChain(uint64_t firstBlock);
+int writeFAT();
+int updateDirEntry(uint64_t dirBlock, uint64_t dirSize, int index, struct DirectoryEntry *entry);
+struct dirReader *dirReaderOpen(uint64_t firstBlock);
+void dirReaderClose(struct dirReader *reader);
+uint64_t dirReaderCount(struct dirReader *reader);
+int dirReaderEntry(struct dirReader *reader, uint64_t slot, struct DirectoryEntry *entry);
+uint32_t pathCacheGeneration(uint64_t dirBlock);
+void b_watchSlot(uint64_t dirBlock, int index);
+int b_watchedOpened();
+void journalBegin();
+int journalBeginSized(uint64_t blocks);
+int journalReserve(uint64_t blocks);
+int journalEnd();
+uint64_t fatSpan(const struct extent *extents, int count);
+uint64_t freeChain(uint64_t firstBlock, uint64_t limit);
+
+// A file that may be moved, as the scan found it
+struct candidate {
+    uint64_t dirBlock;
+    uint64_t dirSize;
+    int slot;
+    uint64_t extents;
+    struct DirectoryEntry entry;
+};
+
+struct scan {
+    pthread_mutex_t lock;
+    struct fs_defragstats stats;
+    int collect;                // Gather candidates as well as the score
+    struct candidate *candidates;
+    uint64_t count;
+    uint64_t capacity;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    int running;                // A service thread exists
+    int stopping;               // It has been asked to finish
+    int rate;
+    struct fs_defragstats before;
+    uint64_t filesMoved;
+    uint64_t blocksMoved;
+} service = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};
+
+static pthread_mutex_t volumeLock = PTHREAD_MUTEX_INITIALIZER;
+
+void fs_lockVolume() {
+    pthread_mutex_lock(&volumeLock);
+}
+
+void fs_unlockVolume() {
+    pthread_mutex_unlock(&volumeLock);
+}
+
+// Counts the blocks and extents of a chain and whether any block is shared.
+// Returns -1 if the chain leaves the volume or loops.
+static int measureChain(uint64_t firstBlock, uint64_t *blocks, uint64_t *extents, int *shared) {
+    *blocks = 0;
+    *extents = 0;
+    *shared = 0;
+    uint64_t previous = 0;
+    for (uint64_t block = firstBlock; block != FAT_EOF; block = fat[block].nextBlock) {
+        if (block < vcb->dataStart || block >= vcb->totalBlocks || *blocks >= vcb->totalBlocks) {
+            return -1;
+        }
+        if (*blocks == 0 || block != previous + 1) {
+            (*extents)++;
+        }
+        if (blockRefs[block] > 0) {
+            *shared = 1;
+        }
+        (*blocks)++;
+        previous = block;
+    }
+    return 0;
+}
+
+static int addCandidate(struct scan *scan, struct candidate *candidate) {
+    if (scan->count == scan->capacity) {
+        uint64_t capacity = (scan->capacity > 0) ? scan->capacity * 2 : 256;
+        struct candidate *grown = realloc(scan->candidates, capacity * sizeof(struct candidate));
+        if (grown == NULL) {
+            return -1;
+        }
+        scan->candidates = grown;
+        scan->capacity = capacity;
+    }
+    scan->candidates[scan->count++] = *candidate;
+    return 0;
+}
+
+// Scores the files of each directory the walk reaches
+static int scanDir(const struct fs_walkent *ent, void *context) {
+    struct scan *scan = context;
+    if (ent->entry->fileType != 1) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&b_ioLock);
+    struct dirReader *reader = dirReaderOpen(ent->entry->firstBlockIndex);
+    if (reader == NULL) {
+        pthread_mutex_unlock(&b_ioLock);
+        return 0; // Left for fsck
+    }
+    struct fs_defragstats stats = {0};
+    struct candidate candidate = {0};
+    candidate.dirBlock = ent->entry->firstBlockIndex;
+    candidate.dirSize = dirReaderCount(reader) * sizeof(struct DirectoryEntry);
+    int result = 0;
+    for (uint64_t slot = 2; slot < dirReaderCount(reader) && result == 0; slot++) {
+        struct DirectoryEntry *entry = &candidate.entry;
+        if (dirReaderEntry(reader, slot, entry) != 1 || entry->fileType == 1 ||
+                entry->inlineData || entry->firstBlockIndex == 0) {
+            continue;
+        }
+        uint64_t blocks;
+        int shared;
+        if (measureChain(entry->firstBlockIndex, &blocks, &candidate.extents, &shared) != 0) {
+            continue;
+        }
+        stats.files++;
+        stats.extents += candidate.extents;
+        if (candidate.extents > 1) {
+            stats.fragmentedFiles++;
+        }
+        // Shared blocks belong to clones too, so those files stay put
+        if (scan->collect && !shared) {
+            candidate.slot = slot;
+            pthread_mutex_lock(&scan->lock);
+            result = addCandidate(scan, &candidate);
+            pthread_mutex_unlock(&scan->lock);
+        }
+    }
+    dirReaderClose(reader);
+    pthread_mutex_unlock(&b_ioLock);
+
+    pthread_mutex_lock(&scan->lock);
+    scan->stats.files += stats.files;
+    scan->stats.fragmentedFiles += stats.fragmentedFiles;
+    scan->stats.extents += stats.extents;
+    pthread_mutex_unlock(&scan->lock);
+    return result;
+}
+
+static void scoreFreeSpace(struct fs_defragstats *stats) {
+    pthread_mutex_lock(&b_ioLock);
+    uint64_t run = 0;
+    for (uint64_t block = vcb->dataStart; block < vcb->totalBlocks; block++) {
+        if (fat[block].nextBlock == FAT_FREE) {
+            if (run++ == 0) {
+                stats->freeExtents++;
+            }
+            stats->largestFree = (run > stats->largestFree) ? run : stats->largestFree;
+        } else {
+            run = 0;
+        }
+    }
+    pthread_mutex_unlock(&b_ioLock);
+}
+
+static int scanVolume(struct scan *scan) {
+    pthread_mutex_init(&scan->lock, NULL);
+    int result = fs_walk("/", scanDir, 0, 0, scan);
+    pthread_mutex_destroy(&scan->lock);
+    if (result == 0) {
+        scoreFreeSpace(&scan->stats);
+    }
+    return result;
+}
+
+int fs_defragScore(struct fs_defragstats *stats) {
+    struct scan scan = {0};
+    int result = scanVolume(&scan);
+    *stats = scan.stats;
+    return result;
+}
+
+// Waits up to seconds, returning early with 1 once the service is stopping
+static int waitOrStop(double seconds) {
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec += (time_t)seconds;
+    until.tv_nsec += (long)((seconds - (time_t)seconds) * 1e9);
+    if (until.tv_nsec >= 1000000000L) {
+        until.tv_sec++;
+        until.tv_nsec -= 1000000000L;
+    }
+    pthread_mutex_lock(&service.lock);
+    while (!service.stopping &&
+            pthread_cond_timedwait(&service.changed, &service.lock, &until) == 0) {
+    }
+    int stopping = service.stopping;
+    pthread_mutex_unlock(&service.lock);
+    return stopping;
+}
+
+// Whether the entry is still where and what the scan saw, and unshared.
+// Called with b_ioLock held.
+static int stillCandidate(struct candidate *candidate, uint64_t *blocks) {
+    struct dirReader *reader = dirReaderOpen(candidate->dirBlock);
+    struct DirectoryEntry entry;
+    int found = (reader != NULL) && (dirReaderEntry(reader, candidate->slot, &entry) == 1);
+    dirReaderClose(reader);
+    uint64_t extents;
+    int shared;
+    return found && strcmp(entry.filename, candidate->entry.filename) == 0 &&
+        entry.firstBlockIndex == candidate->entry.firstBlockIndex &&
+        entry.fileSize == candidate->entry.fileSize &&
+        entry.creationTime == candidate->entry.creationTime &&
+        entry.lastModifiedTime == candidate->entry.lastModifiedTime && !entry.inlineData &&
+        measureChain(entry.firstBlockIndex, blocks, &extents, &shared) == 0 && !shared;
+}
+
+// Claims a contiguous run for the file if moving it there helps, in a
+// transaction of its own.  Nothing refers to the run until switchChain,
+// so a crash in between only leaks it.  Returns the run's first block, or
+// -1 to leave the file where it is.
+static int claimRun(struct candidate *candidate, uint64_t *blocks, uint32_t *generation) {
+    int run = -1;
+    uint64_t sizeBlocks = (candidate->entry.fileSize + vcb->blockSize - 1) / vcb->blockSize;
+    uint64_t reserved = (sizeBlocks * sizeof(struct FATEntry) + vcb->blockSize - 1) / vcb->blockSize + 1;
+    fs_lockVolume();
+    int sized = journalBeginSized(reserved + 1); // Outside b_ioLock, since it may wait for a commit
+    pthread_mutex_lock(&b_ioLock);
+    *generation = pathCacheGeneration(candidate->dirBlock);
+    if (sized == 0 && stillCandidate(candidate, blocks)) {
+        int lowest = allocFindRun(*blocks);
+        if (lowest != -1 && (candidate->extents > 1 || lowest < candidate->entry.firstBlockIndex)) {
+            run = allocateBlocks(*blocks, vcb);
+        }
+    }
+    if (run != -1) {
+        struct extent claimed = {run, *blocks};
+        uint64_t span = fatSpan(&claimed, 1);
+        if (journalReserve(span + 1) != 0 || writeFAT() != 0) {
+            freeChain(run, 0);
+            run = -1;
+        }
+    }
+    if (run != -1) {
+        b_watchSlot(candidate->dirBlock, candidate->slot);
+        if (b_watchedOpened()) {
+            b_watchSlot(0, -1);
+            releaseChain(run);
+            run = -1;
+        }
+    }
+    pthread_mutex_unlock(&b_ioLock);
+    journalEnd();
+    fs_unlockVolume();
+    return run;
+}
+
+// Copies the file's blocks to the run, DEFRAG_CHUNK at a time with the
+// locks given up and the rate kept between chunks
+static int copyChain(struct candidate *candidate, uint64_t blocks, uint64_t run) {
+    char *buffer = malloc((uint64_t)DEFRAG_CHUNK * vcb->blockSize);
+    if (buffer == NULL) {
+        return -1;
+    }
+    int result = 0;
+    uint64_t source = candidate->entry.firstBlockIndex;
+    for (uint64_t copied = 0; copied < blocks && result == 0; ) {
+        uint64_t count = (blocks - copied < DEFRAG_CHUNK) ? blocks - copied : DEFRAG_CHUNK;
+        fs_lockVolume();
+        pthread_mutex_lock(&b_ioLock);
+        // The chain may have changed since the scan; if so the switch is
+        // abandoned, so only stay on the volume while following it
+        for (uint64_t i = 0; i < count && result == 0; ) {
+            uint64_t length = 1;
+            if (source < vcb->dataStart || source >= vcb->totalBlocks) {
+                result = -1;
+                break;
+            }
+            while (i + length < count && fat[source + length - 1].nextBlock == source + length) {
+                length++;
+            }
+            if (LBAread(buffer + i * vcb->blockSize, length, source) != length) {
+                result = -1;
+            }
+            source = fat[source + length - 1].nextBlock;
+            i += length;
+        }
+        if (result == 0 && LBAwrite(buffer, count, run + copied) != count) {
+            result = -1;
+        }
+        pthread_mutex_unlock(&b_ioLock);
+        fs_unlockVolume();
+        copied += count;
+        if (result == 0 && waitOrStop((double)count / service.rate)) {
+            result = -1;
+        }
+    }
+    free(buffer);
+    return result;
+}
+
+// Points the entry at the copy and frees the old chain, or frees the copy
+// if the file changed meanwhile.  Returns 1 if the file moved.
+static int switchChain(struct candidate *candidate, uint64_t run, uint32_t generation, int copied) {
+    fs_lockVolume();
+    journalBegin(); // Outside b_ioLock, since it may wait for a commit
+    pthread_mutex_lock(&b_ioLock);
+    uint64_t blocks;
+    int moved = copied && !b_watchedOpened() &&
+        pathCacheGeneration(candidate->dirBlock) == generation && stillCandidate(candidate, &blocks);
+    b_watchSlot(0, -1);
+    if (moved) {
+        struct DirectoryEntry entry = candidate->entry;
+        entry.firstBlockIndex = run;
+        moved = (updateDirEntry(candidate->dirBlock, candidate->dirSize, candidate->slot, &entry) == 0);
+    }
+    releaseChain(moved ? candidate->entry.firstBlockIndex : run);
+    writeFAT();
+    pthread_mutex_unlock(&b_ioLock);
+    journalEnd();
+    fs_unlockVolume();
+    return moved;
+}
+
+// Moves one file if that helps, returning the blocks moved
+static uint64_t relocate(struct candidate *candidate) {
+    uint64_t blocks;
+    uint32_t generation;
+    int run = claimRun(candidate, &blocks, &generation);
+    if (run == -1) {
+        return 0;
+    }
+    int copied = (copyChain(candidate, blocks, run) == 0);
+    return switchChain(candidate, run, generation, copied) ? blocks : 0;
+}
+
+// Lowest files first, so each move can use the space the last one freed
+static int byFirstBlock(const void *a, const void *b) {
+    uint64_t x = ((const struct candidate *)a)->entry.firstBlockIndex;
+    uint64_t y = ((const struct candidate *)b)->entry.firstBlockIndex;
+    return (x > y) - (x < y);
+}
+
+static void *defragService(void *arg) {
+    int stopping = 0;
+    while (!stopping) {
+        struct scan scan = {0};
+        scan.collect = 1;
+        fs_lockVolume();
+        int result = scanVolume(&scan);
+        fs_unlockVolume();
+        if (result == 0) {
+            qsort(scan.candidates, scan.count, sizeof(struct candidate), byFirstBlock);
+        }
+
+        uint64_t moved = 0;
+        for (uint64_t i = 0; result == 0 && i < scan.count && !stopping; i++) {
+            uint64_t blocks = relocate(&scan.candidates[i]);
+            pthread_mutex_lock(&service.lock);
+            if (blocks > 0) {
+                service.filesMoved++;
+                service.blocksMoved += blocks;
+                moved++;
+            }
+            stopping = service.stopping;
+            pthread_mutex_unlock(&service.lock);
+        }
+        free(scan.candidates);
+        if (moved == 0 && !stopping) {
+            stopping = waitOrStop(DEFRAG_IDLE_SECONDS); // Done until something changes
+        }
+    }
+
+    pthread_mutex_lock(&service.lock);
+    service.running = 0;
+    pthread_cond_broadcast(&service.changed);
+    pthread_mutex_unlock(&service.lock);
+    return NULL;
+}
+
+// Starts the service, scoring the volume first for fs_defragStatus.  Called
+// with the volume lock held.
+int fs_defragStart(int blocksPerSecond) {
+    pthread_mutex_lock(&service.lock);
+    if (service.running) {
+        pthread_mutex_unlock(&service.lock);
+        return -1; // Running, or still finishing after a stop
+    }
+    pthread_mutex_unlock(&service.lock);
+
+    struct fs_defragstats before;
+    if (fs_defragScore(&before) != 0) {
+        return -1;
+    }
+    pthread_mutex_lock(&service.lock);
+    service.before = before;
+    service.filesMoved = 0;
+    service.blocksMoved = 0;
+    service.rate = (blocksPerSecond > 0) ? blocksPerSecond : DEFRAG_DEFAULT_RATE;
+    service.stopping = 0;
+    pthread_t thread;
+    int result = pthread_create(&thread, NULL, defragService, NULL);
+    if (result == 0) {
+        pthread_detach(thread);
+        service.running = 1;
+    }
+    pthread_mutex_unlock(&service.lock);
+    return (result == 0) ? 0 : -1;
+}
+
+// Returns 1 if the service is running, 0 if not.  The counts moved are
+// those of the last run either way.
+int fs_defragStatus(struct fs_defragstats *before, struct fs_defragstats *now) {
+    if (fs_defragScore(now) != 0) {
+        return -1;
+    }
+    pthread_mutex_lock(&service.lock);
+    *before = service.before;
+    now->filesMoved = service.filesMoved;
+    now->blocksMoved = service.blocksMoved;
+    int running = service.running && !service.stopping;
+    pthread_mutex_unlock(&service.lock);
+    return running;
+}
+
+int fs_defragStop() {
+    pthread_mutex_lock(&service.lock);
+    int running = service.running;
+    service.stopping = 1;
+    pthread_cond_broadcast(&service.changed);
+    pthread_mutex_unlock(&service.lock);
+    return running ? 0 : -1;
+}
+
+// Stops the service and waits for it to finish, called at unmount without
+// the volume lock
+void defragShutdown() {
+    fs_defragStop();
+    pthread_mutex_lock(&service.lock);
+    while (service.running) {
+        pthread_cond_wait(&service.changed, &service.lock);
+    }
+    pthread_mutex_unlock(&service.lock);
+}
@@ -0,0 +1,185 @@
+/**************************************************************
+* Class::  CSC-415-0# Spring 2024
+* Name::
+* Student IDs::
+* GitHub-Name::
+* Group-Name::
+* Project:: Basic File System
+*
+* File:: fsDentry.c
+*
+* Description:: Dentry cache for path resolution.  Maps a
+*   (parent directory block, name) pair to a copy of the child's
+*   directory entry so parsePath can walk cached components
+*   without loading each directory.  Entries are evicted least
+*   recently used first, and every entry of a directory is
+*   dropped whenever that directory is written.
+*
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "mfs.h"
+#include "vcb.h"
+
+#define DCACHE_SIZE 1024
+#define DCACHE_BUCKETS 2048  // Power of two
+
+struct dentry {
+    uint64_t parentBlock;       // First block of the directory holding the entry
+    uint32_t hash;              // dirNameHash of entry.filename
+    int slot;                   // Index of the entry in its parent
+    struct DirectoryEntry entry;
+    int hashNext;               // Next dentry in the same bucket, -1 ends the list
+    int lruPrev;                // Toward the most recently used end
+    int lruNext;
+    int inUse;
+};
+
+static struct dentry dentries[DCACHE_SIZE];
+static int buckets[DCACHE_BUCKETS];
+static int lruHead = -1;        // Most recently used
+static int lruTail = -1;
+static int freeList = -1;       // Unused dentries, chained through hashNext
+static int initialized = 0;
+static pthread_mutex_t dcacheLock = PTHREAD_MUTEX_INITIALIZER;
+
+uint32_t dirNameHash(const char *name);
+
+static int bucketOf(uint64_t parentBlock, uint32_t hash) {
+    return (hash ^ (uint32_t)(parentBlock * 2654435761u)) & (DCACHE_BUCKETS - 1);
+}
+
+static void lruUnlink(int d) {
+    if (dentries[d].lruPrev != -1) {
+        dentries[dentries[d].lruPrev].lruNext = dentries[d].lruNext;
+    } else {
+        lruHead = dentries[d].lruNext;
+    }
+    if (dentries[d].lruNext != -1) {
+        dentries[dentries[d].lruNext].lruPrev = dentries[d].lruPrev;
+    } else {
+        lruTail = dentries[d].lruPrev;
+    }
+}
+
+static void lruPushFront(int d) {
+    dentries[d].lruPrev = -1;
+    dentries[d].lruNext = lruHead;
+    if (lruHead != -1) {
+        dentries[lruHead].lruPrev = d;
+    } else {
+        lruTail = d;
+    }
+    lruHead = d;
+}
+
+// Takes d out of its bucket and the LRU list and puts it on the free list
+static void dentryRelease(int d) {
+    int *link = &buckets[bucketOf(dentries[d].parentBlock, dentries[d].hash)];
+    while (*link != d) {
+        link = &dentries[*link].hashNext;
+    }
+    *link = dentries[d].hashNext;
+    lruUnlink(d);
+
+    dentries[d].inUse = 0;
+    dentries[d].hashNext = freeList;
+    freeList = d;
+}
+
+// Empties the cache, called when a volume is mounted
+void dcacheClear() {
+    pthread_mutex_lock(&dcacheLock);
+    for (int i = 0; i < DCACHE_BUCKETS; i++) {
+        buckets[i] = -1;
+    }
+    freeList = -1;
+    for (int d = DCACHE_SIZE - 1; d >= 0; d--) {
+        dentries[d].inUse = 0;
+        dentries[d].hashNext = freeList;
+        freeList = d;
+    }
+    lruHead = -1;
+    lruTail = -1;
+    initialized = 1;
+    pthread_mutex_unlock(&dcacheLock);
+}
+
+// Copies the cached entry for name in the directory at parentBlock to
+// entry and its slot to slot (when not NULL).  Returns 0 on a hit, -1 on
+// a miss.
+int dcacheLookup(uint64_t parentBlock, const char *name, struct DirectoryEntry *entry, int *slot) {
+    if (!initialized) {
+        return -1;
+    }
+    uint32_t hash = dirNameHash(name);
+
+    pthread_mutex_lock(&dcacheLock);
+    for (int d = buckets[bucketOf(parentBlock, hash)]; d != -1; d = dentries[d].hashNext) {
+        if (dentries[d].parentBlock == parentBlock && dentries[d].hash == hash &&
+                strcmp(dentries[d].entry.filename, name) == 0) {
+            *entry = dentries[d].entry;
+            if (slot != NULL) {
+                *slot = dentries[d].slot;
+            }
+            lruUnlink(d);
+            lruPushFront(d);
+            pthread_mutex_unlock(&dcacheLock);
+            return 0;
+        }
+    }
+    pthread_mutex_unlock(&dcacheLock);
+    return -1;
+}
+
+// Caches entry, found in slot of the directory at parentBlock
+void dcacheInsert(uint64_t parentBlock, int slot, struct DirectoryEntry *entry) {
+    if (!initialized) {
+        return;
+    }
+    uint32_t hash = dirNameHash(entry->filename);
+
+    pthread_mutex_lock(&dcacheLock);
+    int bucket = bucketOf(parentBlock, hash);
+    for (int d = buckets[bucket]; d != -1; d = dentries[d].hashNext) {
+        if (dentries[d].parentBlock == parentBlock && dentries[d].hash == hash &&
+                strcmp(dentries[d].entry.filename, entry->filename) == 0) {
+            pthread_mutex_unlock(&dcacheLock);
+            return; // Already cached
+        }
+    }
+
+    if (freeList == -1) {
+        dentryRelease(lruTail);
+    }
+    int d = freeList;
+    freeList = dentries[d].hashNext;
+
+    dentries[d].parentBlock = parentBlock;
+    dentries[d].hash = hash;
+    dentries[d].slot = slot;
+    dentries[d].entry = *entry;
+    dentries[d].inUse = 1;
+    dentries[d].hashNext = buckets[bucket];
+    buckets[bucket] = d;
+    lruPushFront(d);
+    pthread_mutex_unlock(&dcacheLock);
+}
+
+// Drops every cached entry of the directory at parentBlock, called
+// whenever that directory changes on disk
+void dcacheInvalidateDir(uint64_t parentBlock) {
+    if (!initialized) {
+        return;
+    }
+    pthread_mutex_lock(&dcacheLock);
+    for (int d = 0; d < DCACHE_SIZE; d++) {
+        if (dentries[d].inUse && dentries[d].parentBlock == parentBlock) {
+            dentryRelease(d);
+        }
+    }
+    pthread_mutex_unlock(&dcacheLock);
+}
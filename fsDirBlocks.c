@@ -0,0 +1,520 @@
+/**************************************************************
+* Class::  CSC-415-0# Spring 2024
+* Name::
+* Student IDs::
+* GitHub-Name::
+* Group-Name::
+* Project:: Basic File System
+*
+* File:: fsDirBlocks.c
+*
+* Description:: Block-granular access to a directory on disk,
+*   for callers that need one entry or one pass over the
+*   entries rather than the whole loaded directory.  A reader
+*   holds the directory's layout from its "." entry and one
+*   cached block; a name lookup reads the index block its hash
+*   points at and the block holding the matching entry, and a
+*   listing reads the entry blocks in turn.  Entries are
+*   rewritten in place, and a compact directory's names are
+*   moved within its heap only when they change, so a changed
+*   directory is written a few blocks at a time.
+*
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include "mfs.h"
+#include "vcb.h"
+#include "fsLow.h"
+
+#define NO_BLOCK ((uint64_t)-1)
+
+extern struct VolumeControlBlock* vcb;
+extern struct FATEntry* fat;
+
+int dirCompact();
+uint32_t dirNameHash(const char *name);
+char *dirInlineData(struct DirectoryEntry *entry);
+uint32_t dirHeapChunk(uint64_t nameLength, uint64_t inlineBytes);
+int journalWrite(const void *buffer, uint64_t count, uint64_t lba);
+int journalRead(void *buffer, uint64_t count, uint64_t lba);
+
+struct dirReader {
+    uint64_t firstBlock;
+    int compact;                // Entries are DirSlots with names in a heap
+    uint64_t numEntries;
+    uint64_t slotSize;          // Bytes per entry on disk
+    uint64_t heapStart;         // Byte offsets into the directory
+    uint64_t indexStart;
+    uint16_t heapBlocks;
+    uint16_t indexBlocks;
+    uint8_t indexType;
+    uint32_t heapEnd;           // Heap state from ".", written back if heapChanged
+    uint32_t heapFree;
+    uint32_t heapLive;
+    int heapChanged;
+    uint64_t walkLogical;       // Last block found in the chain
+    uint64_t walkPhys;
+    uint64_t cachedLogical;     // Block held in block, NO_BLOCK if none
+    char *block;
+};
+
+// Physical block of a logical block of the directory, 0 past the end.
+// Walks forward from the last lookup, so in-order access is linear.
+static uint64_t physOf(struct dirReader *reader, uint64_t logical) {
+    if (reader->walkLogical == NO_BLOCK || logical < reader->walkLogical) {
+        reader->walkLogical = 0;
+        reader->walkPhys = reader->firstBlock;
+    }
+    while (reader->walkLogical < logical) {
+        uint64_t next = fat[reader->walkPhys].nextBlock;
+        if (next == 0 || next == FAT_EOF) {
+            return 0;
+        }
+        reader->walkPhys = next;
+        reader->walkLogical++;
+    }
+    return reader->walkPhys;
+}
+
+static char *blockAt(struct dirReader *reader, uint64_t logical) {
+    if (reader->cachedLogical == logical) {
+        return reader->block;
+    }
+    uint64_t phys = physOf(reader, logical);
+    reader->cachedLogical = NO_BLOCK;
+    if (phys == 0 || journalRead(reader->block, 1, phys) != 0) {
+        return NULL;
+    }
+    reader->cachedLogical = logical;
+    return reader->block;
+}
+
+// Copies length bytes at offset in the directory's on-disk image
+static int readBytes(struct dirReader *reader, uint64_t offset, void *out, uint64_t length) {
+    char *position = out;
+    while (length > 0) {
+        char *block = blockAt(reader, offset / vcb->blockSize);
+        if (block == NULL) {
+            return -1;
+        }
+        uint64_t within = offset % vcb->blockSize;
+        uint64_t chunk = vcb->blockSize - within;
+        if (chunk > length) {
+            chunk = length;
+        }
+        memcpy(position, block + within, chunk);
+        position += chunk;
+        offset += chunk;
+        length -= chunk;
+    }
+    return 0;
+}
+
+// Overwrites length bytes at offset, one read-modify-write per block
+static int writeBytes(struct dirReader *reader, uint64_t offset, const void *data, uint64_t length) {
+    const char *position = data;
+    while (length > 0) {
+        uint64_t logical = offset / vcb->blockSize;
+        uint64_t within = offset % vcb->blockSize;
+        uint64_t chunk = vcb->blockSize - within;
+        if (chunk > length) {
+            chunk = length;
+        }
+        char *block;
+        if (chunk == vcb->blockSize) {
+            block = reader->block; // Replaced outright, no need to read it
+            reader->cachedLogical = logical;
+        } else {
+            block = blockAt(reader, logical);
+        }
+        uint64_t phys = physOf(reader, logical);
+        if (block == NULL || phys == 0) {
+            reader->cachedLogical = NO_BLOCK;
+            return -1;
+        }
+        memcpy(block + within, position, chunk);
+        if (journalWrite(block, 1, phys) != 0) {
+            return -1;
+        }
+        position += chunk;
+        offset += chunk;
+        length -= chunk;
+    }
+    return 0;
+}
+
+static uint64_t roundToBlock(uint64_t bytes) {
+    return (bytes + vcb->blockSize - 1) / vcb->blockSize * vcb->blockSize;
+}
+
+// Opens the directory starting at firstBlock, reading only its first block
+struct dirReader *dirReaderOpen(uint64_t firstBlock) {
+    struct dirReader *reader = calloc(1, sizeof(struct dirReader));
+    if (reader == NULL) {
+        return NULL;
+    }
+    reader->block = malloc(vcb->blockSize);
+    if (reader->block == NULL) {
+        free(reader);
+        return NULL;
+    }
+    reader->firstBlock = firstBlock;
+    reader->walkLogical = NO_BLOCK;
+    reader->cachedLogical = NO_BLOCK;
+    reader->compact = dirCompact();
+
+    char *first = blockAt(reader, 0);
+    if (first == NULL) {
+        free(reader->block);
+        free(reader);
+        return NULL;
+    }
+    if (reader->compact) {
+        struct DirSlot *dot = (struct DirSlot *)first;
+        reader->slotSize = sizeof(struct DirSlot);
+        reader->numEntries = dot->fileSize / sizeof(struct DirSlot);
+        reader->heapStart = roundToBlock(dot->fileSize);
+        reader->indexStart = reader->heapStart + (uint64_t)dot->heapBlocks * vcb->blockSize;
+        reader->heapBlocks = dot->heapBlocks;
+        reader->indexBlocks = dot->indexBlocks;
+        reader->indexType = dot->indexType;
+        reader->heapEnd = dot->heapEnd;
+        reader->heapFree = dot->heapFree;
+        reader->heapLive = dot->heapLive;
+    } else {
+        struct DirectoryEntry *dot = (struct DirectoryEntry *)first;
+        reader->slotSize = sizeof(struct DirectoryEntry);
+        reader->numEntries = dot->fileSize / sizeof(struct DirectoryEntry);
+        reader->indexStart = roundToBlock(dot->fileSize);
+        reader->indexBlocks = dot->indexBlocks;
+        reader->indexType = dot->indexType;
+    }
+    return reader;
+}
+
+void dirReaderClose(struct dirReader *reader) {
+    if (reader != NULL) {
+        free(reader->block);
+        free(reader);
+    }
+}
+
+uint64_t dirReaderCount(struct dirReader *reader) {
+    return reader->numEntries;
+}
+
+uint8_t dirReaderIndexType(struct dirReader *reader) {
+    return reader->indexType;
+}
+
+// Fills entry with the entry in slot.  Returns 1 if the slot is in use, 0
+// if it is free, or -1 on a read error.
+int dirReaderEntry(struct dirReader *reader, uint64_t slot, struct DirectoryEntry *entry) {
+    memset(entry, 0, sizeof(struct DirectoryEntry));
+    if (!reader->compact) {
+        if (readBytes(reader, slot * reader->slotSize, entry, sizeof(struct DirectoryEntry)) != 0) {
+            return -1;
+        }
+        return entry->inUse;
+    }
+
+    struct DirSlot dirSlot;
+    if (readBytes(reader, slot * reader->slotSize, &dirSlot, sizeof(dirSlot)) != 0) {
+        return -1;
+    }
+    if (!dirSlot.inUse) {
+        return 0;
+    }
+    if (dirSlot.nameLength + 1 + (dirSlot.inlineData ? dirSlot.fileSize : 0) > MAX_FILENAME_LENGTH) {
+        return -1; // Corrupt slot, would not fit the entry
+    }
+    if (readBytes(reader, reader->heapStart + dirSlot.nameOffset, entry->filename, dirSlot.nameLength) != 0) {
+        return -1;
+    }
+    entry->filename[dirSlot.nameLength] = '\0';
+    entry->fileSize = dirSlot.fileSize;
+    entry->firstBlockIndex = dirSlot.firstBlockIndex;
+    entry->creationTime = dirSlot.creationTime;
+    entry->lastModifiedTime = dirSlot.lastModifiedTime;
+    entry->fileType = dirSlot.fileType;
+    entry->inUse = 1;
+    entry->linkCount = dirSlot.linkCount;
+    if (slot == 0) {
+        entry->fileSize = reader->numEntries * sizeof(struct DirectoryEntry);
+        entry->indexBlocks = dirSlot.indexBlocks;
+        entry->heapBlocks = dirSlot.heapBlocks;
+        entry->indexType = dirSlot.indexType;
+    }
+    if (dirSlot.inlineData) {
+        entry->inlineData = 1;
+        if (readBytes(reader, reader->heapStart + dirSlot.nameOffset + dirSlot.nameLength + 1,
+                dirInlineData(entry), dirSlot.fileSize) != 0) {
+            return -1;
+        }
+    }
+    return 1;
+}
+
+// Finds name through the hash index, reading only the blocks the probe
+// touches.  Returns the slot with entry filled, -1 if name is not there, or
+// -2 if the directory has no hash index to consult.
+int dirReaderLookup(struct dirReader *reader, const char *name, struct DirectoryEntry *entry) {
+    if (reader->indexType != DIR_INDEX_HASH || reader->indexBlocks == 0) {
+        return -2;
+    }
+    uint64_t capacity = (uint64_t)reader->indexBlocks * vcb->blockSize / sizeof(struct DirIndexSlot);
+    uint32_t hash = dirNameHash(name);
+    uint64_t i = hash & (capacity - 1);
+    for (uint64_t probes = 0; probes < capacity; probes++) {
+        struct DirIndexSlot indexSlot;
+        if (readBytes(reader, reader->indexStart + i * sizeof(indexSlot), &indexSlot, sizeof(indexSlot)) != 0) {
+            return -1;
+        }
+        if (indexSlot.slot == DIR_INDEX_EMPTY) {
+            return -1;
+        }
+        if (indexSlot.hash == hash && dirReaderEntry(reader, indexSlot.slot, entry) == 1 &&
+                strcmp(entry->filename, name) == 0) {
+            return indexSlot.slot;
+        }
+        i = (i + 1) & (capacity - 1);
+    }
+    return -1;
+}
+
+// Hands out size bytes of the heap: the tail of the first free chunk of
+// the few looked at that is big enough, or else the end of the heap.
+// Returns 0 with *offset set, 1 if the heap has no room, or -1 on an I/O
+// error.
+static int heapAlloc(struct dirReader *reader, uint32_t size, uint32_t *offset) {
+    uint32_t prev = DIR_HEAP_NONE;
+    uint32_t current = reader->heapFree;
+    for (int tries = 0; current != DIR_HEAP_NONE && tries < DIR_HEAP_FIT_TRIES; tries++) {
+        struct DirHeapFree chunk;
+        if ((uint64_t)current + sizeof(chunk) > reader->heapEnd) {
+            return 1; // Damaged list, a whole write repacks the heap
+        }
+        if (readBytes(reader, reader->heapStart + current, &chunk, sizeof(chunk)) != 0) {
+            return -1;
+        }
+        if (chunk.size == 0 || (uint64_t)current + chunk.size > reader->heapEnd) {
+            return 1;
+        }
+        if (chunk.size > size) {
+            // The front stays free, so the list is unchanged
+            chunk.size -= size;
+            if (writeBytes(reader, reader->heapStart + current, &chunk, sizeof(chunk)) != 0) {
+                return -1;
+            }
+            *offset = current + chunk.size;
+            reader->heapLive += size;
+            reader->heapChanged = 1;
+            return 0;
+        }
+        if (chunk.size == size) {
+            if (prev == DIR_HEAP_NONE) {
+                reader->heapFree = chunk.next;
+            } else if (writeBytes(reader, reader->heapStart + prev + offsetof(struct DirHeapFree, next),
+                    &chunk.next, sizeof(chunk.next)) != 0) {
+                return -1;
+            }
+            *offset = current;
+            reader->heapLive += size;
+            reader->heapChanged = 1;
+            return 0;
+        }
+        prev = current;
+        current = chunk.next;
+    }
+
+    if ((uint64_t)reader->heapEnd + size > (uint64_t)reader->heapBlocks * vcb->blockSize) {
+        return 1;
+    }
+    *offset = reader->heapEnd;
+    reader->heapEnd += size;
+    reader->heapLive += size;
+    reader->heapChanged = 1;
+    return 0;
+}
+
+// Gives back the size-byte chunk at offset.  The last chunk just moves
+// the end of the heap back; others go on the free list unmerged.
+static int heapRelease(struct dirReader *reader, uint32_t offset, uint32_t size) {
+    reader->heapLive -= size;
+    reader->heapChanged = 1;
+    if (offset + size == reader->heapEnd) {
+        reader->heapEnd = offset;
+        return 0;
+    }
+    struct DirHeapFree chunk = { reader->heapFree, size };
+    if (writeBytes(reader, reader->heapStart + offset, &chunk, sizeof(chunk)) != 0) {
+        return -1;
+    }
+    reader->heapFree = offset;
+    return 0;
+}
+
+// Records the heap state in "."
+static int storeHeap(struct dirReader *reader) {
+    struct DirSlot dot;
+    if (readBytes(reader, 0, &dot, sizeof(dot)) != 0) {
+        return -1;
+    }
+    dot.heapEnd = reader->heapEnd;
+    dot.heapFree = reader->heapFree;
+    dot.heapLive = reader->heapLive;
+    reader->heapChanged = 0;
+    return writeBytes(reader, 0, &dot, sizeof(dot));
+}
+
+// Writes entry, or a free slot if it is not in use, into slot of a
+// compact directory.  Its name and inline data keep their place in the
+// heap unless they changed.  Returns as dirReaderUpdate.
+static int putSlot(struct dirReader *reader, uint64_t slot, struct DirectoryEntry *entry) {
+    struct DirSlot dirSlot;
+    if (readBytes(reader, slot * reader->slotSize, &dirSlot, sizeof(dirSlot)) != 0) {
+        return -1;
+    }
+    uint64_t nameLength = strlen(entry->filename);
+    uint64_t inlineBytes = entry->inlineData ? entry->fileSize : 0;
+
+    int moved = 1;
+    if (dirSlot.inUse && entry->inUse && dirSlot.nameLength == nameLength &&
+            dirSlot.inlineData == entry->inlineData && (!entry->inlineData || dirSlot.fileSize == inlineBytes)) {
+        char held[MAX_FILENAME_LENGTH];
+        if (readBytes(reader, reader->heapStart + dirSlot.nameOffset, held, nameLength + 1 + inlineBytes) != 0) {
+            return -1;
+        }
+        moved = memcmp(held, entry->filename, nameLength) != 0 ||
+                memcmp(held + nameLength + 1, dirInlineData(entry), inlineBytes) != 0;
+    }
+
+    uint32_t nameOffset = dirSlot.nameOffset;
+    if (moved && (dirSlot.inUse || entry->inUse)) {
+        if (reader->heapEnd == 0) {
+            return 1; // Heap packed by an older version, not tracked
+        }
+        if (dirSlot.inUse && heapRelease(reader, dirSlot.nameOffset,
+                dirHeapChunk(dirSlot.nameLength, dirSlot.inlineData ? dirSlot.fileSize : 0)) != 0) {
+            return -1;
+        }
+        if (entry->inUse) {
+            int result = heapAlloc(reader, dirHeapChunk(nameLength, inlineBytes), &nameOffset);
+            if (result != 0) {
+                return result;
+            }
+            if (writeBytes(reader, reader->heapStart + nameOffset, entry->filename, nameLength + 1) != 0 ||
+                    writeBytes(reader, reader->heapStart + nameOffset + nameLength + 1,
+                    dirInlineData(entry), inlineBytes) != 0) {
+                return -1;
+            }
+        }
+    }
+
+    memset(&dirSlot, 0, sizeof(dirSlot));
+    if (entry->inUse) {
+        dirSlot.hash = dirNameHash(entry->filename);
+        dirSlot.nameOffset = nameOffset;
+        dirSlot.nameLength = nameLength;
+        dirSlot.fileSize = entry->fileSize;
+        dirSlot.firstBlockIndex = entry->firstBlockIndex;
+        dirSlot.creationTime = entry->creationTime;
+        dirSlot.lastModifiedTime = entry->lastModifiedTime;
+        dirSlot.fileType = entry->fileType;
+        dirSlot.inUse = 1;
+        dirSlot.linkCount = entry->linkCount;
+        dirSlot.inlineData = entry->inlineData;
+    }
+    return writeBytes(reader, slot * reader->slotSize, &dirSlot, sizeof(dirSlot));
+}
+
+// Rewrites the entry in slot where it lies.  Returns 0 when done, 1 if the
+// whole directory must be written instead ("." or a name that does not
+// fit the heap), or -1 on an I/O error.
+int dirReaderUpdate(struct dirReader *reader, uint64_t slot, struct DirectoryEntry *entry) {
+    if (slot == 0 || slot >= reader->numEntries) {
+        return 1; // "." carries the layout
+    }
+    if (!reader->compact) {
+        return writeBytes(reader, slot * reader->slotSize, entry, sizeof(struct DirectoryEntry));
+    }
+    int result = putSlot(reader, slot, entry);
+    if (result == 0 && reader->heapChanged) {
+        result = storeHeap(reader);
+    }
+    return result;
+}
+
+// Writes the given slots and index blocks of the loaded directory dir
+// over the same directory on disk, which must otherwise match it.
+// Returns as dirReaderUpdate; 1 also when the layout differs or the heap
+// is due to shrink.
+int dirReaderStore(struct dirReader *reader, struct DirectoryEntry *dir, const int *slots, int slotCount,
+        const uint64_t *indexBlocks, int indexCount) {
+    uint64_t entryBlocks = (dir[0].fileSize + vcb->blockSize - 1) / vcb->blockSize;
+    if (reader->numEntries != dir[0].fileSize / sizeof(struct DirectoryEntry) ||
+            reader->indexBlocks != dir[0].indexBlocks || reader->indexType != dir[0].indexType ||
+            (reader->compact && (reader->heapBlocks != dir[0].heapBlocks || reader->heapEnd == 0))) {
+        return 1;
+    }
+
+    for (int i = 0; i < slotCount; i++) {
+        int result;
+        if (slots[i] == 0 || (uint64_t)slots[i] >= reader->numEntries) {
+            return 1;
+        }
+        if (reader->compact) {
+            result = putSlot(reader, slots[i], &dir[slots[i]]);
+        } else {
+            result = writeBytes(reader, slots[i] * reader->slotSize, &dir[slots[i]], sizeof(struct DirectoryEntry));
+        }
+        if (result != 0) {
+            return result;
+        }
+    }
+    for (int i = 0; i < indexCount; i++) {
+        if (writeBytes(reader, reader->indexStart + indexBlocks[i] * vcb->blockSize,
+                (char *)dir + (entryBlocks + indexBlocks[i]) * vcb->blockSize, vcb->blockSize) != 0) {
+            return -1;
+        }
+    }
+
+    if (!reader->compact) {
+        return 0;
+    }
+    if (reader->heapBlocks > 1 && (uint64_t)reader->heapLive * 4 < (uint64_t)reader->heapBlocks * vcb->blockSize) {
+        return 1; // Mostly empty, let the whole write halve it
+    }
+    return reader->heapChanged ? storeHeap(reader) : 0;
+}
+
+// Looks name up in the directory at dirBlock without loading it.  Returns
+// as dirReaderLookup does.
+int dirLookupBlock(uint64_t dirBlock, const char *name, struct DirectoryEntry *entry) {
+    struct dirReader *reader = dirReaderOpen(dirBlock);
+    if (reader == NULL) {
+        return -2;
+    }
+    int slot = dirReaderLookup(reader, name, entry);
+    dirReaderClose(reader);
+    return slot;
+}
+
+// Returns 1 if the directory at dirBlock is ancestor or lies below it,
+// following ".." up to the root
+int dirIsWithin(uint64_t dirBlock, uint64_t ancestor) {
+    while (dirBlock != ancestor) {
+        struct dirReader *reader = dirReaderOpen(dirBlock);
+        struct DirectoryEntry dotDot;
+        int found = (reader != NULL) && (dirReaderEntry(reader, 1, &dotDot) == 1);
+        dirReaderClose(reader);
+        if (!found || dotDot.firstBlockIndex == dirBlock) {
+            return 0; // Reached the root
+        }
+        dirBlock = dotDot.firstBlockIndex;
+    }
+    return 1;
+}
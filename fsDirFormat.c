@@ -0,0 +1,192 @@
+/**************************************************************
+* Class::  CSC-415-0# Spring 2024
+* Name::
+* Student IDs::
+* GitHub-Name::
+* Group-Name::
+* Project:: Basic File System
+*
+* File:: fsDirFormat.c
+*
+* Description:: On-disk directory formats.  Loaded directories
+*   are always an array of DirectoryEntry followed by the name
+*   index.  Volumes formatted with compact directories store
+*   64-byte DirSlots and a name heap instead, so these
+*   routines translate between the two images.
+*
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mfs.h"
+#include "vcb.h"
+
+extern struct VolumeControlBlock* vcb;
+
+uint32_t dirNameHash(const char *name);
+uint64_t dirTotalBlocks(struct DirectoryEntry *dir);
+
+static uint64_t blocksFor(uint64_t bytes) {
+    return (bytes + vcb->blockSize - 1) / vcb->blockSize;
+}
+
+int dirCompact() {
+    return vcb->fsVersion == FS_VERSION_COMPACT_DIRS;
+}
+
+// Blocks the directory occupies on disk
+uint64_t dirDiskBlocks(struct DirectoryEntry *dir) {
+    if (!dirCompact()) {
+        return dirTotalBlocks(dir);
+    }
+    uint64_t numEntries = dir[0].fileSize / sizeof(struct DirectoryEntry);
+    return blocksFor(numEntries * sizeof(struct DirSlot)) + dir[0].heapBlocks + dir[0].indexBlocks;
+}
+
+// Blocks the directory occupies on disk, judged from its first block
+uint64_t dirDiskBlocksFromFirst(void *firstBlock) {
+    if (!dirCompact()) {
+        return dirTotalBlocks(firstBlock);
+    }
+    struct DirSlot *dot = firstBlock;
+    return blocksFor(dot->fileSize) + dot->heapBlocks + dot->indexBlocks;
+}
+
+// Room for inline data left in the filename field of an entry named name.
+// Small files keep their data at the end of the field, clear of the name,
+// instead of in a block of their own.
+uint64_t dirInlineRoom(const char *name) {
+    return MAX_FILENAME_LENGTH - strlen(name) - 1;
+}
+
+// Where the data of an inline file starts
+char *dirInlineData(struct DirectoryEntry *entry) {
+    return entry->filename + MAX_FILENAME_LENGTH - entry->fileSize;
+}
+
+// Heap bytes taken by a name of nameLength characters followed by
+// inlineBytes of data, rounded to whole chunks
+uint32_t dirHeapChunk(uint64_t nameLength, uint64_t inlineBytes) {
+    return (nameLength + 1 + inlineBytes + DIR_HEAP_UNIT - 1) / DIR_HEAP_UNIT * DIR_HEAP_UNIT;
+}
+
+static uint32_t entryChunk(struct DirectoryEntry *entry) {
+    return dirHeapChunk(strlen(entry->filename), entry->inlineData ? entry->fileSize : 0);
+}
+
+// Name heap blocks a compact directory needs for its current names and
+// inline data.  The
+// heap doubles when it overflows and halves once it is mostly empty, so
+// it is not resized on every create and delete.
+uint16_t dirHeapBlocks(struct DirectoryEntry *dir) {
+    int numEntries = dir[0].fileSize / sizeof(struct DirectoryEntry);
+    uint64_t bytes = 0;
+    for (int i = 0; i < numEntries; i++) {
+        if (dir[i].inUse) {
+            bytes += entryChunk(&dir[i]);
+        }
+    }
+
+    uint64_t blocks = (dir[0].heapBlocks > 0) ? dir[0].heapBlocks : 1;
+    while (blocks * vcb->blockSize < bytes) {
+        blocks *= 2;
+    }
+    while (blocks > 1 && bytes * 4 < blocks * vcb->blockSize) {
+        blocks /= 2;
+    }
+    return blocks;
+}
+
+// Builds the on-disk image of a loaded compact directory, with the names
+// packed at the start of the heap and no free chunks.  The caller has
+// already sized dir[0].heapBlocks with dirHeapBlocks.
+void *encodeDir(struct DirectoryEntry *dir) {
+    uint64_t numEntries = dir[0].fileSize / sizeof(struct DirectoryEntry);
+    uint64_t slotBlocks = blocksFor(numEntries * sizeof(struct DirSlot));
+    char *disk = calloc(dirDiskBlocks(dir), vcb->blockSize);
+    if (disk == NULL) {
+        return NULL;
+    }
+
+    struct DirSlot *slots = (struct DirSlot *)disk;
+    char *heap = disk + slotBlocks * vcb->blockSize;
+    uint32_t heapUsed = 0;
+    for (uint64_t i = 0; i < numEntries; i++) {
+        if (!dir[i].inUse) {
+            continue;
+        }
+        uint16_t length = strlen(dir[i].filename);
+        slots[i].hash = dirNameHash(dir[i].filename);
+        slots[i].nameOffset = heapUsed;
+        slots[i].nameLength = length;
+        slots[i].fileSize = dir[i].fileSize;
+        slots[i].firstBlockIndex = dir[i].firstBlockIndex;
+        slots[i].creationTime = dir[i].creationTime;
+        slots[i].lastModifiedTime = dir[i].lastModifiedTime;
+        slots[i].fileType = dir[i].fileType;
+        slots[i].inUse = 1;
+        slots[i].linkCount = dir[i].linkCount;
+        memcpy(heap + heapUsed, dir[i].filename, length + 1);
+        if (dir[i].inlineData) {
+            slots[i].inlineData = 1;
+            memcpy(heap + heapUsed + length + 1, dirInlineData(&dir[i]), dir[i].fileSize);
+        }
+        heapUsed += entryChunk(&dir[i]);
+    }
+    slots[0].fileSize = numEntries * sizeof(struct DirSlot);
+    slots[0].indexBlocks = dir[0].indexBlocks;
+    slots[0].heapBlocks = dir[0].heapBlocks;
+    slots[0].indexType = dir[0].indexType;
+    slots[0].heapEnd = heapUsed;
+    slots[0].heapFree = DIR_HEAP_NONE;
+    slots[0].heapLive = heapUsed;
+
+    char *index = heap + dir[0].heapBlocks * vcb->blockSize;
+    uint64_t entryBlocks = blocksFor(dir[0].fileSize);
+    memcpy(index, (char *)dir + entryBlocks * vcb->blockSize, dir[0].indexBlocks * vcb->blockSize);
+    return disk;
+}
+
+// Expands the on-disk image of a compact directory into a loaded directory
+struct DirectoryEntry *decodeDir(void *diskImage) {
+    char *disk = diskImage;
+    struct DirSlot *slots = diskImage;
+    uint64_t numEntries = slots[0].fileSize / sizeof(struct DirSlot);
+    uint64_t slotBlocks = blocksFor(slots[0].fileSize);
+    uint64_t entryBlocks = blocksFor(numEntries * sizeof(struct DirectoryEntry));
+
+    struct DirectoryEntry *dir = calloc(entryBlocks + slots[0].indexBlocks, vcb->blockSize);
+    if (dir == NULL) {
+        return NULL;
+    }
+
+    char *heap = disk + slotBlocks * vcb->blockSize;
+    for (uint64_t i = 0; i < numEntries; i++) {
+        if (!slots[i].inUse) {
+            continue;
+        }
+        memcpy(dir[i].filename, heap + slots[i].nameOffset, slots[i].nameLength);
+        dir[i].filename[slots[i].nameLength] = '\0';
+        dir[i].fileSize = slots[i].fileSize;
+        dir[i].firstBlockIndex = slots[i].firstBlockIndex;
+        dir[i].creationTime = slots[i].creationTime;
+        dir[i].lastModifiedTime = slots[i].lastModifiedTime;
+        dir[i].fileType = slots[i].fileType;
+        dir[i].inUse = 1;
+        dir[i].linkCount = slots[i].linkCount;
+        if (slots[i].inlineData) {
+            dir[i].inlineData = 1;
+            memcpy(dirInlineData(&dir[i]), heap + slots[i].nameOffset + slots[i].nameLength + 1,
+                    slots[i].fileSize);
+        }
+    }
+    dir[0].fileSize = numEntries * sizeof(struct DirectoryEntry);
+    dir[0].indexBlocks = slots[0].indexBlocks;
+    dir[0].heapBlocks = slots[0].heapBlocks;
+    dir[0].indexType = slots[0].indexType;
+
+    char *index = heap + slots[0].heapBlocks * vcb->blockSize;
+    memcpy((char *)dir + entryBlocks * vcb->blockSize, index, slots[0].indexBlocks * vcb->blockSize);
+    return dir;
+}
@@ -0,0 +1,170 @@
+/**************************************************************
+* Class::  CSC-415-0# Spring 2024
+* Name::
+* Student IDs::
+* GitHub-Name::
+* Group-Name::
+* Project:: Basic File System
+*
+* File:: fsDirIndex.c
+*
+* Description:: Name index kept with every directory.  The
+*   index is stored in the blocks that follow the directory
+*   entries in the directory's own chain, and loaded with it.
+*   By default it is an open addressing table of (name hash,
+*   entry slot) pairs: lookups probe from the name's home slot
+*   and compare only entries whose full hash matches.  Ordered
+*   directories use the B+tree in fsDirTree.c instead.
+*
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mfs.h"
+#include "vcb.h"
+
+extern struct VolumeControlBlock* vcb;
+
+// 32-bit FNV-1a
+uint32_t dirNameHash(const char *name) {
+    uint32_t hash = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)name; *p != '\0'; p++) {
+        hash ^= *p;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+uint16_t dirTreeBlocks(int numEntries);
+void dirTreeBuild(struct DirectoryEntry *dir);
+void dirTreeInsert(struct DirectoryEntry *dir, int slot);
+void dirTreeRemove(struct DirectoryEntry *dir, int slot);
+int dirTreeLookup(struct DirectoryEntry *dir, const char *name);
+void dirMarkIndex(struct DirectoryEntry *dir, uint64_t offset, uint64_t length);
+
+// Blocks needed by the index of a directory with numEntries slots.  The
+// table keeps at least twice as many slots as entries so probe runs stay
+// short; a block size that is a power of two keeps the capacity one too.
+uint16_t dirIndexBlocks(int numEntries, uint8_t indexType) {
+    if (indexType == DIR_INDEX_BTREE) {
+        return dirTreeBlocks(numEntries);
+    }
+    uint64_t capacity = 1;
+    while (capacity < (uint64_t)numEntries * 2) {
+        capacity *= 2;
+    }
+    uint64_t bytes = capacity * sizeof(struct DirIndexSlot);
+    return (bytes + vcb->blockSize - 1) / vcb->blockSize;
+}
+
+// The index sits right after the entry blocks of a loaded directory
+static struct DirIndexSlot *dirIndexTable(struct DirectoryEntry *dir, uint64_t *capacity) {
+    uint64_t entryBlocks = (dir[0].fileSize + vcb->blockSize - 1) / vcb->blockSize;
+    *capacity = dir[0].indexBlocks * vcb->blockSize / sizeof(struct DirIndexSlot);
+    return (struct DirIndexSlot *)((char *)dir + entryBlocks * vcb->blockSize);
+}
+
+// Records the entry in slot in the index
+void dirIndexInsert(struct DirectoryEntry *dir, int slot) {
+    if (dir[0].indexType == DIR_INDEX_BTREE) {
+        dirTreeInsert(dir, slot);
+        return;
+    }
+    uint64_t capacity;
+    struct DirIndexSlot *table = dirIndexTable(dir, &capacity);
+    if (capacity == 0) {
+        return;
+    }
+
+    uint32_t hash = dirNameHash(dir[slot].filename);
+    uint64_t i = hash & (capacity - 1);
+    while (table[i].slot != DIR_INDEX_EMPTY) {
+        i = (i + 1) & (capacity - 1);
+    }
+    table[i].hash = hash;
+    table[i].slot = slot;
+    dirMarkIndex(dir, i * sizeof(struct DirIndexSlot), sizeof(struct DirIndexSlot));
+}
+
+// Drops the entry in slot from the index.  Later members of the same probe
+// run are shifted back into the gap, so the table never needs tombstones.
+void dirIndexRemove(struct DirectoryEntry *dir, int slot) {
+    if (dir[0].indexType == DIR_INDEX_BTREE) {
+        dirTreeRemove(dir, slot);
+        return;
+    }
+    uint64_t capacity;
+    struct DirIndexSlot *table = dirIndexTable(dir, &capacity);
+    if (capacity == 0) {
+        return;
+    }
+
+    uint64_t mask = capacity - 1;
+    uint64_t i = dirNameHash(dir[slot].filename) & mask;
+    while (table[i].slot != (uint32_t)slot) {
+        if (table[i].slot == DIR_INDEX_EMPTY) {
+            return; // Not indexed
+        }
+        i = (i + 1) & mask;
+    }
+
+    uint64_t gap = i;
+    for (uint64_t j = (gap + 1) & mask; table[j].slot != DIR_INDEX_EMPTY; j = (j + 1) & mask) {
+        uint64_t home = table[j].hash & mask;
+        // Move j into the gap unless its home lies cyclically in (gap, j]
+        int homeBetween = (gap <= j) ? (home > gap && home <= j) : (home > gap || home <= j);
+        if (!homeBetween) {
+            table[gap] = table[j];
+            dirMarkIndex(dir, gap * sizeof(struct DirIndexSlot), sizeof(struct DirIndexSlot));
+            gap = j;
+        }
+    }
+    table[gap].slot = DIR_INDEX_EMPTY;
+    dirMarkIndex(dir, gap * sizeof(struct DirIndexSlot), sizeof(struct DirIndexSlot));
+}
+
+// Fills the index from scratch with every entry in use
+void dirIndexBuild(struct DirectoryEntry *dir) {
+    if (dir[0].indexType == DIR_INDEX_BTREE) {
+        dirTreeBuild(dir);
+        return;
+    }
+    uint64_t capacity;
+    struct DirIndexSlot *table = dirIndexTable(dir, &capacity);
+    memset(table, 0xFF, dir[0].indexBlocks * vcb->blockSize); // Every slot DIR_INDEX_EMPTY
+    dirMarkIndex(dir, 0, dir[0].indexBlocks * vcb->blockSize);
+
+    int numEntries = dir[0].fileSize / sizeof(struct DirectoryEntry);
+    for (int i = 0; i < numEntries; i++) {
+        if (dir[i].inUse) {
+            dirIndexInsert(dir, i);
+        }
+    }
+}
+
+// Returns the slot of name, -1 if it is not in the directory, or -2 if
+// the directory carries no index
+int dirIndexLookup(struct DirectoryEntry *dir, const char *name) {
+    if (dir[0].indexType == DIR_INDEX_BTREE && dir[0].indexBlocks > 0) {
+        return dirTreeLookup(dir, name);
+    }
+    uint64_t capacity;
+    struct DirIndexSlot *table = dirIndexTable(dir, &capacity);
+    if (capacity == 0) {
+        return -2;
+    }
+
+    uint32_t hash = dirNameHash(name);
+    uint64_t i = hash & (capacity - 1);
+    for (uint64_t probes = 0; probes < capacity; probes++) {
+        if (table[i].slot == DIR_INDEX_EMPTY) {
+            return -1;
+        }
+        if (table[i].hash == hash && strcmp(dir[table[i].slot].filename, name) == 0) {
+            return table[i].slot;
+        }
+        i = (i + 1) & (capacity - 1);
+    }
+    return -1;
+}
@@ -0,0 +1,476 @@
+/**************************************************************
+* Class::  CSC-415-0# Spring 2024
+* Name::
+* Student IDs::
+* GitHub-Name::
+* Group-Name::
+* Project:: Basic File System
+*
+* File:: fsDirTree.c
+*
+* Description:: B+tree name index for ordered directories.  The
+*   tree lives in the directory's index blocks, one node per
+*   block, with node 0 holding the tree header.  Keys are entry
+*   slots compared by the entry's name, so separators always
+*   name a live entry: removing an entry that is also a
+*   separator puts its in-order successor in its place.  Leaves
+*   are linked in name order for sorted listings and range
+*   scans.  Nodes left empty by deletes are unlinked; when the
+*   node pool runs out the tree is rebuilt compactly.
+*
+**************************************************************/
+
+#define _GNU_SOURCE     // qsort_r
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mfs.h"
+#include "vcb.h"
+
+#define TREE_MAX_HEIGHT 16
+
+extern struct VolumeControlBlock* vcb;
+
+struct DirTreeHeader {
+    uint32_t root;          // Root node, a leaf while the tree is small
+    uint32_t height;        // 1 when the root is a leaf
+    uint32_t nodeCount;     // Nodes ever handed out, including the header
+    uint32_t freeNode;      // Head of the freed node list, 0 if empty
+};
+
+struct DirTreeNode {
+    uint16_t leaf;
+    uint16_t count;         // Keys in the node
+    uint32_t next;          // Leaves: next leaf in name order, 0 at the end
+    uint32_t prev;          // Leaves: previous leaf, 0 at the start
+    uint32_t items[];       // Leaves: slots.  Internal: keys, then children
+};
+
+void dirMarkIndex(struct DirectoryEntry *dir, uint64_t offset, uint64_t length);
+
+struct dirTree {
+    struct DirectoryEntry *dir;
+    struct DirTreeHeader *header;
+    char *nodes;
+    uint32_t nodeLimit;
+    uint32_t leafCap;
+    uint32_t innerCap;
+};
+
+static void treeOpen(struct DirectoryEntry *dir, struct dirTree *tree) {
+    uint64_t entryBlocks = (dir[0].fileSize + vcb->blockSize - 1) / vcb->blockSize;
+    tree->dir = dir;
+    tree->nodes = (char *)dir + entryBlocks * vcb->blockSize;
+    tree->header = (struct DirTreeHeader *)tree->nodes;
+    tree->nodeLimit = dir[0].indexBlocks;
+    tree->leafCap = (vcb->blockSize - sizeof(struct DirTreeNode)) / sizeof(uint32_t);
+    tree->innerCap = (vcb->blockSize - sizeof(struct DirTreeNode) - sizeof(uint32_t)) / (2 * sizeof(uint32_t));
+}
+
+static struct DirTreeNode *node(struct dirTree *tree, uint32_t n) {
+    return (struct DirTreeNode *)(tree->nodes + (uint64_t)n * vcb->blockSize);
+}
+
+// Node n, about to be changed
+static struct DirTreeNode *change(struct dirTree *tree, uint32_t n) {
+    dirMarkIndex(tree->dir, (uint64_t)n * vcb->blockSize, vcb->blockSize);
+    return node(tree, n);
+}
+
+static uint32_t *keysOf(struct DirTreeNode *n) {
+    return n->items;
+}
+
+static uint32_t *childrenOf(struct dirTree *tree, struct DirTreeNode *n) {
+    return n->items + tree->innerCap;
+}
+
+static const char *nameOf(struct dirTree *tree, uint32_t slot) {
+    return tree->dir[slot].filename;
+}
+
+static uint32_t freeNodes(struct dirTree *tree) {
+    uint32_t count = tree->nodeLimit - tree->header->nodeCount;
+    for (uint32_t n = tree->header->freeNode; n != 0; n = node(tree, n)->next) {
+        count++;
+    }
+    return count;
+}
+
+static uint32_t newNode(struct dirTree *tree, int leaf) {
+    change(tree, 0);
+    uint32_t n = tree->header->freeNode;
+    if (n != 0) {
+        tree->header->freeNode = node(tree, n)->next;
+    } else {
+        n = tree->header->nodeCount++;
+    }
+    memset(change(tree, n), 0, vcb->blockSize);
+    node(tree, n)->leaf = leaf;
+    return n;
+}
+
+static void releaseNode(struct dirTree *tree, uint32_t n) {
+    change(tree, n)->next = tree->header->freeNode;
+    change(tree, 0);
+    tree->header->freeNode = n;
+}
+
+// Index of the child of an internal node to follow for name
+static int childFor(struct dirTree *tree, struct DirTreeNode *n, const char *name) {
+    int low = 0, high = n->count;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (strcmp(name, nameOf(tree, keysOf(n)[mid])) < 0) {
+            high = mid;
+        } else {
+            low = mid + 1;
+        }
+    }
+    return low;
+}
+
+// First position in a leaf whose name is not below name
+static int lowerBound(struct dirTree *tree, struct DirTreeNode *n, const char *name) {
+    int low = 0, high = n->count;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (strcmp(nameOf(tree, n->items[mid]), name) < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+// Descends to the leaf for name, recording the path
+static uint32_t descend(struct dirTree *tree, const char *name, uint32_t *path, int *childIndex) {
+    uint32_t n = tree->header->root;
+    for (uint32_t level = 0; level + 1 < tree->header->height; level++) {
+        int c = childFor(tree, node(tree, n), name);
+        path[level] = n;
+        childIndex[level] = c;
+        n = childrenOf(tree, node(tree, n))[c];
+    }
+    return n;
+}
+
+static int compareSlots(const void *a, const void *b, void *context) {
+    struct dirTree *tree = context;
+    return strcmp(nameOf(tree, *(const uint32_t *)a), nameOf(tree, *(const uint32_t *)b));
+}
+
+// Blocks needed for the tree of a directory with numEntries slots.  Leaves
+// split half full, so the pool allows for that plus the inner nodes.
+uint16_t dirTreeBlocks(int numEntries) {
+    uint32_t leafCap = (vcb->blockSize - sizeof(struct DirTreeNode)) / sizeof(uint32_t);
+    uint32_t innerCap = (vcb->blockSize - sizeof(struct DirTreeNode) - sizeof(uint32_t)) / (2 * sizeof(uint32_t));
+    uint64_t leaves = (numEntries + leafCap / 2 - 1) / (leafCap / 2) + 1;
+    uint64_t inner = leaves / (innerCap / 2) + TREE_MAX_HEIGHT;
+    return 1 + leaves + inner;
+}
+
+// Bulk loads the tree with every entry in use, leaves packed full
+void dirTreeBuild(struct DirectoryEntry *dir) {
+    struct dirTree tree;
+    treeOpen(dir, &tree);
+    memset(tree.nodes, 0, tree.nodeLimit * vcb->blockSize);
+    dirMarkIndex(dir, 0, tree.nodeLimit * vcb->blockSize);
+    tree.header->nodeCount = 1;
+
+    int numEntries = dir[0].fileSize / sizeof(struct DirectoryEntry);
+    uint32_t *sorted = malloc((numEntries + 1) * sizeof(uint32_t));
+    uint32_t count = 0;
+    for (int i = 0; i < numEntries; i++) {
+        if (dir[i].inUse) {
+            sorted[count++] = i;
+        }
+    }
+    qsort_r(sorted, count, sizeof(uint32_t), compareSlots, &tree);
+
+    // Leaves first, remembering each node's smallest key for the level above
+    uint32_t levelCount = 0;
+    uint32_t *level = malloc(((count + tree.leafCap - 1) / tree.leafCap + 1) * sizeof(uint32_t));
+    uint32_t *levelMin = malloc(((count + tree.leafCap - 1) / tree.leafCap + 1) * sizeof(uint32_t));
+    uint32_t prev = 0;
+    for (uint32_t i = 0; i == 0 || i < count; i += tree.leafCap) {
+        uint32_t n = newNode(&tree, 1);
+        struct DirTreeNode *leaf = node(&tree, n);
+        leaf->count = (count - i < tree.leafCap) ? count - i : tree.leafCap;
+        memcpy(leaf->items, sorted + i, leaf->count * sizeof(uint32_t));
+        leaf->prev = prev;
+        if (prev != 0) {
+            node(&tree, prev)->next = n;
+        }
+        prev = n;
+        levelMin[levelCount] = (leaf->count > 0) ? leaf->items[0] : 0;
+        level[levelCount++] = n;
+    }
+
+    uint32_t height = 1;
+    while (levelCount > 1) {
+        uint32_t parents = 0;
+        for (uint32_t i = 0; i < levelCount; i += tree.innerCap + 1) {
+            uint32_t n = newNode(&tree, 0);
+            struct DirTreeNode *inner = node(&tree, n);
+            uint32_t children = (levelCount - i < tree.innerCap + 1) ? levelCount - i : tree.innerCap + 1;
+            for (uint32_t c = 0; c < children; c++) {
+                childrenOf(&tree, inner)[c] = level[i + c];
+                if (c > 0) {
+                    keysOf(inner)[c - 1] = levelMin[i + c];
+                }
+            }
+            inner->count = children - 1;
+            levelMin[parents] = levelMin[i];
+            level[parents++] = n;
+        }
+        levelCount = parents;
+        height++;
+    }
+    tree.header->root = level[0];
+    tree.header->height = height;
+
+    free(level);
+    free(levelMin);
+    free(sorted);
+}
+
+// Adds slot to the tree.  Returns -1 without changing anything if the node
+// pool might run out on the way.
+static int treeInsert(struct dirTree *tree, uint32_t slot) {
+    if (freeNodes(tree) < tree->header->height + 1) {
+        return -1;
+    }
+
+    const char *name = nameOf(tree, slot);
+    uint32_t path[TREE_MAX_HEIGHT];
+    int childIndex[TREE_MAX_HEIGHT];
+    uint32_t n = descend(tree, name, path, childIndex);
+    struct DirTreeNode *leaf = change(tree, n);
+
+    int position = lowerBound(tree, leaf, name);
+    uint32_t carryKey, carryChild;
+    if (leaf->count < tree->leafCap) {
+        memmove(&leaf->items[position + 1], &leaf->items[position], (leaf->count - position) * sizeof(uint32_t));
+        leaf->items[position] = slot;
+        leaf->count++;
+        return 0;
+    }
+
+    // Split the full leaf; the right half's first key goes up
+    uint32_t *merged = malloc((tree->leafCap + 1) * sizeof(uint32_t));
+    memcpy(merged, leaf->items, position * sizeof(uint32_t));
+    merged[position] = slot;
+    memcpy(merged + position + 1, leaf->items + position, (leaf->count - position) * sizeof(uint32_t));
+    uint32_t total = tree->leafCap + 1;
+    uint32_t r = newNode(tree, 1);
+    leaf = node(tree, n);
+    struct DirTreeNode *right = node(tree, r);
+    leaf->count = total / 2;
+    right->count = total - leaf->count;
+    memcpy(leaf->items, merged, leaf->count * sizeof(uint32_t));
+    memcpy(right->items, merged + leaf->count, right->count * sizeof(uint32_t));
+    free(merged);
+    right->next = leaf->next;
+    right->prev = n;
+    if (leaf->next != 0) {
+        change(tree, leaf->next)->prev = r;
+    }
+    leaf->next = r;
+    carryKey = right->items[0];
+    carryChild = r;
+
+    // Insert the separator into each parent, splitting full ones
+    for (int levelIndex = (int)tree->header->height - 2; levelIndex >= 0; levelIndex--) {
+        struct DirTreeNode *parent = change(tree, path[levelIndex]);
+        int c = childIndex[levelIndex];
+        uint32_t *keys = keysOf(parent);
+        uint32_t *children = childrenOf(tree, parent);
+        if (parent->count < tree->innerCap) {
+            memmove(&keys[c + 1], &keys[c], (parent->count - c) * sizeof(uint32_t));
+            memmove(&children[c + 2], &children[c + 1], (parent->count - c) * sizeof(uint32_t));
+            keys[c] = carryKey;
+            children[c + 1] = carryChild;
+            parent->count++;
+            return 0;
+        }
+
+        uint32_t keyTotal = tree->innerCap + 1;
+        uint32_t *allKeys = malloc(keyTotal * sizeof(uint32_t));
+        uint32_t *allChildren = malloc((keyTotal + 1) * sizeof(uint32_t));
+        memcpy(allKeys, keys, c * sizeof(uint32_t));
+        allKeys[c] = carryKey;
+        memcpy(allKeys + c + 1, keys + c, (parent->count - c) * sizeof(uint32_t));
+        memcpy(allChildren, children, (c + 1) * sizeof(uint32_t));
+        allChildren[c + 1] = carryChild;
+        memcpy(allChildren + c + 2, children + c + 1, (parent->count - c) * sizeof(uint32_t));
+
+        uint32_t mid = keyTotal / 2;
+        uint32_t s = newNode(tree, 0);
+        parent = node(tree, path[levelIndex]);
+        struct DirTreeNode *sibling = node(tree, s);
+        parent->count = mid;
+        memcpy(keysOf(parent), allKeys, mid * sizeof(uint32_t));
+        memcpy(childrenOf(tree, parent), allChildren, (mid + 1) * sizeof(uint32_t));
+        sibling->count = keyTotal - mid - 1;
+        memcpy(keysOf(sibling), allKeys + mid + 1, sibling->count * sizeof(uint32_t));
+        memcpy(childrenOf(tree, sibling), allChildren + mid + 1, (sibling->count + 1) * sizeof(uint32_t));
+        carryKey = allKeys[mid];
+        carryChild = s;
+        free(allKeys);
+        free(allChildren);
+    }
+
+    // The root split
+    uint32_t newRoot = newNode(tree, 0);
+    struct DirTreeNode *root = node(tree, newRoot);
+    root->count = 1;
+    keysOf(root)[0] = carryKey;
+    childrenOf(tree, root)[0] = tree->header->root;
+    childrenOf(tree, root)[1] = carryChild;
+    tree->header->root = newRoot;
+    tree->header->height++;
+    return 0;
+}
+
+void dirTreeInsert(struct DirectoryEntry *dir, int slot) {
+    struct dirTree tree;
+    treeOpen(dir, &tree);
+    if (treeInsert(&tree, slot) != 0) {
+        dirTreeBuild(dir); // Picks up slot along with everything else
+    }
+}
+
+void dirTreeRemove(struct DirectoryEntry *dir, int slot) {
+    struct dirTree tree;
+    treeOpen(dir, &tree);
+    const char *name = nameOf(&tree, slot);
+
+    uint32_t path[TREE_MAX_HEIGHT];
+    int childIndex[TREE_MAX_HEIGHT];
+    uint32_t n = descend(&tree, name, path, childIndex);
+    struct DirTreeNode *leaf = node(&tree, n);
+    int position = lowerBound(&tree, leaf, name);
+    if (position >= leaf->count || leaf->items[position] != (uint32_t)slot) {
+        return; // Not in the tree
+    }
+
+    // The successor replaces slot wherever slot is also a separator
+    uint32_t successor = 0;
+    if (position + 1 < leaf->count) {
+        successor = leaf->items[position + 1];
+    } else {
+        for (uint32_t next = leaf->next; next != 0; next = node(&tree, next)->next) {
+            if (node(&tree, next)->count > 0) {
+                successor = node(&tree, next)->items[0];
+                break;
+            }
+        }
+    }
+
+    change(&tree, n);
+    memmove(&leaf->items[position], &leaf->items[position + 1], (leaf->count - position - 1) * sizeof(uint32_t));
+    leaf->count--;
+
+    // Unlink nodes left empty, walking up while parents empty out as well
+    int levelIndex = (int)tree.header->height - 2;
+    if (leaf->count == 0 && levelIndex >= 0) {
+        if (leaf->prev != 0) {
+            change(&tree, leaf->prev)->next = leaf->next;
+        }
+        if (leaf->next != 0) {
+            change(&tree, leaf->next)->prev = leaf->prev;
+        }
+        releaseNode(&tree, n);
+
+        for (; levelIndex >= 0; levelIndex--) {
+            struct DirTreeNode *parent = change(&tree, path[levelIndex]);
+            int c = childIndex[levelIndex];
+            uint32_t *keys = keysOf(parent);
+            uint32_t *children = childrenOf(&tree, parent);
+            if (parent->count == 0) {
+                releaseNode(&tree, path[levelIndex]); // Its only child is gone
+                continue;
+            }
+            int k = (c > 0) ? c - 1 : 0;
+            memmove(&keys[k], &keys[k + 1], (parent->count - k - 1) * sizeof(uint32_t));
+            memmove(&children[c], &children[c + 1], (parent->count - c) * sizeof(uint32_t));
+            parent->count--;
+            break;
+        }
+        if (levelIndex < 0) {
+            dirTreeBuild(dir); // Every level emptied, start over with an empty leaf
+            return;
+        }
+    }
+
+    // A root left with one child hands the tree to that child
+    while (tree.header->height > 1 && node(&tree, tree.header->root)->count == 0) {
+        uint32_t old = tree.header->root;
+        change(&tree, 0);
+        tree.header->root = childrenOf(&tree, node(&tree, old))[0];
+        tree.header->height--;
+        releaseNode(&tree, old);
+    }
+
+    // Replace slot if it survives as a separator on the way down
+    uint32_t current = tree.header->root;
+    for (uint32_t level = 0; level + 1 < tree.header->height; level++) {
+        struct DirTreeNode *inner = node(&tree, current);
+        int c = childFor(&tree, inner, name);
+        if (c > 0 && keysOf(inner)[c - 1] == (uint32_t)slot) {
+            keysOf(change(&tree, current))[c - 1] = successor;
+        }
+        current = childrenOf(&tree, inner)[c];
+    }
+}
+
+// Returns the slot named name, or -1
+int dirTreeLookup(struct DirectoryEntry *dir, const char *name) {
+    struct dirTree tree;
+    treeOpen(dir, &tree);
+    uint32_t path[TREE_MAX_HEIGHT];
+    int childIndex[TREE_MAX_HEIGHT];
+    struct DirTreeNode *leaf = node(&tree, descend(&tree, name, path, childIndex));
+    int position = lowerBound(&tree, leaf, name);
+    if (position < leaf->count && strcmp(nameOf(&tree, leaf->items[position]), name) == 0) {
+        return leaf->items[position];
+    }
+    return -1;
+}
+
+// Positions a cursor on the first name not below from, or on the first
+// name of the directory when from is NULL
+void dirTreeSeek(struct DirectoryEntry *dir, const char *from, uint32_t *leafNode, uint32_t *position) {
+    struct dirTree tree;
+    treeOpen(dir, &tree);
+    uint32_t path[TREE_MAX_HEIGHT];
+    int childIndex[TREE_MAX_HEIGHT];
+    if (from == NULL) {
+        uint32_t n = tree.header->root;
+        for (uint32_t level = 0; level + 1 < tree.header->height; level++) {
+            n = childrenOf(&tree, node(&tree, n))[0];
+        }
+        *leafNode = n;
+        *position = 0;
+        return;
+    }
+    *leafNode = descend(&tree, from, path, childIndex);
+    *position = lowerBound(&tree, node(&tree, *leafNode), from);
+}
+
+// Returns the slot at the cursor and advances it, or -1 past the last name
+int dirTreeNext(struct DirectoryEntry *dir, uint32_t *leafNode, uint32_t *position) {
+    struct dirTree tree;
+    treeOpen(dir, &tree);
+    while (*leafNode != 0) {
+        struct DirTreeNode *leaf = node(&tree, *leafNode);
+        if (*position < leaf->count) {
+            return leaf->items[(*position)++];
+        }
+        *leafNode = leaf->next;
+        *position = 0;
+    }
+    return -1;
+}
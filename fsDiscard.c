@@ -0,0 +1,293 @@
+/**************************************************************
+* Class::  CSC-415-0# Spring 2024
+* Name::
+* Student IDs::
+* GitHub-Name::
+* Group-Name::
+* Project:: Basic File System
+*
+* File:: fsDiscard.c
+*
+* Description:: Gives freed blocks back to the host.  Freed
+*   blocks are noted as runs, merged as they come in, and once
+*   enough have built up they are punched out of the volume
+*   file as holes, so its size on the host follows the live
+*   data.  Nothing is punched while a journal transaction is
+*   open, since a free is only final once it has committed,
+*   and a block is only punched if it is still free.  A trim
+*   punches every free run on the volume, now or periodically.
+*
+**************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include "mfs.h"
+#include "vcb.h"
+#include "fsLow.h"
+
+#define DISCARD_BATCH 256           // Freed blocks noted before they are punched
+
+extern struct VolumeControlBlock* vcb;
+extern struct FATEntry* fat;
+extern pthread_mutex_t b_ioLock;
+
+int journalQuiet();
+
+struct run {
+    uint64_t start;
+    uint64_t count;
+};
+
+static pthread_mutex_t discardLock = PTHREAD_MUTEX_INITIALIZER;
+static int volumeFd = -1;       // The volume file, -1 while discard is off
+static struct run *runs;        // Freed and not yet punched
+static uint64_t runCount;
+static uint64_t runCap;
+static uint64_t notedBlocks;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    int running;
+    int stopping;
+    int seconds;
+} trimmer = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};
+
+// Punches [start, start + count) out of the volume file.  The partition
+// header takes the file's first block, so LBA block n is file block n + 1.
+// Called with b_ioLock held.
+static int punch(uint64_t start, uint64_t count) {
+    if (fallocate(volumeFd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+            (off_t)(start + 1) * vcb->blockSize, (off_t)count * vcb->blockSize) != 0) {
+        if (errno == EOPNOTSUPP) {
+            printf("Host file system cannot punch holes, discard is off\n");
+            close(volumeFd);
+            volumeFd = -1;
+        }
+        return -1;
+    }
+    return 0;
+}
+
+// Punches the blocks of [start, start + count) that are still free,
+// returning how many.  Called with b_ioLock held.
+static uint64_t punchFree(uint64_t start, uint64_t count) {
+    uint64_t punched = 0;
+    uint64_t end = (start + count < vcb->totalBlocks) ? start + count : vcb->totalBlocks;
+    uint64_t block = (start > vcb->dataStart) ? start : vcb->dataStart;
+    while (block < end && volumeFd >= 0) {
+        if (fat[block].nextBlock != FAT_FREE) {
+            block++;
+            continue;
+        }
+        uint64_t first = block;
+        while (block < end && fat[block].nextBlock == FAT_FREE) {
+            block++;
+        }
+        if (punch(first, block - first) == 0) {
+            punched += block - first;
+        }
+    }
+    return punched;
+}
+
+static int addRun(uint64_t start, uint64_t count) {
+    if (runCount == runCap) {
+        uint64_t cap = (runCap > 0) ? runCap * 2 : 64;
+        struct run *grown = realloc(runs, cap * sizeof(struct run));
+        if (grown == NULL) {
+            return -1;
+        }
+        runs = grown;
+        runCap = cap;
+    }
+    runs[runCount].start = start;
+    runs[runCount].count = count;
+    runCount++;
+    return 0;
+}
+
+// Records that block was freed.  Chains are mostly freed in order, so a
+// block usually extends the last run noted.
+void discardNote(uint64_t block) {
+    pthread_mutex_lock(&discardLock);
+    if (volumeFd >= 0) {
+        struct run *last = (runCount > 0) ? &runs[runCount - 1] : NULL;
+        if (last != NULL && block == last->start + last->count) {
+            last->count++;
+        } else if (last != NULL && block + 1 == last->start) {
+            last->start--;
+            last->count++;
+        } else if (addRun(block, 1) != 0) {
+            pthread_mutex_unlock(&discardLock);
+            return; // Left for the next trim
+        }
+        notedBlocks++;
+    }
+    pthread_mutex_unlock(&discardLock);
+}
+
+static int byStart(const void *a, const void *b) {
+    uint64_t x = ((const struct run *)a)->start;
+    uint64_t y = ((const struct run *)b)->start;
+    return (x > y) - (x < y);
+}
+
+// Punches the runs noted so far once there are enough of them, or all of
+// them with force.  Called after a commit, without b_ioLock.
+void discardFlush(int force) {
+    pthread_mutex_lock(&discardLock);
+    if (volumeFd < 0 || runCount == 0 || (!force && notedBlocks < DISCARD_BATCH)) {
+        pthread_mutex_unlock(&discardLock);
+        return;
+    }
+    struct run *batch = runs;
+    uint64_t count = runCount;
+    runs = NULL;
+    runCount = runCap = 0;
+    notedBlocks = 0;
+    pthread_mutex_unlock(&discardLock);
+
+    // Sorted, runs freed apart that touch are punched as one
+    qsort(batch, count, sizeof(struct run), byStart);
+    uint64_t merged = 0;
+    for (uint64_t i = 1; i < count; i++) {
+        struct run *last = &batch[merged];
+        if (batch[i].start <= last->start + last->count) {
+            uint64_t end = batch[i].start + batch[i].count;
+            if (end > last->start + last->count) {
+                last->count = end - last->start;
+            }
+        } else {
+            batch[++merged] = batch[i];
+        }
+    }
+    count = (count > 0) ? merged + 1 : 0;
+
+    // Every run here was noted before this check, so if no operation is
+    // open now, each free it holds has committed
+    pthread_mutex_lock(&b_ioLock);
+    int quiet = journalQuiet();
+    pthread_mutex_lock(&discardLock);
+    for (uint64_t i = 0; i < count; i++) {
+        if (!quiet) {
+            addRun(batch[i].start, batch[i].count);
+            notedBlocks += batch[i].count;
+        } else if (volumeFd >= 0) {
+            punchFree(batch[i].start, batch[i].count);
+        }
+    }
+    pthread_mutex_unlock(&discardLock);
+    pthread_mutex_unlock(&b_ioLock);
+    free(batch);
+}
+
+// Turns discard on for the volume in volumeFile, the file the partition
+// system was started on
+int fs_discardOpen(const char *volumeFile) {
+    pthread_mutex_lock(&discardLock);
+    if (volumeFd < 0) {
+        volumeFd = open(volumeFile, O_RDWR);
+    }
+    int result = (volumeFd >= 0) ? 0 : -1;
+    pthread_mutex_unlock(&discardLock);
+    return result;
+}
+
+// Punches every free run on the volume.  Returns the blocks punched, or -1
+// if discard is off or an operation is open.  Called with the volume lock
+// held, so none starts meanwhile.
+int64_t fs_trim() {
+    int64_t punched = -1;
+    pthread_mutex_lock(&b_ioLock);
+    pthread_mutex_lock(&discardLock);
+    if (volumeFd >= 0 && journalQuiet()) {
+        punched = punchFree(vcb->dataStart, vcb->totalBlocks - vcb->dataStart);
+        runCount = 0; // All punched with the rest
+        notedBlocks = 0;
+    }
+    pthread_mutex_unlock(&discardLock);
+    pthread_mutex_unlock(&b_ioLock);
+    return punched;
+}
+
+static void *trimService(void *arg) {
+    pthread_mutex_lock(&trimmer.lock);
+    while (!trimmer.stopping) {
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec += trimmer.seconds;
+        while (!trimmer.stopping &&
+                pthread_cond_timedwait(&trimmer.changed, &trimmer.lock, &until) == 0) {
+        }
+        if (!trimmer.stopping) {
+            pthread_mutex_unlock(&trimmer.lock);
+            fs_lockVolume();
+            fs_trim();
+            fs_unlockVolume();
+            pthread_mutex_lock(&trimmer.lock);
+        }
+    }
+    trimmer.running = 0;
+    pthread_cond_broadcast(&trimmer.changed);
+    pthread_mutex_unlock(&trimmer.lock);
+    return NULL;
+}
+
+// Trims the volume every seconds in the background, or stops with 0.  A
+// trimmer already running is asked to stop and left to finish on its own,
+// so this can be called with the volume lock held.
+int fs_trimEvery(int seconds) {
+    pthread_mutex_lock(&trimmer.lock);
+    if (trimmer.running) {
+        trimmer.stopping = 1;
+        pthread_cond_broadcast(&trimmer.changed);
+        if (seconds > 0) {
+            pthread_mutex_unlock(&trimmer.lock);
+            return -1; // Still finishing
+        }
+    }
+    int result = 0;
+    if (seconds > 0) {
+        pthread_t thread;
+        trimmer.seconds = seconds;
+        trimmer.stopping = 0;
+        result = pthread_create(&thread, NULL, trimService, NULL);
+        if (result == 0) {
+            pthread_detach(thread);
+            trimmer.running = 1;
+        }
+    }
+    pthread_mutex_unlock(&trimmer.lock);
+    return (result == 0) ? 0 : -1;
+}
+
+// Stops the trimmer, punches what is still noted and turns discard off,
+// at unmount once nothing is open
+void discardClose() {
+    pthread_mutex_lock(&trimmer.lock);
+    trimmer.stopping = 1;
+    pthread_cond_broadcast(&trimmer.changed);
+    while (trimmer.running) {
+        pthread_cond_wait(&trimmer.changed, &trimmer.lock);
+    }
+    pthread_mutex_unlock(&trimmer.lock);
+
+    discardFlush(1);
+    pthread_mutex_lock(&discardLock);
+    if (volumeFd >= 0) {
+        close(volumeFd);
+        volumeFd = -1;
+    }
+    free(runs);
+    runs = NULL;
+    runCount = runCap = notedBlocks = 0;
+    pthread_mutex_unlock(&discardLock);
+}
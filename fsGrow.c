@@ -0,0 +1,289 @@
+/**************************************************************
+* Class::  CSC-415-0# Spring 2024
+* Name::
+* Student IDs::
+* GitHub-Name::
+* Group-Name::
+* Project:: Basic File System
+*
+* File:: fsGrow.c
+*
+* Description:: Grows a mounted volume.  The volume file and
+*   its partition header are extended first, and the partition
+*   system reopened on them, so the new blocks can be read and
+*   written.  Tables sized by the block count then grow with
+*   it: the FAT and the share counts stay where they are while
+*   their last block has room, and otherwise move to a run of
+*   new blocks, as the free space summaries do.  A moved table
+*   is written whole to its new blocks, and the VCB naming them
+*   commits in one journal transaction with the rest, so after
+*   a crash the volume has either its old size or its new one.
+*   The old places of moved tables are freed in a second
+*   transaction, after that one.  The FAT's original blocks
+*   before the data area stay reserved; the data blocks after
+*   them are never moved.
+*
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "mfs.h"
+#include "vcb.h"
+#include "fsLow.h"
+
+extern struct VolumeControlBlock* vcb;
+extern struct FATEntry* fat;
+extern uint16_t *blockRefs;
+extern struct tableDirt fatDirt;
+extern struct tableDirt refsDirt;
+extern pthread_mutex_t b_ioLock;
+
+int allocateBlocks(int numBlocks, struct VolumeControlBlock *vcb);
+void releaseChain(uint64_t firstBlock);
+int writeFAT();
+int writeRefcounts();
+void markFAT(uint64_t first, uint64_t count);
+void markRefs(uint64_t first, uint64_t count);
+int trackTables(uint64_t blockSize);
+int allocSummaryGrow(uint64_t *oldStart);
+void journalBegin();
+int journalBeginSized(uint64_t blocks);
+int journalEnd();
+int journalWrite(const void *buffer, uint64_t count, uint64_t lba);
+
+// The start of the header the partition system keeps in the first block of
+// the volume file, ahead of the volume's own blocks
+struct partitionHeader {
+    char caption[64];           // PART_CAPTION
+    uint64_t signature;         // PART_SIGNATURE
+    uint64_t volumeSize;        // Bytes, a whole number of blocks
+    uint64_t blockSize;
+    uint64_t numberOfBlocks;
+};
+
+static uint64_t blocksFor(uint64_t bytes) {
+    return (bytes + vcb->blockSize - 1) / vcb->blockSize;
+}
+
+// Extends the volume file to totalBlocks and reopens the partition system
+// on it.  Called with b_ioLock held and the journal unable to commit, so
+// nothing else reaches the disk meanwhile.
+static int extendPartition(const char *volumeFile, uint64_t totalBlocks) {
+    char *header = malloc(MINBLOCKSIZE);
+    int fd = open(volumeFile, O_RDWR);
+    int result = (header == NULL || fd < 0 || pread(fd, header, MINBLOCKSIZE, 0) != MINBLOCKSIZE) ? -1 : 0;
+    struct partitionHeader *partition = (struct partitionHeader *)header;
+    if (result == 0 && (partition->signature != PART_SIGNATURE ||
+            partition->blockSize != vcb->blockSize)) {
+        printf("Error: %s does not hold this volume\n", volumeFile);
+        result = -1;
+    }
+    if (result == 0) {
+        // The new blocks read as zeros until they are written
+        partition->volumeSize = totalBlocks * vcb->blockSize;
+        partition->numberOfBlocks = totalBlocks;
+        if (ftruncate(fd, (off_t)(totalBlocks + 1) * vcb->blockSize) != 0 ||
+                pwrite(fd, header, MINBLOCKSIZE, 0) != MINBLOCKSIZE || fsync(fd) != 0) {
+            printf("Error: Failed to extend %s\n", volumeFile);
+            result = -1;
+        }
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    free(header);
+    if (result != 0) {
+        return -1;
+    }
+
+    uint64_t volumeSize = 0;
+    uint64_t blockSize = vcb->blockSize;
+    closePartitionSystem();
+    if (startPartitionSystem((char *)volumeFile, &volumeSize, &blockSize) != PART_NOERROR ||
+            volumeSize / blockSize < totalBlocks) {
+        printf("Error: Failed to reopen %s\n", volumeFile);
+        return -1;
+    }
+    return 0;
+}
+
+// Grows an in-memory table from oldBlocks to blocks, zeroing the new part
+static void *growTable(void *table, uint64_t oldBlocks, uint64_t blocks) {
+    char *grown = realloc(table, blocks * vcb->blockSize);
+    if (grown != NULL) {
+        memset(grown + oldBlocks * vcb->blockSize, 0, (blocks - oldBlocks) * vcb->blockSize);
+    }
+    return grown;
+}
+
+// Writes a table whole to the run it moved to, which leaves none of it
+// to write later
+static int writeMoved(void *table, struct tableDirt *dirt, uint64_t blocks, uint64_t start) {
+    if (LBAwrite(table, blocks, start) != blocks) {
+        return -1;
+    }
+    for (uint64_t i = 0; i < dirt->count; i++) {
+        dirt->marked[dirt->list[i]] = 0;
+    }
+    dirt->count = 0;
+    return 0;
+}
+
+// Chains of the tables' old places, freed only once the VCB naming the new
+// ones has committed, so nothing reuses them while the VCB on disk still
+// points there.  0 where a table stayed put.
+struct leftBehind {
+    uint64_t fat;
+    uint64_t refs;
+    uint64_t summaries;
+};
+
+// Sizes the tables for totalBlocks, moving those that outgrow their blocks,
+// and writes them.  Called with b_ioLock held inside a journal operation.
+static int growTables(uint64_t totalBlocks, struct leftBehind *old) {
+    uint64_t oldTotal = vcb->totalBlocks;
+    uint64_t oldFatBlocks = vcb->fatBlocks;
+    uint64_t oldRefBlocks = blocksFor(vcb->fatEntryCount * sizeof(uint16_t));
+    uint64_t fatBlocks = blocksFor(totalBlocks * sizeof(struct FATEntry));
+    uint64_t refBlocks = blocksFor(totalBlocks * sizeof(uint16_t));
+
+    // Every allocation comes first, so a failure leaves only larger buffers
+    if (fatBlocks > oldFatBlocks) {
+        struct FATEntry *grown = growTable(fat, oldFatBlocks, fatBlocks);
+        if (grown == NULL) {
+            return -1;
+        }
+        fat = grown;
+    }
+    if (refBlocks > oldRefBlocks) {
+        uint16_t *grown = growTable(blockRefs, oldRefBlocks, refBlocks);
+        if (grown == NULL) {
+            return -1;
+        }
+        blockRefs = grown;
+    }
+
+    uint64_t oldFatStart = vcb->fatStart;
+    vcb->totalBlocks = totalBlocks;
+    vcb->fatEntryCount = totalBlocks;
+    vcb->fatBlocks = fatBlocks;
+    if (trackTables(vcb->blockSize) != 0 || allocSummaryGrow(&old->summaries) != 0) {
+        vcb->totalBlocks = oldTotal;
+        vcb->fatEntryCount = oldTotal;
+        vcb->fatBlocks = oldFatBlocks;
+        return -1;
+    }
+    // The new entries are free and unshared
+    markFAT(oldTotal, totalBlocks - oldTotal);
+    markRefs(oldTotal, totalBlocks - oldTotal);
+
+    // The new blocks are free now, and fs_growVolume checked they hold
+    // every table that moves.  The old places stay allocated, so a moved
+    // table is written straight to blocks nothing committed refers to.
+    int moveFat = (fatBlocks > oldFatBlocks);
+    int moveRefs = (refBlocks > oldRefBlocks);
+    if (moveFat) {
+        int start = allocateBlocks(fatBlocks, vcb);
+        if (start == -1) {
+            return -1;
+        }
+        if (oldFatStart >= vcb->dataStart) {
+            old->fat = oldFatStart; // Moved before, into the data area
+        }
+        vcb->fatStart = start;
+    }
+    if (moveRefs) {
+        int start = allocateBlocks(refBlocks, vcb);
+        if (start == -1) {
+            return -1;
+        }
+        old->refs = vcb->metadataLocation;
+        vcb->metadataLocation = start;
+    }
+
+    int result = moveRefs ? writeMoved(blockRefs, &refsDirt, refBlocks, vcb->metadataLocation) :
+        writeRefcounts();
+    if (result == 0) {
+        result = moveFat ? writeMoved(fat, &fatDirt, fatBlocks, vcb->fatStart) : writeFAT();
+    }
+    if (result == 0) {
+        result = journalWrite(vcb, 1, 1);
+    }
+    return result;
+}
+
+// Grows the mounted volume held in volumeFile to totalBlocks blocks.
+// Called with the volume lock held.
+int fs_growVolume(const char *volumeFile, uint64_t totalBlocks) {
+    if (totalBlocks <= vcb->totalBlocks) {
+        printf("Error: The volume already has %lu blocks\n", vcb->totalBlocks);
+        return -1;
+    }
+
+    // The tables that move must fit in the new blocks alone
+    uint64_t fatBlocks = blocksFor(totalBlocks * sizeof(struct FATEntry));
+    uint64_t refBlocks = blocksFor(totalBlocks * sizeof(uint16_t));
+    uint64_t groups = (totalBlocks + ALLOC_GROUP_BLOCKS - 1) / ALLOC_GROUP_BLOCKS;
+    uint64_t needed = blocksFor(groups * sizeof(struct allocGroup));
+    if (fatBlocks > vcb->fatBlocks) {
+        needed += fatBlocks;
+    }
+    if (refBlocks > blocksFor(vcb->fatEntryCount * sizeof(uint16_t))) {
+        needed += refBlocks;
+    }
+    if (totalBlocks - vcb->totalBlocks < needed) {
+        printf("Error: Grow by at least %lu blocks\n", needed);
+        return -1;
+    }
+
+    // The journal takes the new parts of the tables that stay put, the
+    // FAT entries of the places allocated for the others, and the VCB.  A
+    // moved table is written straight to its new place.
+    uint64_t journalBlocks = blocksFor(needed * sizeof(struct FATEntry)) + 3;
+    if (fatBlocks <= vcb->fatBlocks) {
+        journalBlocks += fatBlocks - vcb->totalBlocks * sizeof(struct FATEntry) / vcb->blockSize;
+    }
+    if (refBlocks <= blocksFor(vcb->fatEntryCount * sizeof(uint16_t))) {
+        journalBlocks += refBlocks - vcb->totalBlocks * sizeof(uint16_t) / vcb->blockSize;
+    }
+
+    // Holding an operation open keeps other threads' commits off the disk
+    // while the partition is reopened
+    struct leftBehind old = {0};
+    int result = journalBeginSized(journalBlocks);
+    pthread_mutex_lock(&b_ioLock);
+    if (result == 0) {
+        result = extendPartition(volumeFile, totalBlocks);
+    }
+    if (result == 0) {
+        result = growTables(totalBlocks, &old);
+    }
+    pthread_mutex_unlock(&b_ioLock);
+    if (journalEnd() != 0) {
+        result = -1;
+    }
+    if (result != 0 || (old.fat == 0 && old.refs == 0 && old.summaries == 0)) {
+        return result;
+    }
+
+    // A crash before this commits leaves the old places allocated, for
+    // fsck to report as leaked
+    journalBegin();
+    pthread_mutex_lock(&b_ioLock);
+    uint64_t chains[] = {old.fat, old.refs, old.summaries};
+    for (int i = 0; i < 3; i++) {
+        if (chains[i] != 0) {
+            releaseChain(chains[i]);
+        }
+    }
+    result = writeFAT();
+    pthread_mutex_unlock(&b_ioLock);
+    if (journalEnd() != 0) {
+        result = -1;
+    }
+    return result;
+}
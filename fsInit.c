@@ -16,13 +16,38 @@ struct FATEntry* fat = NULL;
 struct DirectoryEntry *rootDir = NULL;  // Global root directory pointer
 char currentWorkingDirectory[MAX_FILENAME_LENGTH]; // Global current working directory
 struct DirectoryEntry *loadedCWD = NULL; // Global loaded CWD
+uint16_t *blockRefs = NULL; // Global share counts, one per block, for cloned files
+struct tableDirt fatDirt;          // Blocks of the FAT and share counts changed
+struct tableDirt refsDirt;         // since they were written, none while formatting
 
 
 // Function prototypes
 int initializeFAT(uint64_t blockSize, uint64_t totalBlocks);
 int initializeRootDirectory(uint64_t blockSize);
+int initializeRefcounts(uint64_t blockSize);
+int loadFAT(uint64_t blockSize);
+int loadRefcounts(uint64_t blockSize);
 struct DirectoryEntry* loadDir(struct DirectoryEntry* entry); // Add this prototype
-int allocateBlocks(int numBlocks, struct VolumeControlBlock vcb);
+int allocateBlocks(int numBlocks, struct VolumeControlBlock *vcb);
+int writeFAT();
+uint16_t dirIndexBlocks(int numEntries, uint8_t indexType);
+void dirIndexBuild(struct DirectoryEntry *dir);
+void dcacheClear();
+void pathCacheClear();
+void bloomClear();
+int dirCompact();
+uint64_t dirDiskBlocks(struct DirectoryEntry *dir);
+int writeDir(struct DirectoryEntry *dir);
+int journalCreate();
+int journalRecover();
+void journalClose();
+void defragShutdown();
+void discardClose();
+int allocSummaryCreate();
+int allocSummaryLoad();
+int allocSummarySave();
+void allocSummaryClose();
+int trackTables(uint64_t blockSize);
 
 
 int initFileSystem(uint64_t numberOfBlocks, uint64_t blockSize) {
@@ -56,6 +81,7 @@ int initFileSystem(uint64_t numberOfBlocks, uint64_t blockSize) {
         vcb->freeBlocks = numberOfBlocks; // Initialize with all blocks free 
         vcb->creationTime = time(NULL);
         vcb->lastMountedTime = vcb->creationTime;
+        vcb->fsVersion = FS_VERSION_COMPACT_DIRS;
 
         // Write the initial VCB to disk (before initializing FAT)
         if (LBAwrite(vcb, 1, 1) != 1) { 
@@ -82,8 +108,24 @@ int initFileSystem(uint64_t numberOfBlocks, uint64_t blockSize) {
         }
         vcb->rootDirectory = rootDirStart;
 
-        // Adjust free blocks in VCB (after initializing FAT and root directory)
-        vcb->freeBlocks -= (vcb->fatBlocks + (rootDirStart - vcb->dataStart)); 
+        // Reserve the block share counts used by cloned files
+        if (initializeRefcounts(blockSize) < 0) {
+            printf("Error: Failed to initialize block reference counts\n");
+            free(vcb);
+            return -1;
+        }
+
+        // Reserve the metadata journal; every later metadata write goes through it
+        if (trackTables(blockSize) < 0 || journalCreate() < 0) {
+            printf("Error: Failed to initialize the journal\n");
+            free(vcb);
+            return -1;
+        }
+
+        if (allocSummaryCreate() < 0) {
+            free(vcb);
+            return -1;
+        }
 
         // Write the updated VCB to disk
         if (LBAwrite(vcb, 1, 1) != 1) { 
@@ -95,9 +137,43 @@ int initFileSystem(uint64_t numberOfBlocks, uint64_t blockSize) {
         printf("File system initialized successfully!\n");
     } else {
         printf("Found existing file system. Loading...\n");
+
+        // Finish whatever the last session committed before reading the tables
+        if (journalRecover() < 0) {
+            printf("Error: Unable to replay the journal\n");
+            free(vcb);
+            return -1;
+        }
         vcb->lastMountedTime = time(NULL);
         vcb->mountCount++;
 
+        // Volumes from before compact directories have version 0
+        if (vcb->fsVersion > FS_VERSION_COMPACT_DIRS) {
+            printf("Error: Unsupported file system version %u\n", vcb->fsVersion);
+            free(vcb);
+            return -1;
+        }
+        printf("Directory format: %s\n", dirCompact() ? "compact" : "wide");
+
+        if (loadFAT(blockSize) < 0 || loadRefcounts(blockSize) < 0 || trackTables(blockSize) < 0) {
+            printf("Error: Unable to load allocation tables\n");
+            free(vcb);
+            return -1;
+        }
+
+        // Volumes formatted before the journal get one now
+        if (vcb->journalStart == 0 && journalCreate() < 0) {
+            printf("Error: Failed to create the journal\n");
+            free(vcb);
+            return -1;
+        }
+
+        // Free space summaries are current only if the last unmount was clean
+        if (allocSummaryLoad() < 0) {
+            free(vcb);
+            return -1;
+        }
+
         if (LBAwrite(vcb, 1, 1) != 1) { 
             printf("Error: Unable to update VCB on disk\n");
             free(vcb);
@@ -106,7 +182,10 @@ int initFileSystem(uint64_t numberOfBlocks, uint64_t blockSize) {
     }
 
     // Load the root directory
-    rootDir = loadDir(&(struct DirectoryEntry){.firstBlockIndex = vcb->rootDirectory, .fileSize = 51 * sizeof(struct DirectoryEntry)}); 
+    dcacheClear();
+    pathCacheClear();
+    bloomClear();
+    rootDir = loadDir(&(struct DirectoryEntry){.firstBlockIndex = vcb->rootDirectory, .fileSize = DIR_INITIAL_ENTRIES * sizeof(struct DirectoryEntry)}); 
     if (rootDir == NULL) {
         printf("Error: Failed to load root directory\n");
         return -1;
@@ -255,6 +334,8 @@ int initializeRootDirectory(uint64_t blockSize) {
     const int NUM_DE = 50;
     uint64_t dirSize = sizeof(struct DirectoryEntry) * NUM_DE;
     uint64_t dirBlocks = (dirSize + blockSize - 1) / blockSize;
+    uint16_t indexBlocks = dirIndexBlocks(NUM_DE, DIR_INDEX_HASH);
+    dirBlocks += indexBlocks; // The name index follows the entries
 
     printf("Directory size: %lu bytes, Directory blocks: %lu\n", dirSize, dirBlocks); // Debug
 
@@ -269,35 +350,39 @@ int initializeRootDirectory(uint64_t blockSize) {
     // Clear memory
     memset(rootDirEntries, 0, dirBlocks * blockSize);
 
-    // Get blocks for directory from FAT
+    // Initialize "." entry
+    strcpy(rootDirEntries[0].filename, ".");
+    rootDirEntries[0].fileSize = dirSize; 
+    rootDirEntries[0].creationTime = time(NULL);
+    rootDirEntries[0].lastModifiedTime = rootDirEntries[0].creationTime;
+    rootDirEntries[0].fileType = 1;  // Directory
+    rootDirEntries[0].inUse = 1;
+    rootDirEntries[0].indexBlocks = indexBlocks;
+    rootDirEntries[0].heapBlocks = dirCompact() ? 1 : 0;
+
+    // Get blocks for directory from FAT, sized for its on-disk format
     printf("Allocating blocks for root directory...\n"); // Debug
-    int startBlock = allocateBlocks(dirBlocks, *vcb); 
+    dirBlocks = dirDiskBlocks(rootDirEntries);
+    int startBlock = allocateBlocks(dirBlocks, vcb); 
     if (startBlock == -1) {
         printf("Error: Failed to allocate blocks for root directory\n");
         free(rootDirEntries);
         return -1;
     }
     printf("Allocated blocks for root directory starting at block: %d\n", startBlock); // Debug
-
-    // Initialize "." entry
-    strcpy(rootDirEntries[0].filename, ".");
-    rootDirEntries[0].fileSize = dirSize; 
     rootDirEntries[0].firstBlockIndex = startBlock;
-    rootDirEntries[0].creationTime = time(NULL);
-    rootDirEntries[0].lastModifiedTime = rootDirEntries[0].creationTime;
-    rootDirEntries[0].fileType = 1;  // Directory
-    rootDirEntries[0].inUse = 1;
 
     // Initialize ".." entry (same as "." for root)
     memcpy(&rootDirEntries[1], &rootDirEntries[0], sizeof(struct DirectoryEntry)); 
     strcpy(rootDirEntries[1].filename, "..");
+    dirIndexBuild(rootDirEntries);
 
     // Write directory to disk
     printf("Writing root directory to disk...\n"); 
     printf("  rootDirEntries: %p\n", (void *)rootDirEntries); // Corrected print statement
     printf("  dirBlocks: %lu\n", dirBlocks);          // Corrected print statement
     printf("  startBlock: %d\n", startBlock);        // Corrected print statement
-    if (LBAwrite(rootDirEntries, dirBlocks, startBlock) != dirBlocks) { 
+    if (writeDir(rootDirEntries) != 0) { 
         printf("Error: Failed to write root directory\n");
         free(rootDirEntries);
         return -1;
@@ -325,8 +410,120 @@ int initializeRootDirectory(uint64_t blockSize) {
     return startBlock;
 }
 
+// Allocates the share count table and records its location in the VCB.
+// Every block starts with a count of 0, meaning it has a single owner.
+int initializeRefcounts(uint64_t blockSize) {
+    uint64_t refBlocks = (vcb->fatEntryCount * sizeof(uint16_t) + blockSize - 1) / blockSize;
+
+    blockRefs = calloc(refBlocks, blockSize);
+    if (blockRefs == NULL) {
+        printf("Error: Failed to allocate reference count memory\n");
+        return -1;
+    }
+
+    int startBlock = allocateBlocks(refBlocks, vcb);
+    if (startBlock == -1) {
+        printf("Error: Failed to allocate blocks for reference counts\n");
+        free(blockRefs);
+        blockRefs = NULL;
+        return -1;
+    }
+    vcb->metadataLocation = startBlock;
+
+    if (LBAwrite(blockRefs, refBlocks, startBlock) != refBlocks || writeFAT() != 0) {
+        printf("Error: Failed to write reference counts\n");
+        free(blockRefs);
+        blockRefs = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+// Reads the FAT of an existing volume into memory
+int loadFAT(uint64_t blockSize) {
+    fat = malloc(vcb->fatBlocks * blockSize);
+    if (fat == NULL) {
+        printf("Error: Failed to allocate FAT memory\n");
+        return -1;
+    }
+    if (LBAread(fat, vcb->fatBlocks, vcb->fatStart) != vcb->fatBlocks) {
+        printf("Error: Failed to read FAT\n");
+        free(fat);
+        fat = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+// Sizes dirt for a table of blocks, keeping what is already marked
+static int trackTable(struct tableDirt *dirt, uint64_t blocks) {
+    uint8_t *marked = realloc(dirt->marked, blocks);
+    if (marked == NULL) {
+        return -1;
+    }
+    dirt->marked = marked;
+    uint64_t *list = realloc(dirt->list, blocks * sizeof(uint64_t));
+    if (list == NULL) {
+        return -1;
+    }
+    dirt->list = list;
+    if (blocks > dirt->blocks) {
+        memset(marked + dirt->blocks, 0, blocks - dirt->blocks);
+    }
+    dirt->blocks = blocks;
+    return 0;
+}
+
+static void untrackTable(struct tableDirt *dirt) {
+    free(dirt->marked);
+    free(dirt->list);
+    memset(dirt, 0, sizeof(struct tableDirt));
+}
+
+// Starts noting which blocks of the FAT and share counts change, so writes
+// only send those.  Called again when the tables grow.
+int trackTables(uint64_t blockSize) {
+    uint64_t refBlocks = (vcb->fatEntryCount * sizeof(uint16_t) + blockSize - 1) / blockSize;
+    if (trackTable(&fatDirt, vcb->fatBlocks) != 0 || trackTable(&refsDirt, refBlocks) != 0) {
+        printf("Error: Failed to allocate table tracking\n");
+        untrackTable(&fatDirt);
+        untrackTable(&refsDirt);
+        return -1;
+    }
+    return 0;
+}
+
+// Reads the share count table, creating it on volumes formatted before
+// clones existed
+int loadRefcounts(uint64_t blockSize) {
+    if (vcb->metadataLocation == 0) {
+        return initializeRefcounts(blockSize);
+    }
+
+    uint64_t refBlocks = (vcb->fatEntryCount * sizeof(uint16_t) + blockSize - 1) / blockSize;
+    blockRefs = malloc(refBlocks * blockSize);
+    if (blockRefs == NULL) {
+        printf("Error: Failed to allocate reference count memory\n");
+        return -1;
+    }
+    if (LBAread(blockRefs, refBlocks, vcb->metadataLocation) != refBlocks) {
+        printf("Error: Failed to read reference counts\n");
+        free(blockRefs);
+        blockRefs = NULL;
+        return -1;
+    }
+    return 0;
+}
+
 void exitFileSystem() {
+    defragShutdown();
+    journalClose();
+    discardClose();
     if (vcb != NULL) {
+        // Free block counts change at runtime, so persist them on the way out,
+        // with the summaries before the VCB that marks them clean
+        allocSummarySave();
+        LBAwrite(vcb, 1, 1);
         free(vcb);
         vcb = NULL;
     }
@@ -334,4 +531,11 @@ void exitFileSystem() {
         free(fat);
         fat = NULL;
     }
+    if (blockRefs != NULL) {
+        free(blockRefs);
+        blockRefs = NULL;
+    }
+    allocSummaryClose();
+    untrackTable(&fatDirt);
+    untrackTable(&refsDirt);
 }
@@ -0,0 +1,615 @@
+/**************************************************************
+* Class::  CSC-415-0# Spring 2024
+* Name::
+* Student IDs::
+* GitHub-Name::
+* Group-Name::
+* Project:: Basic File System
+*
+* File:: fsJournal.c
+*
+* Description:: Write-ahead journal for metadata.  FAT, share
+*   count, VCB and directory blocks written during an operation
+*   are held in memory until the operation ends, then written
+*   as one transaction to a circular region reserved at format
+*   time, in a single sequential write, and only then to their
+*   home locations.  Operations that overlap share a
+*   transaction, which commits when the last of them ends.
+*   Blocks reach home before the next transaction is written,
+*   so after a crash only the last complete transaction in the
+*   journal can be missing from home, and mount replays it.
+*   Each operation reserves room in the transaction when it
+*   starts, so none is ever split across two of them, and the
+*   blocks it frees stay allocated until it has committed.
+*
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "mfs.h"
+#include "vcb.h"
+#include "fsLow.h"
+
+#define JOURNAL_MAGIC 0x4A524E4C4A524E4CULL    // "JRNLJRNL"
+#define JOURNAL_TXN_MAGIC 0x54584E5354584E53ULL // "TXNSTXNS"
+#define JOURNAL_MIN_BLOCKS 64
+#define JOURNAL_MAX_BLOCKS 4096
+#define JOURNAL_OP_BLOCKS 64            // Reserved by an operation that gives no size
+
+extern struct VolumeControlBlock* vcb;
+extern pthread_mutex_t b_ioLock;
+
+int allocateBlocks(int numBlocks, struct VolumeControlBlock *vcb);
+int writeFAT();
+int writeRefcounts();
+uint64_t freeChain(uint64_t firstBlock, uint64_t limit);
+int journalReserve(uint64_t blocks);
+int journalEnd();
+void discardFlush(int force);
+
+// First block of the region.  Replay starts at start, expecting seq.
+struct journalSuper {
+    uint64_t magic;
+    uint64_t start;             // Block of the oldest transaction to look at
+    uint64_t seq;
+};
+
+// First block of a transaction, followed by the rest of its target list
+// and then its blocks in target order
+struct journalTxn {
+    uint64_t magic;
+    uint64_t seq;
+    uint64_t count;             // Blocks carried
+    uint64_t totalBlocks;       // Blocks the transaction takes in the journal
+    uint64_t checksum;          // Over the targets and the blocks
+    uint64_t targets[];
+};
+
+// Blocks of the open transaction, with a hash of their targets so reads
+// and repeated writes find them
+struct pendingBlock {
+    uint64_t lba;
+    char *data;
+};
+
+static pthread_mutex_t journalLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t journalCommitted = PTHREAD_COND_INITIALIZER;
+static int journaling = 0;      // Region set up and mounted
+static uint64_t areaStart;      // Transactions go in [areaStart, areaEnd)
+static uint64_t areaEnd;
+static uint64_t maxBlocks;      // Most blocks a transaction can carry
+static uint64_t position;       // Where the next transaction goes
+static uint64_t nextSeq;
+static struct pendingBlock *pending;
+static uint64_t pendingCount;
+static uint64_t pendingCap;
+static uint32_t *pendingHash;   // Indices into pending, UINT32_MAX when empty
+static uint64_t hashCap;
+static int active;              // Operations in the open transaction
+static __thread int depth;      // Nesting of operations on this thread
+static uint64_t reserved;       // Blocks promised to the open operations, not yet written
+static __thread uint64_t opReserve; // This thread's part of reserved
+
+// Heads of chains to free
+struct chainList {
+    uint64_t *chains;
+    uint64_t count;
+    uint64_t cap;
+};
+
+// Chains released by operations that have not committed yet, and chains
+// whose release has committed.  Until then a chain's blocks stay
+// allocated, so no other file can be given one and write its data there
+// while a crash could still bring back the entry that refers to it.
+static struct chainList held;
+static struct chainList released;
+static __thread int draining;   // This thread is freeing released chains
+
+static int pushChain(struct chainList *list, uint64_t firstBlock) {
+    if (list->count == list->cap) {
+        uint64_t cap = (list->cap > 0) ? list->cap * 2 : 16;
+        uint64_t *grown = realloc(list->chains, cap * sizeof(uint64_t));
+        if (grown == NULL) {
+            return -1;
+        }
+        list->chains = grown;
+        list->cap = cap;
+    }
+    list->chains[list->count++] = firstBlock;
+    return 0;
+}
+
+static uint64_t checksumOf(uint64_t seq, const uint64_t *targets, uint64_t count, const char *data) {
+    uint64_t hash = 14695981039346656037ULL ^ seq;
+    const unsigned char *bytes = (const unsigned char *)targets;
+    for (uint64_t i = 0; i < count * sizeof(uint64_t); i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    }
+    bytes = (const unsigned char *)data;
+    for (uint64_t i = 0; i < count * vcb->blockSize; i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Journal blocks a transaction of count blocks takes: its header with as
+// many targets as fit, further target blocks, then the blocks
+static uint64_t txnBlocks(uint64_t count) {
+    uint64_t inHeader = (vcb->blockSize - sizeof(struct journalTxn)) / sizeof(uint64_t);
+    uint64_t perBlock = vcb->blockSize / sizeof(uint64_t);
+    uint64_t more = (count > inHeader) ? (count - inHeader + perBlock - 1) / perBlock : 0;
+    return 1 + more + count;
+}
+
+static int writeSuper(uint64_t start, uint64_t seq) {
+    struct journalSuper *super = calloc(1, vcb->blockSize);
+    if (super == NULL) {
+        return -1;
+    }
+    super->magic = JOURNAL_MAGIC;
+    super->start = start;
+    super->seq = seq;
+    int result = (LBAwrite(super, 1, vcb->journalStart) == 1) ? 0 : -1;
+    free(super);
+    return result;
+}
+
+static uint32_t *hashSlot(uint64_t lba) {
+    uint64_t i = (lba * 0x9E3779B97F4A7C15ULL) & (hashCap - 1);
+    while (pendingHash[i] != UINT32_MAX && pending[pendingHash[i]].lba != lba) {
+        i = (i + 1) & (hashCap - 1);
+    }
+    return &pendingHash[i];
+}
+
+static int growPending() {
+    uint64_t cap = (pendingCap > 0) ? pendingCap * 2 : 64;
+    struct pendingBlock *grown = realloc(pending, cap * sizeof(struct pendingBlock));
+    uint32_t *hash = malloc(cap * 2 * sizeof(uint32_t));
+    if (grown == NULL || hash == NULL) {
+        pending = (grown != NULL) ? grown : pending;
+        free(hash);
+        return -1;
+    }
+    pending = grown;
+    pendingCap = cap;
+    free(pendingHash);
+    pendingHash = hash;
+    hashCap = cap * 2;
+    memset(pendingHash, 0xFF, hashCap * sizeof(uint32_t));
+    for (uint64_t i = 0; i < pendingCount; i++) {
+        *hashSlot(pending[i].lba) = i;
+    }
+    return 0;
+}
+
+static int byTarget(const void *a, const void *b) {
+    const struct pendingBlock *left = a;
+    const struct pendingBlock *right = b;
+    return (left->lba > right->lba) - (left->lba < right->lba);
+}
+
+// Writes the open transaction to the journal and then home.  Called with
+// journalLock held.
+static int commitLocked() {
+    if (pendingCount == 0) {
+        return 0;
+    }
+
+    // Sorted targets make runs of home blocks contiguous in the image too
+    qsort(pending, pendingCount, sizeof(struct pendingBlock), byTarget);
+    uint64_t total = txnBlocks(pendingCount);
+    uint64_t dataStart = total - pendingCount;
+    char *image = calloc(total, vcb->blockSize);
+    int result = (image == NULL) ? -1 : 0;
+    if (result == 0) {
+        struct journalTxn *txn = (struct journalTxn *)image;
+        char *data = image + dataStart * vcb->blockSize;
+        for (uint64_t i = 0; i < pendingCount; i++) {
+            txn->targets[i] = pending[i].lba;
+            memcpy(data + i * vcb->blockSize, pending[i].data, vcb->blockSize);
+        }
+        txn->magic = JOURNAL_TXN_MAGIC;
+        txn->seq = nextSeq;
+        txn->count = pendingCount;
+        txn->totalBlocks = total;
+        txn->checksum = checksumOf(nextSeq, txn->targets, pendingCount, data);
+
+        // A transaction never straddles the end of the region
+        if (position + total > areaEnd) {
+            position = areaStart;
+            result = writeSuper(position, nextSeq);
+        }
+        if (result == 0 && LBAwrite(image, total, position) != total) {
+            result = -1;
+        }
+
+        for (uint64_t i = 0; result == 0 && i < pendingCount; ) {
+            uint64_t run = 1;
+            while (i + run < pendingCount && pending[i + run].lba == pending[i].lba + run) {
+                run++;
+            }
+            if (LBAwrite(data + i * vcb->blockSize, run, pending[i].lba) != run) {
+                result = -1;
+            }
+            i += run;
+        }
+        if (result == 0) {
+            position += total;
+            nextSeq++;
+        }
+    }
+    if (result != 0) {
+        printf("Error: Failed to commit journal transaction\n");
+    }
+
+    // Nothing on disk refers to the held chains any more.  After a failed
+    // commit they wait for the next one.
+    for (uint64_t i = 0; result == 0 && i < held.count; i++) {
+        if (pushChain(&released, held.chains[i]) != 0) {
+            break; // Left allocated, for fsck to report as leaked
+        }
+    }
+    if (result == 0) {
+        held.count = 0;
+    }
+
+    free(image);
+    for (uint64_t i = 0; i < pendingCount; i++) {
+        free(pending[i].data);
+    }
+    pendingCount = 0;
+    memset(pendingHash, 0xFF, hashCap * sizeof(uint32_t));
+    pthread_cond_broadcast(&journalCommitted);
+    return result;
+}
+
+// Grows this thread's reservation to blocks if the open transaction has
+// room for them besides what its operations wrote or still may write.
+// Called with journalLock held.
+static int reserveLocked(uint64_t blocks) {
+    if (opReserve >= blocks) {
+        return 0;
+    }
+    if (pendingCount + reserved + blocks - opReserve > maxBlocks) {
+        return -1;
+    }
+    reserved += blocks - opReserve;
+    opReserve = blocks;
+    return 0;
+}
+
+// Starts an operation whose metadata writes must reach disk together and
+// reserves blocks of the journal for them.  An operation that does not
+// fit in the open transaction waits for it to commit, so the outermost
+// call must not hold b_ioLock.  Calls nest; a nested call is a
+// journalReserve, and fails if the transaction has no room.  Returns -1
+// if the blocks can never fit; the operation is started anyway and must
+// be ended, but should change nothing.
+int journalBeginSized(uint64_t blocks) {
+    if (depth++ > 0) {
+        return journalReserve(blocks);
+    }
+    pthread_mutex_lock(&journalLock);
+    int result = 0;
+    if (journaling && blocks > maxBlocks) {
+        printf("Error: The operation is too large for the journal\n");
+        blocks = 0;
+        result = -1;
+    }
+    while (journaling && active > 0 && pendingCount + reserved + blocks > maxBlocks) {
+        pthread_cond_wait(&journalCommitted, &journalLock);
+    }
+    active++;
+    opReserve = 0;
+    if (journaling) {
+        reserveLocked(blocks);
+    }
+    pthread_mutex_unlock(&journalLock);
+    return result;
+}
+
+// Starts an operation of the usual size.  A small journal leaves half of
+// itself for the operations that need more.
+void journalBegin() {
+    journalBeginSized(JOURNAL_OP_BLOCKS < maxBlocks / 2 ? JOURNAL_OP_BLOCKS : maxBlocks / 2);
+}
+
+// Makes sure the running operation can still write blocks new blocks,
+// before the step that needs them changes anything.  What it reserved
+// and has not used counts.  Never waits, since the operation may hold
+// b_ioLock; returns -1 if the open transaction has no room.
+int journalReserve(uint64_t blocks) {
+    pthread_mutex_lock(&journalLock);
+    int result = (journaling && depth > 0) ? reserveLocked(blocks) : 0;
+    pthread_mutex_unlock(&journalLock);
+    if (result != 0) {
+        printf("Error: The operation is too large for the journal\n");
+    }
+    return result;
+}
+
+// Frees the chains whose release has committed, in transactions of at
+// most an operation's reservation each.  A crash part way through leaves
+// the rest allocated but unreferenced, for fsck to report as leaked.
+static void drainReleased() {
+    draining = 1;
+    for (;;) {
+        pthread_mutex_lock(&journalLock);
+        uint64_t chain = (released.count > 0) ? released.chains[--released.count] : 0;
+        pthread_mutex_unlock(&journalLock);
+        if (chain == 0) {
+            break;
+        }
+        while (chain != 0) {
+            journalBegin();
+            pthread_mutex_lock(&b_ioLock);
+            // The VCB goes with the tables
+            chain = freeChain(chain, (opReserve > 2) ? opReserve - 1 : 1);
+            writeRefcounts();
+            writeFAT();
+            pthread_mutex_unlock(&b_ioLock);
+            journalEnd();
+        }
+    }
+    draining = 0;
+}
+
+// Ends an operation.  The last operation of a group commits the writes of
+// all of them, and the blocks they freed can then go back to the
+// allocator and the host, so the outermost call must not hold b_ioLock
+// either.
+int journalEnd() {
+    if (--depth > 0) {
+        return 0;
+    }
+    pthread_mutex_lock(&journalLock);
+    int result = 0;
+    reserved -= opReserve;
+    opReserve = 0;
+    if (--active == 0 && journaling) {
+        result = commitLocked();
+    }
+    int freeing = (released.count > 0 && !draining);
+    pthread_mutex_unlock(&journalLock);
+    if (freeing) {
+        drainReleased();
+    }
+    discardFlush(0);
+    return result;
+}
+
+// Called by releaseChain with b_ioLock held.  Returns 1 if the chain is
+// kept until the open transaction commits, 0 if it can be freed now.
+int journalHold(uint64_t firstBlock) {
+    pthread_mutex_lock(&journalLock);
+    int holding = journaling && active > 0 && pushChain(&held, firstBlock) == 0;
+    pthread_mutex_unlock(&journalLock);
+    return holding;
+}
+
+// Most blocks one operation can reserve, 0 without a journal
+uint64_t journalCapacity() {
+    pthread_mutex_lock(&journalLock);
+    uint64_t capacity = journaling ? maxBlocks : 0;
+    pthread_mutex_unlock(&journalLock);
+    return capacity;
+}
+
+// Returns 1 if no operation is open, so every change made so far has
+// committed
+int journalQuiet() {
+    pthread_mutex_lock(&journalLock);
+    int quiet = (active == 0);
+    pthread_mutex_unlock(&journalLock);
+    return quiet;
+}
+
+// Writes count metadata blocks at lba.  Inside an operation they join its
+// transaction; outside one they are committed at once.  A new block uses
+// up the operation's reservation, then any room nobody reserved; a write
+// past that fails rather than commit part of an operation.
+int journalWrite(const void *buffer, uint64_t count, uint64_t lba) {
+    pthread_mutex_lock(&journalLock);
+    if (!journaling) {
+        pthread_mutex_unlock(&journalLock);
+        return (LBAwrite((void *)buffer, count, lba) == count) ? 0 : -1;
+    }
+
+    int result = 0;
+    const char *block = buffer;
+    for (uint64_t i = 0; i < count && result == 0; i++, block += vcb->blockSize) {
+        uint32_t *slot = (hashCap > 0) ? hashSlot(lba + i) : NULL;
+        if (slot != NULL && *slot != UINT32_MAX) {
+            memcpy(pending[*slot].data, block, vcb->blockSize);
+            continue;
+        }
+
+        int own = (depth > 0 && opReserve > 0);
+        if (!own && pendingCount + reserved >= maxBlocks) {
+            printf("Error: The journal is full\n");
+            result = -1;
+            break;
+        }
+        if (pendingCount == pendingCap && growPending() != 0) {
+            result = -1;
+            break;
+        }
+        char *copy = malloc(vcb->blockSize);
+        if (copy == NULL) {
+            result = -1;
+            break;
+        }
+        memcpy(copy, block, vcb->blockSize);
+        pending[pendingCount].lba = lba + i;
+        pending[pendingCount].data = copy;
+        *hashSlot(lba + i) = pendingCount;
+        pendingCount++;
+        if (own) {
+            opReserve--;
+            reserved--;
+        }
+    }
+    if (result == 0 && active == 0) {
+        result = commitLocked();
+    }
+    pthread_mutex_unlock(&journalLock);
+    return result;
+}
+
+// Reads count metadata blocks at lba, as the open transaction has them
+int journalRead(void *buffer, uint64_t count, uint64_t lba) {
+    if (LBAread(buffer, count, lba) != count) {
+        return -1;
+    }
+    pthread_mutex_lock(&journalLock);
+    for (uint64_t i = 0; i < count && pendingCount > 0; i++) {
+        uint32_t *slot = hashSlot(lba + i);
+        if (*slot != UINT32_MAX) {
+            memcpy((char *)buffer + i * vcb->blockSize, pending[*slot].data, vcb->blockSize);
+        }
+    }
+    pthread_mutex_unlock(&journalLock);
+    return 0;
+}
+
+// Blocks in the journal of a volume of totalBlocks, about 1.5%
+static uint64_t journalSize(uint64_t totalBlocks) {
+    uint64_t blocks = totalBlocks / 64;
+    if (blocks < JOURNAL_MIN_BLOCKS) {
+        blocks = JOURNAL_MIN_BLOCKS;
+    }
+    if (blocks > JOURNAL_MAX_BLOCKS) {
+        blocks = JOURNAL_MAX_BLOCKS;
+    }
+    return blocks;
+}
+
+static void startJournal(uint64_t seq) {
+    areaStart = vcb->journalStart + 1;
+    areaEnd = vcb->journalStart + vcb->journalBlocks;
+    position = areaStart;
+    nextSeq = seq;
+    maxBlocks = areaEnd - areaStart;
+    while (maxBlocks > 0 && txnBlocks(maxBlocks) > areaEnd - areaStart) {
+        maxBlocks--;
+    }
+    journaling = 1;
+}
+
+// Reserves the journal of a new volume, or of one formatted before it
+// existed, and records it in the VCB for the caller to write
+int journalCreate() {
+    uint64_t blocks = journalSize(vcb->totalBlocks);
+    int start = allocateBlocks(blocks, vcb);
+    if (start == -1) {
+        printf("Error: Failed to allocate blocks for the journal\n");
+        return -1;
+    }
+    vcb->journalStart = start;
+    vcb->journalBlocks = blocks;
+    if (writeFAT() != 0 || writeSuper(start + 1, 1) != 0) {
+        return -1;
+    }
+    startJournal(1);
+    return 0;
+}
+
+// Replays the journal of a volume being mounted, before anything else is
+// read from it.  Committed transactions are scanned from the start the
+// superblock gives; the last one may not have reached home and is written
+// again.  The VCB is read again in case it was one of its blocks.
+int journalRecover() {
+    if (vcb->journalStart == 0) {
+        return 0; // Formatted before the journal, created once mounted
+    }
+    struct journalSuper *super = malloc(vcb->blockSize);
+    if (super == NULL || LBAread(super, 1, vcb->journalStart) != 1) {
+        free(super);
+        return -1;
+    }
+    uint64_t areaFirst = vcb->journalStart + 1;
+    uint64_t areaLast = vcb->journalStart + vcb->journalBlocks;
+    uint64_t at = (super->magic == JOURNAL_MAGIC) ? super->start : areaFirst;
+    uint64_t seq = (super->magic == JOURNAL_MAGIC) ? super->seq : 1;
+    free(super);
+
+    char *last = NULL;
+    char *header = malloc(vcb->blockSize);
+    while (header != NULL && at >= areaFirst && at < areaLast && LBAread(header, 1, at) == 1) {
+        struct journalTxn *txn = (struct journalTxn *)header;
+        if (txn->magic != JOURNAL_TXN_MAGIC || txn->seq != seq || txn->count == 0 ||
+                txn->totalBlocks != txnBlocks(txn->count) || at + txn->totalBlocks > areaLast) {
+            break;
+        }
+        char *image = malloc(txn->totalBlocks * vcb->blockSize);
+        if (image == NULL || LBAread(image, txn->totalBlocks, at) != txn->totalBlocks) {
+            free(image);
+            break;
+        }
+        struct journalTxn *whole = (struct journalTxn *)image;
+        char *data = image + (whole->totalBlocks - whole->count) * vcb->blockSize;
+        if (checksumOf(seq, whole->targets, whole->count, data) != whole->checksum) {
+            free(image);
+            break; // Torn by the crash, so never committed
+        }
+        free(last);
+        last = image;
+        at += whole->totalBlocks;
+        seq++;
+    }
+    free(header);
+
+    if (last != NULL) {
+        struct journalTxn *txn = (struct journalTxn *)last;
+        char *data = last + (txn->totalBlocks - txn->count) * vcb->blockSize;
+        printf("Replaying journal transaction %lu (%lu blocks)\n", txn->seq, txn->count);
+        for (uint64_t i = 0; i < txn->count; i++) {
+            LBAwrite(data + i * vcb->blockSize, 1, txn->targets[i]);
+        }
+        free(last);
+        if (LBAread(vcb, 1, 1) != 1) {
+            return -1;
+        }
+    }
+
+    // Everything is home now; new transactions start after the old ones
+    if (at < areaFirst || at >= areaLast) {
+        at = areaFirst;
+    }
+    if (writeSuper(at, seq) != 0) {
+        return -1;
+    }
+    startJournal(seq);
+    position = at;
+    return 0;
+}
+
+// Commits what is open, frees what it released and marks the journal
+// empty, at unmount
+void journalClose() {
+    pthread_mutex_lock(&journalLock);
+    if (journaling) {
+        commitLocked();
+    }
+    pthread_mutex_unlock(&journalLock);
+    drainReleased();
+
+    pthread_mutex_lock(&journalLock);
+    if (journaling) {
+        writeSuper(position, nextSeq);
+        journaling = 0;
+    }
+    free(pending);
+    free(pendingHash);
+    free(held.chains);
+    free(released.chains);
+    pending = NULL;
+    pendingHash = NULL;
+    pendingCount = pendingCap = hashCap = 0;
+    memset(&held, 0, sizeof(held));
+    memset(&released, 0, sizeof(released));
+    pthread_mutex_unlock(&journalLock);
+}
@@ -0,0 +1,281 @@
+/**************************************************************
+* Class::  CSC-415-0# Spring 2024
+* Name::
+* Student IDs::
+* GitHub-Name::
+* Group-Name::
+* Project:: Basic File System
+*
+* File:: fsPathCache.c
+*
+* Description:: Whole-path lookup cache used by fs_isFile,
+*   fs_isDir and fs_stat.  A normalized absolute path maps to
+*   the entry it names, or to a negative entry when it names
+*   nothing.  Each result remembers the generation of every
+*   directory it was resolved through; writing a directory
+*   bumps its generation, which invalidates every cached path
+*   through it without searching the cache.
+*
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "mfs.h"
+#include "vcb.h"
+
+#define PATH_CACHE_SIZE 512        // Power of two
+#define PATH_CACHE_MAX_DEPTH 16    // Deeper paths are resolved but not cached
+#define PATH_GENERATIONS 4096      // Power of two
+
+extern struct DirectoryEntry *rootDir;
+extern struct DirectoryEntry *loadedCWD;
+extern char currentWorkingDirectory[MAX_FILENAME_LENGTH];
+
+struct pathDep {
+    uint64_t dirBlock;          // Directory the path was resolved through
+    uint32_t generation;        // Its generation at the time
+};
+
+struct pathEntry {
+    char *path;                 // Normalized absolute path, NULL when unused
+    uint32_t hash;
+    int found;                  // 0 for a negative entry
+    struct DirectoryEntry entry;
+    int depCount;
+    struct pathDep deps[PATH_CACHE_MAX_DEPTH];
+};
+
+static struct pathEntry pathEntries[PATH_CACHE_SIZE];
+
+// Directories share generation counters by hash of their first block.  A
+// collision only bumps more paths out of the cache than necessary.
+static uint32_t generations[PATH_GENERATIONS];
+static pthread_mutex_t pathCacheLock = PTHREAD_MUTEX_INITIALIZER;
+
+uint32_t dirNameHash(const char *name);
+int parsePath(char * path, struct DirectoryEntry ** retParent, int * index, char ** lastElementName);
+int findInDirectory(struct DirectoryEntry* dir, char * name);
+struct DirectoryEntry* loadDir(struct DirectoryEntry* entry);
+void freeDir(struct DirectoryEntry * dir);
+int dcacheLookup(uint64_t parentBlock, const char *name, struct DirectoryEntry *entry, int *slot);
+void dcacheInsert(uint64_t parentBlock, int slot, struct DirectoryEntry *entry);
+int bloomMayContain(uint64_t dirBlock, const char *name);
+int dirLookupBlock(uint64_t dirBlock, const char *name, struct DirectoryEntry *entry);
+
+static uint32_t *generationOf(uint64_t dirBlock) {
+    return &generations[(dirBlock * 2654435761u) & (PATH_GENERATIONS - 1)];
+}
+
+// Invalidates every cached path resolved through the directory at dirBlock
+void pathCacheBump(uint64_t dirBlock) {
+    pthread_mutex_lock(&pathCacheLock);
+    (*generationOf(dirBlock))++;
+    pthread_mutex_unlock(&pathCacheLock);
+}
+
+// Current generation of the directory at dirBlock.  It changes whenever
+// the directory does, so a caller can tell its copy of an entry went stale.
+uint32_t pathCacheGeneration(uint64_t dirBlock) {
+    pthread_mutex_lock(&pathCacheLock);
+    uint32_t generation = *generationOf(dirBlock);
+    pthread_mutex_unlock(&pathCacheLock);
+    return generation;
+}
+
+// Empties the cache, called when a volume is mounted
+void pathCacheClear() {
+    pthread_mutex_lock(&pathCacheLock);
+    for (int i = 0; i < PATH_CACHE_SIZE; i++) {
+        free(pathEntries[i].path);
+        pathEntries[i].path = NULL;
+    }
+    pthread_mutex_unlock(&pathCacheLock);
+}
+
+// Builds the absolute form of path with empty components removed.  Paths
+// with "." or ".." components return NULL and are left to parsePath, since
+// collapsing them by name would let "file/.." resolve.
+static char *normalizePath(const char *path) {
+    size_t cwdLength = strlen(currentWorkingDirectory);
+    char *joined = malloc(cwdLength + strlen(path) + 2);
+    if (joined == NULL) {
+        return NULL;
+    }
+    if (path[0] == '/') {
+        strcpy(joined, path);
+    } else {
+        strcpy(joined, currentWorkingDirectory);
+        strcat(joined, "/");
+        strcat(joined, path);
+    }
+
+    char *normal = malloc(strlen(joined) + 2);
+    if (normal == NULL) {
+        free(joined);
+        return NULL;
+    }
+    size_t length = 0;
+    char *saveptr;
+    for (char *token = strtok_r(joined, "/", &saveptr); token != NULL;
+            token = strtok_r(NULL, "/", &saveptr)) {
+        if (strcmp(token, ".") == 0 || strcmp(token, "..") == 0) {
+            free(joined);
+            free(normal);
+            return NULL;
+        }
+        normal[length++] = '/';
+        strcpy(normal + length, token);
+        length += strlen(token);
+    }
+    if (length == 0) {
+        normal[length++] = '/';
+    }
+    normal[length] = '\0';
+    free(joined);
+    return normal;
+}
+
+// Walks a normalized path from the root through the dentry cache, loading
+// a directory only for a name it does not have.  Returns 1 with entry
+// filled if the path exists, 0 if not.  The directories walked through
+// are recorded in deps; *depCount is -1 if there were too many.
+static int walkPath(char *path, struct DirectoryEntry *entry, struct pathDep *deps, int *depCount) {
+    *entry = rootDir[0];
+    *depCount = 0;
+
+    char *saveptr;
+    for (char *token = strtok_r(path, "/", &saveptr); token != NULL;
+            token = strtok_r(NULL, "/", &saveptr)) {
+        if (entry->fileType != 1) {
+            return 0; // A file in the middle of the path
+        }
+        uint64_t dirBlock = entry->firstBlockIndex;
+
+        if (*depCount >= 0 && *depCount < PATH_CACHE_MAX_DEPTH) {
+            pthread_mutex_lock(&pathCacheLock);
+            deps[*depCount].dirBlock = dirBlock;
+            deps[*depCount].generation = *generationOf(dirBlock);
+            pthread_mutex_unlock(&pathCacheLock);
+            (*depCount)++;
+        } else {
+            *depCount = -1;
+        }
+
+        if (dcacheLookup(dirBlock, token, entry, NULL) == 0) {
+            continue;
+        }
+        if (!bloomMayContain(dirBlock, token)) {
+            return 0; // Certainly missing, no need to load the directory
+        }
+
+        struct DirectoryEntry *dir;
+        if (dirBlock == rootDir[0].firstBlockIndex) {
+            dir = rootDir;
+        } else if (dirBlock == loadedCWD[0].firstBlockIndex) {
+            dir = loadedCWD;
+        } else {
+            // Read just the blocks the name index leads to
+            int slot = dirLookupBlock(dirBlock, token, entry);
+            if (slot >= 0) {
+                dcacheInsert(dirBlock, slot, entry);
+                continue;
+            }
+            if (slot == -1) {
+                return 0;
+            }
+            dir = loadDir(&(struct DirectoryEntry){.firstBlockIndex = dirBlock});
+            if (dir == NULL) {
+                return 0;
+            }
+        }
+        int idx = findInDirectory(dir, token);
+        if (idx >= 0) {
+            *entry = dir[idx];
+            dcacheInsert(dirBlock, idx, entry);
+        }
+        freeDir(dir);
+        if (idx < 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Looks path up, from the cache when an up-to-date result is there.
+// Returns 1 with entry filled if path exists, 0 if it does not.
+int pathLookup(const char *path, struct DirectoryEntry *entry) {
+    if (path == NULL || path[0] == '\0') {
+        return 0;
+    }
+
+    char *normal = normalizePath(path);
+    if (normal == NULL) {
+        // Let parsePath deal with "." and ".."
+        struct DirectoryEntry *parent;
+        int index;
+        char *lastElementName;
+        char *pathCopy = strdup(path); // parsePath tokenizes in place
+        int result = parsePath(pathCopy, &parent, &index, &lastElementName);
+        free(pathCopy);
+        if (result == -1) {
+            return 0;
+        }
+        if (result == 0) {
+            *entry = parent[index];
+        }
+        freeDir(parent);
+        return result == 0;
+    }
+
+    if (strcmp(normal, "/") == 0) {
+        *entry = rootDir[0]; // Always in memory
+        free(normal);
+        return 1;
+    }
+
+    uint32_t hash = dirNameHash(normal);
+    struct pathEntry *cached = &pathEntries[hash & (PATH_CACHE_SIZE - 1)];
+
+    pthread_mutex_lock(&pathCacheLock);
+    if (cached->path != NULL && cached->hash == hash && strcmp(cached->path, normal) == 0) {
+        int valid = 1;
+        for (int i = 0; i < cached->depCount && valid; i++) {
+            valid = (*generationOf(cached->deps[i].dirBlock) == cached->deps[i].generation);
+        }
+        if (valid) {
+            int found = cached->found;
+            if (found) {
+                *entry = cached->entry;
+            }
+            pthread_mutex_unlock(&pathCacheLock);
+            free(normal);
+            return found;
+        }
+    }
+    pthread_mutex_unlock(&pathCacheLock);
+
+    struct pathDep deps[PATH_CACHE_MAX_DEPTH];
+    int depCount;
+    char *walkCopy = strdup(normal);
+    int found = walkPath(walkCopy, entry, deps, &depCount);
+    free(walkCopy);
+
+    if (depCount >= 0) {
+        pthread_mutex_lock(&pathCacheLock);
+        free(cached->path);
+        cached->path = normal;
+        cached->hash = hash;
+        cached->found = found;
+        if (found) {
+            cached->entry = *entry;
+        }
+        cached->depCount = depCount;
+        memcpy(cached->deps, deps, depCount * sizeof(struct pathDep));
+        pthread_mutex_unlock(&pathCacheLock);
+    } else {
+        free(normal);
+    }
+    return found;
+}
@@ -0,0 +1,537 @@
+/**************************************************************
+* Class::  CSC-415-0# Spring 2024
+* Name::
+* Student IDs::
+* GitHub-Name::
+* Group-Name::
+* Project:: Basic File System
+*
+* File:: fsTransfer.c
+*
+* Description:: Bulk copies between Linux files and the volume.
+*   The size of the data is known up front, so the destination
+*   extent is reserved in one step and the data is streamed
+*   through two large aligned buffers: one thread fills a buffer
+*   while the other drains the previous one.
+*
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "mfs.h"
+#include "fsLow.h"
+#include "vcb.h"
+
+#define TRANSFER_CHUNK (1024 * 1024)   // Bytes moved per buffer
+#define TRANSFER_ALIGN 4096            // Buffer alignment for the host I/O
+#define MAX_EXTENTS 1024               // Pieces a fragmented file may use
+
+extern struct VolumeControlBlock* vcb;
+extern struct FATEntry* fat;
+extern pthread_mutex_t b_ioLock;
+
+int parsePath(char * path, struct DirectoryEntry ** retParent, int * index, char ** lastElementName);
+void freeDir(struct DirectoryEntry * dir);
+int allocateExtents(uint64_t numBlocks, struct extent *extents, int maxExtents);
+uint64_t fatSpan(const struct extent *extents, int count);
+int writeFAT();
+int writeRefcounts();
+int writeDirSlot(struct DirectoryEntry *dir, int slot);
+void journalBegin();
+int journalBeginSized(uint64_t blocks);
+int journalReserve(uint64_t blocks);
+int journalEnd();
+int addDirEntry(struct DirectoryEntry **dirp, const char *name, struct DirectoryEntry *entry);
+void releaseChain(uint64_t firstBlock);
+uint64_t freeChain(uint64_t firstBlock, uint64_t limit);
+uint64_t dirInlineRoom(const char *name);
+char *dirInlineData(struct DirectoryEntry *entry);
+int b_slotOpen(uint64_t dirBlock, int index);
+
+// One of the two buffers passed between the threads
+struct transferSlot {
+    char *data;
+    size_t length;  // Valid bytes, 0 marks the end of the stream
+    int full;
+};
+
+struct transferPipe {
+    struct transferSlot slots[2];
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    int error;
+
+    // Produces up to TRANSFER_CHUNK bytes into buffer, returns the count,
+    // 0 at the end or -1 on error
+    ssize_t (*produce)(struct transferPipe *pipe, char *buffer);
+    // Consumes length bytes from buffer, returns 0 or -1 on error
+    int (*consume)(struct transferPipe *pipe, char *buffer, size_t length);
+
+    int linuxFd;
+    struct extent *extents;
+    int extentCount;
+    int extentIndex;           // Extent the volume side is positioned in
+    uint64_t extentOffset;     // Blocks already used from that extent
+    uint64_t bytesLeft;        // Bytes still to come from the volume
+};
+
+static double elapsedSeconds(struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Reads or writes the next blockCount blocks of the extent list.  Each run
+// holds b_ioLock, which serializes the LBA layer.
+static int extentIO(struct transferPipe *pipe, char *buffer, uint64_t blockCount, int writing) {
+    while (blockCount > 0) {
+        if (pipe->extentIndex >= pipe->extentCount) {
+            return -1;
+        }
+        struct extent *ext = &pipe->extents[pipe->extentIndex];
+        uint64_t run = ext->count - pipe->extentOffset;
+        if (run > blockCount) {
+            run = blockCount;
+        }
+
+        pthread_mutex_lock(&b_ioLock);
+        uint64_t done = writing
+            ? LBAwrite(buffer, run, ext->start + pipe->extentOffset)
+            : LBAread(buffer, run, ext->start + pipe->extentOffset);
+        pthread_mutex_unlock(&b_ioLock);
+        if (done != run) {
+            return -1;
+        }
+
+        buffer += run * vcb->blockSize;
+        blockCount -= run;
+        pipe->extentOffset += run;
+        if (pipe->extentOffset == ext->count) {
+            pipe->extentIndex++;
+            pipe->extentOffset = 0;
+        }
+    }
+    return 0;
+}
+
+static ssize_t readLinux(struct transferPipe *pipe, char *buffer) {
+    size_t filled = 0;
+    while (filled < TRANSFER_CHUNK) {
+        ssize_t got = read(pipe->linuxFd, buffer + filled, TRANSFER_CHUNK - filled);
+        if (got < 0) {
+            return -1;
+        }
+        if (got == 0) {
+            break;
+        }
+        filled += got;
+    }
+    return filled;
+}
+
+static int writeVolume(struct transferPipe *pipe, char *buffer, size_t length) {
+    uint64_t blocks = (length + vcb->blockSize - 1) / vcb->blockSize;
+    memset(buffer + length, 0, blocks * vcb->blockSize - length);  // Zero the tail of the last block
+    return extentIO(pipe, buffer, blocks, 1);
+}
+
+static ssize_t readVolume(struct transferPipe *pipe, char *buffer) {
+    uint64_t length = pipe->bytesLeft < TRANSFER_CHUNK ? pipe->bytesLeft : TRANSFER_CHUNK;
+    uint64_t blocks = (length + vcb->blockSize - 1) / vcb->blockSize;
+    if (length == 0) {
+        return 0;
+    }
+    if (extentIO(pipe, buffer, blocks, 0) != 0) {
+        return -1;
+    }
+    pipe->bytesLeft -= length;
+    return length;
+}
+
+static int writeLinux(struct transferPipe *pipe, char *buffer, size_t length) {
+    size_t written = 0;
+    while (written < length) {
+        ssize_t put = write(pipe->linuxFd, buffer + written, length - written);
+        if (put <= 0) {
+            return -1;
+        }
+        written += put;
+    }
+    return 0;
+}
+
+// Reader side: fill the slots in turn until the source is exhausted
+static void *producerThread(void *arg) {
+    struct transferPipe *pipe = arg;
+    for (int turn = 0; ; turn ^= 1) {
+        struct transferSlot *slot = &pipe->slots[turn];
+
+        pthread_mutex_lock(&pipe->lock);
+        while (slot->full && !pipe->error) {
+            pthread_cond_wait(&pipe->changed, &pipe->lock);
+        }
+        int stop = pipe->error;
+        pthread_mutex_unlock(&pipe->lock);
+        if (stop) {
+            return NULL;
+        }
+
+        ssize_t length = pipe->produce(pipe, slot->data);
+
+        pthread_mutex_lock(&pipe->lock);
+        if (length < 0) {
+            pipe->error = 1;
+        } else {
+            slot->length = length;
+            slot->full = 1;
+        }
+        pthread_cond_broadcast(&pipe->changed);
+        pthread_mutex_unlock(&pipe->lock);
+
+        if (length <= 0) {
+            return NULL;
+        }
+    }
+}
+
+// Writer side: drain the slots in the same order they were filled
+static void *consumerThread(void *arg) {
+    struct transferPipe *pipe = arg;
+    for (int turn = 0; ; turn ^= 1) {
+        struct transferSlot *slot = &pipe->slots[turn];
+
+        pthread_mutex_lock(&pipe->lock);
+        while (!slot->full && !pipe->error) {
+            pthread_cond_wait(&pipe->changed, &pipe->lock);
+        }
+        int stop = pipe->error;
+        pthread_mutex_unlock(&pipe->lock);
+        if (stop || slot->length == 0) {
+            return NULL;
+        }
+
+        int result = pipe->consume(pipe, slot->data, slot->length);
+
+        pthread_mutex_lock(&pipe->lock);
+        if (result != 0) {
+            pipe->error = 1;
+        }
+        slot->full = 0;
+        pthread_cond_broadcast(&pipe->changed);
+        pthread_mutex_unlock(&pipe->lock);
+    }
+}
+
+// Runs the reader and writer threads over the two buffers
+static int runPipe(struct transferPipe *pipe) {
+    // Room for a whole chunk plus the padding of a partial last block
+    size_t bufferSize = TRANSFER_CHUNK + vcb->blockSize;
+    for (int i = 0; i < 2; i++) {
+        pipe->slots[i].full = 0;
+        pipe->slots[i].length = 0;
+        if (posix_memalign((void **)&pipe->slots[i].data, TRANSFER_ALIGN, bufferSize) != 0) {
+            if (i == 1) {
+                free(pipe->slots[0].data);
+            }
+            return -1;
+        }
+    }
+    pthread_mutex_init(&pipe->lock, NULL);
+    pthread_cond_init(&pipe->changed, NULL);
+    pipe->error = 0;
+
+    pthread_t producer, consumer;
+    pthread_create(&producer, NULL, producerThread, pipe);
+    pthread_create(&consumer, NULL, consumerThread, pipe);
+    pthread_join(producer, NULL);
+    pthread_join(consumer, NULL);
+
+    pthread_cond_destroy(&pipe->changed);
+    pthread_mutex_destroy(&pipe->lock);
+    free(pipe->slots[0].data);
+    free(pipe->slots[1].data);
+    return pipe->error ? -1 : 0;
+}
+
+// Checks that fsPath can take a file of size bytes and allocates its
+// blocks, unless it is small enough to live in its directory entry.
+// Called with b_ioLock held inside a journal operation reserved for the
+// FAT blocks of a single run; a fragmented allocation reserves more.
+// Returns the number of extents, 0 for none, or -1.
+static int allocateDestination(const char *fsPath, uint64_t size, struct extent *extents) {
+    struct DirectoryEntry *parent;
+    int index;
+    char *lastElementName;
+    char *pathCopy = strdup(fsPath);
+    int result = parsePath(pathCopy, &parent, &index, &lastElementName);
+    if (result == -1 || lastElementName == NULL ||
+            (result == 0 && parent[index].fileType != 0)) {
+        if (result != -1) {
+            freeDir(parent);
+        }
+        free(pathCopy);
+        return -1;
+    }
+    // An open file's record maps the blocks being replaced and may still
+    // write through them
+    if (result == 0 && b_slotOpen(parent[0].firstBlockIndex, index)) {
+        printf("Error: %s is in use\n", fsPath);
+        freeDir(parent);
+        free(pathCopy);
+        return -1;
+    }
+    int inlined = (size > 0 && size <= dirInlineRoom(lastElementName));
+    freeDir(parent);
+    free(pathCopy);
+
+    uint64_t numBlocks = inlined ? 0 : (size + vcb->blockSize - 1) / vcb->blockSize;
+    int extentCount = allocateExtents(numBlocks, extents, MAX_EXTENTS);
+    if (extentCount < 0) {
+        printf("Error: Not enough free space for %s\n", fsPath);
+        return -1;
+    }
+    uint64_t span = fatSpan(extents, extentCount);
+    if (extentCount > 0 && (journalReserve(span + 1) != 0 || writeFAT() != 0)) {
+        freeChain(extents[0].start, 0);
+        return -1;
+    }
+    return extentCount;
+}
+
+// Points fsPath at the data of entry, replacing the file there if there is
+// one.  The path is looked up again, since the directory may have changed
+// while the data was copied.  Called with b_ioLock held inside a journal
+// operation.
+static int linkDestination(const char *fsPath, struct DirectoryEntry *entry) {
+    struct DirectoryEntry *parent;
+    int index;
+    char *lastElementName;
+    char *pathCopy = strdup(fsPath);
+    int result = parsePath(pathCopy, &parent, &index, &lastElementName);
+    if (result == -1 || lastElementName == NULL ||
+            (result == 0 && parent[index].fileType != 0)) {
+        if (result != -1) {
+            freeDir(parent);
+        }
+        free(pathCopy);
+        return -1;
+    }
+    if (result == 0 && b_slotOpen(parent[0].firstBlockIndex, index)) {
+        printf("Error: %s is in use\n", fsPath);
+        result = -1;
+    } else if (result == 0) {
+        uint64_t oldBlocks = parent[index].firstBlockIndex;
+        entry->creationTime = parent[index].creationTime;
+        entry->linkCount = parent[index].linkCount;
+        entry->inUse = 1;
+        strcpy(entry->filename, parent[index].filename); // Clear of any inline data
+        parent[index] = *entry;
+        result = writeDirSlot(parent, index);
+        if (result == 0) {
+            releaseChain(oldBlocks);
+            writeRefcounts();
+        }
+    } else {
+        entry->creationTime = entry->lastModifiedTime;
+        result = (addDirEntry(&parent, lastElementName, entry) == -1) ? -1 : 0;
+    }
+    freeDir(parent);
+    free(pathCopy);
+    return result;
+}
+
+// Copies a Linux file into the volume.  An existing file is replaced.
+int fs_importFile(const char *linuxPath, const char *fsPath, struct fs_transferstats *stats) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int linuxFd = open(linuxPath, O_RDONLY);
+    if (linuxFd < 0) {
+        printf("Error: Cannot open %s\n", linuxPath);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(linuxFd, &st) != 0) {
+        close(linuxFd);
+        return -1;
+    }
+
+    // 1. Check the destination and reserve all of it up front, in a
+    // transaction of its own.  Nothing refers to the blocks until step 3,
+    // so a crash in between only leaks them.
+    uint64_t reserved = ((st.st_size + vcb->blockSize - 1) / vcb->blockSize * sizeof(struct FATEntry) +
+        vcb->blockSize - 1) / vcb->blockSize + 1;
+    struct extent *extents = malloc(sizeof(struct extent) * MAX_EXTENTS);
+    int extentCount = -1;
+    // Outside b_ioLock, since it may wait for a commit
+    if (journalBeginSized(reserved + 1) == 0 && extents != NULL) {
+        pthread_mutex_lock(&b_ioLock);
+        extentCount = allocateDestination(fsPath, st.st_size, extents);
+        pthread_mutex_unlock(&b_ioLock);
+    }
+    int result = journalEnd();
+    if (extentCount < 0) {
+        free(extents);
+        close(linuxFd);
+        return -1;
+    }
+
+    // 2. Stream the data.  A file small enough to live in its directory
+    // entry needs no blocks at all.
+    struct DirectoryEntry entry = {0};
+    if (result == 0 && extentCount == 0 && st.st_size > 0) {
+        entry.fileSize = st.st_size;
+        entry.inlineData = 1;
+        result = (read(linuxFd, dirInlineData(&entry), st.st_size) == st.st_size) ? 0 : -1;
+    } else if (result == 0 && extentCount > 0) {
+        struct transferPipe pipe = {0};
+        pipe.produce = readLinux;
+        pipe.consume = writeVolume;
+        pipe.linuxFd = linuxFd;
+        pipe.extents = extents;
+        pipe.extentCount = extentCount;
+        result = runPipe(&pipe);
+    }
+    close(linuxFd);
+
+    // 3. Point the entry at the new data, in one journal transaction.  The
+    // file is not open; b_ioLock keeps it so until the old blocks are
+    // released.
+    journalBegin();
+    pthread_mutex_lock(&b_ioLock);
+    entry.fileSize = st.st_size;
+    entry.firstBlockIndex = (extentCount > 0) ? extents[0].start : 0;
+    entry.lastModifiedTime = time(NULL);
+    entry.fileType = 0;
+    if (result == 0) {
+        result = linkDestination(fsPath, &entry);
+    }
+    if (result != 0) {
+        releaseChain(entry.firstBlockIndex);
+    }
+    writeFAT();
+    pthread_mutex_unlock(&b_ioLock);
+    if (journalEnd() != 0) {
+        result = -1;
+    }
+    free(extents);
+
+    if (stats != NULL) {
+        stats->bytes = (result == 0) ? st.st_size : 0;
+        stats->seconds = elapsedSeconds(&start);
+    }
+    return result;
+}
+
+// Finds the file to export.  Called with b_ioLock held.
+static int findSource(const char *fsPath, struct DirectoryEntry *source) {
+    struct DirectoryEntry *parent;
+    int index;
+    char *lastElementName;
+    char *pathCopy = strdup(fsPath);
+    int result = parsePath(pathCopy, &parent, &index, &lastElementName);
+    free(pathCopy);
+    if (result == -1) {
+        return -1;
+    }
+    if (result != 0 || lastElementName == NULL || parent[index].fileType != 0) {
+        freeDir(parent);
+        return -1;
+    }
+    // An open file may have data still in its record, not yet in its
+    // entry or its blocks
+    if (b_slotOpen(parent[0].firstBlockIndex, index)) {
+        printf("Error: %s is in use\n", fsPath);
+        freeDir(parent);
+        return -1;
+    }
+    *source = parent[index];
+    freeDir(parent);
+    return 0;
+}
+
+// Turns a FAT chain into runs of contiguous blocks.  Called with b_ioLock
+// held.
+static struct extent *chainExtents(uint64_t firstBlock, int *count) {
+    int extentCapacity = 64;
+    int extentCount = 0;
+    struct extent *extents = malloc(sizeof(struct extent) * extentCapacity);
+    if (extents == NULL) {
+        return NULL;
+    }
+    for (uint64_t block = firstBlock; block != 0 && block != FAT_EOF; block = fat[block].nextBlock) {
+        if (extentCount > 0 &&
+                extents[extentCount - 1].start + extents[extentCount - 1].count == block) {
+            extents[extentCount - 1].count++;
+            continue;
+        }
+        if (extentCount == extentCapacity) {
+            extentCapacity *= 2;
+            struct extent *grown = realloc(extents, sizeof(struct extent) * extentCapacity);
+            if (grown == NULL) {
+                free(extents);
+                return NULL;
+            }
+            extents = grown;
+        }
+        extents[extentCount].start = block;
+        extents[extentCount].count = 1;
+        extentCount++;
+    }
+    *count = extentCount;
+    return extents;
+}
+
+// Copies a file from the volume out to Linux
+int fs_exportFile(const char *fsPath, const char *linuxPath, struct fs_transferstats *stats) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // 1. Find the source file and turn its chain into runs
+    struct DirectoryEntry source;
+    struct extent *extents = NULL;
+    int extentCount = 0;
+    pthread_mutex_lock(&b_ioLock);
+    int result = findSource(fsPath, &source);
+    if (result == 0 && !source.inlineData) {
+        extents = chainExtents(source.firstBlockIndex, &extentCount);
+        result = (extents == NULL) ? -1 : 0;
+    }
+    pthread_mutex_unlock(&b_ioLock);
+    if (result != 0) {
+        return -1;
+    }
+
+    // 2. Stream the data, which for a small file came in with the directory
+    int linuxFd = open(linuxPath, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (linuxFd < 0) {
+        printf("Error: Cannot create %s\n", linuxPath);
+        free(extents);
+        return -1;
+    }
+    if (source.inlineData) {
+        result = (write(linuxFd, dirInlineData(&source), source.fileSize) == (ssize_t)source.fileSize) ? 0 : -1;
+    } else {
+        struct transferPipe pipe = {0};
+        pipe.produce = readVolume;
+        pipe.consume = writeLinux;
+        pipe.linuxFd = linuxFd;
+        pipe.extents = extents;
+        pipe.extentCount = extentCount;
+        pipe.bytesLeft = source.fileSize;
+        result = runPipe(&pipe);
+    }
+    close(linuxFd);
+    free(extents);
+
+    if (stats != NULL) {
+        stats->bytes = (result == 0) ? source.fileSize : 0;
+        stats->seconds = elapsedSeconds(&start);
+    }
+    return result;
+}
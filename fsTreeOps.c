@@ -0,0 +1,254 @@
+/**************************************************************
+* Class::  CSC-415-0# Spring 2024
+* Name::
+* Student IDs::
+* GitHub-Name::
+* Group-Name::
+* Project:: Basic File System
+*
+* File:: fsTreeOps.c
+*
+* Description:: Recursive remove and copy, built on fs_walk.
+*   A removal walks the tree to collect every chain under it,
+*   unlinks the top entry from its parent once, and then frees
+*   all the chains with a single FAT and share count write
+*   rather than rewriting each directory as it empties.  A copy
+*   creates each directory before its contents and clones the
+*   files as the walk's workers reach them.
+*
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include "mfs.h"
+#include "vcb.h"
+#include "b_io.h"
+
+#define COPY_BUFFER (64 * 1024)
+
+extern struct DirectoryEntry *loadedCWD;
+extern pthread_mutex_t b_ioLock;
+
+int pathLookup(const char *path, struct DirectoryEntry *entry);
+int parsePath(char *path, struct DirectoryEntry **retParent, int *index, char **lastElementName);
+void freeDir(struct DirectoryEntry *dir);
+int unlinkEntry(const char *path, struct DirectoryEntry *removed);
+void forgetDir(uint64_t dirBlock);
+void releaseChain(uint64_t firstBlock);
+int writeFAT();
+int writeRefcounts();
+int b_isOpen(uint64_t dirBlock, int index);
+struct dirReader *dirReaderOpen(uint64_t firstBlock);
+void dirReaderClose(struct dirReader *reader);
+uint8_t dirReaderIndexType(struct dirReader *reader);
+int dirIsWithin(uint64_t dirBlock, uint64_t ancestor);
+void journalBegin();
+int journalEnd();
+
+struct chain {
+    uint64_t firstBlock;
+    int isDir;
+};
+
+struct removal {
+    pthread_mutex_t lock;
+    struct chain *chains;
+    uint64_t count;
+    uint64_t capacity;
+};
+
+static int collectChain(const struct fs_walkent *ent, void *context) {
+    struct removal *removal = context;
+    int isDir = (ent->entry->fileType == 1);
+    if (isDir && (ent->entry->firstBlockIndex == loadedCWD[0].firstBlockIndex ||
+            b_isOpen(ent->entry->firstBlockIndex, -1))) {
+        printf("Error: %s is in use\n", ent->path);
+        return -1;
+    }
+    if (ent->entry->firstBlockIndex == 0) {
+        return 0; // Empty or inline file
+    }
+
+    pthread_mutex_lock(&removal->lock);
+    if (removal->count == removal->capacity) {
+        uint64_t capacity = (removal->capacity > 0) ? removal->capacity * 2 : 256;
+        struct chain *grown = realloc(removal->chains, capacity * sizeof(struct chain));
+        if (grown == NULL) {
+            pthread_mutex_unlock(&removal->lock);
+            return -1;
+        }
+        removal->chains = grown;
+        removal->capacity = capacity;
+    }
+    removal->chains[removal->count].firstBlock = ent->entry->firstBlockIndex;
+    removal->chains[removal->count].isDir = isDir;
+    removal->count++;
+    pthread_mutex_unlock(&removal->lock);
+    return 0;
+}
+
+// Removes path and everything under it.  Nothing is changed unless the
+// whole tree could be read and none of it is in use.
+int fs_rmtree(const char *path, int nthreads) {
+    struct DirectoryEntry entry;
+    if (!pathLookup(path, &entry)) {
+        return -1;
+    }
+    if (entry.fileType != 1) {
+        return fs_delete((char *)path);
+    }
+
+    struct removal removal = {0};
+    pthread_mutex_init(&removal.lock, NULL);
+    int result = fs_walk(path, collectChain, FS_WALK_DEPTH, nthreads, &removal);
+    pthread_mutex_destroy(&removal.lock);
+    if (result != 0) {
+        free(removal.chains);
+        return -1;
+    }
+
+    // The unlink and the freed blocks commit as one transaction
+    journalBegin();
+    result = unlinkEntry(path, &entry);
+    if (result == 0) {
+        // The tree is unreachable now, so its blocks go back in one pass
+        for (uint64_t i = 0; i < removal.count; i++) {
+            if (removal.chains[i].isDir) {
+                forgetDir(removal.chains[i].firstBlock);
+            }
+            releaseChain(removal.chains[i].firstBlock);
+        }
+        if (writeFAT() != 0 || writeRefcounts() != 0) {
+            result = -1;
+        }
+    }
+    free(removal.chains);
+    if (journalEnd() != 0) {
+        return -1;
+    }
+    return (result == 0) ? 0 : -1;
+}
+
+struct copy {
+    const char *srcPath;
+    const char *destPath;
+};
+
+// Where the entry at srcEntryPath goes: its path below srcPath, put below
+// destPath
+static char *destFor(struct copy *copy, const char *srcEntryPath) {
+    const char *rest = srcEntryPath + strlen(copy->srcPath);
+    while (*rest == '/') {
+        rest++;
+    }
+    char *path = malloc(strlen(copy->destPath) + strlen(rest) + 2);
+    if (path != NULL) {
+        strcpy(path, copy->destPath);
+        size_t length = strlen(path);
+        if (*rest != '\0') {
+            if (length == 0 || path[length - 1] != '/') {
+                strcat(path, "/");
+            }
+            strcat(path, rest);
+        }
+    }
+    return path;
+}
+
+// Copies a file's data through b_io, for files that cannot be cloned
+static int copyData(const char *srcPath, const char *destPath) {
+    char *buffer = malloc(COPY_BUFFER);
+    int src = b_open((char *)srcPath, O_RDONLY);
+    int dest = b_open((char *)destPath, O_WRONLY | O_CREAT | O_TRUNC);
+    int result = (buffer == NULL || src < 0 || dest < 0) ? -1 : 0;
+    int count;
+    while (result == 0 && (count = b_read(src, buffer, COPY_BUFFER)) > 0) {
+        if (b_write(dest, buffer, count) != count) {
+            result = -1;
+        }
+    }
+    if (src >= 0) {
+        b_close(src);
+    }
+    if (dest >= 0 && b_close(dest) != 0) {
+        result = -1;
+    }
+    free(buffer);
+    return result;
+}
+
+// Directories keep the index type of their source.  Metadata changes are
+// serialized with the walk's reads on b_ioLock; file data is copied
+// outside it, by b_read and b_write.
+static int copyEntry(const struct fs_walkent *ent, void *context) {
+    struct copy *copy = context;
+    char *destPath = destFor(copy, ent->path);
+    if (destPath == NULL) {
+        return -1;
+    }
+
+    int result;
+    if (ent->entry->fileType == 1) {
+        journalBegin(); // Outside b_ioLock, since it may wait for a commit
+        pthread_mutex_lock(&b_ioLock);
+        mode_t mode = 0777;
+        struct dirReader *reader = dirReaderOpen(ent->entry->firstBlockIndex);
+        if (reader != NULL && dirReaderIndexType(reader) == DIR_INDEX_BTREE) {
+            mode |= FS_DIR_ORDERED;
+        }
+        dirReaderClose(reader);
+        result = fs_mkdir(destPath, mode);
+        pthread_mutex_unlock(&b_ioLock);
+        if (journalEnd() != 0) {
+            result = -1;
+        }
+    } else {
+        // Clones share the source's blocks until either file changes.
+        // fs_clone takes b_ioLock itself.
+        result = fs_clone(ent->path, destPath);
+        if (result != 0) {
+            result = copyData(ent->path, destPath);
+        }
+    }
+    if (result != 0) {
+        printf("Error: Failed to copy %s to %s\n", ent->path, destPath);
+    }
+    free(destPath);
+    return result;
+}
+
+// Copies srcPath and everything under it to destPath, which must not
+// exist yet
+int fs_copytree(const char *srcPath, const char *destPath, int nthreads) {
+    struct DirectoryEntry source;
+    if (!pathLookup(srcPath, &source)) {
+        return -1;
+    }
+
+    struct DirectoryEntry *parent;
+    int index;
+    char *lastElementName;
+    char *pathCopy = strdup(destPath);
+    int result = parsePath(pathCopy, &parent, &index, &lastElementName);
+    if (result != -2) {
+        if (result == 0) {
+            freeDir(parent);
+        }
+        free(pathCopy);
+        return -1; // Destination exists or its directory does not
+    }
+    uint64_t destDir = parent[0].firstBlockIndex;
+    freeDir(parent);
+    free(pathCopy);
+
+    if (source.fileType == 1 && dirIsWithin(destDir, source.firstBlockIndex)) {
+        printf("Error: Cannot copy %s into itself\n", srcPath);
+        return -1;
+    }
+
+    struct copy copy = {srcPath, destPath};
+    return fs_walk(srcPath, copyEntry, 0, nthreads, &copy);
+}
@@ -0,0 +1,391 @@
+/**************************************************************
+* Class::  CSC-415-0# Spring 2024
+* Name::
+* Student IDs::
+* GitHub-Name::
+* Group-Name::
+* Project:: Basic File System
+*
+* File:: fsWalk.c
+*
+* Description:: fs_walk, a parallel nftw-style tree walk.  Every
+*   directory to list is a task on a worker's deque: a worker
+*   takes its own newest task, which keeps it depth first, and
+*   an idle worker steals the oldest task of another, which is
+*   usually the largest subtree left.  The LBA layer has one
+*   file position, so reads are serialized on b_ioLock, but a
+*   directory's blocks are fetched in contiguous runs while its
+*   parent is being listed, and decoding and visiting run on
+*   all workers at once.
+*
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "mfs.h"
+#include "vcb.h"
+#include "fsLow.h"
+
+#define WALK_MAX_THREADS 64
+#define WALK_PREFETCH 4         // Child directories read ahead per listing
+
+extern struct VolumeControlBlock* vcb;
+extern pthread_mutex_t b_ioLock;
+
+int pathLookup(const char *path, struct DirectoryEntry *entry);
+int readChain(uint64_t firstBlock, uint64_t startBlock, uint64_t count, void *buffer);
+int journalRead(void *buffer, uint64_t count, uint64_t lba);
+int dirCompact();
+uint64_t dirDiskBlocksFromFirst(void *firstBlock);
+struct DirectoryEntry *decodeDir(void *diskImage);
+
+// A directory to list.  It stays allocated until everything under it has
+// been visited, which is when FS_WALK_DEPTH visits it.
+struct walkDir {
+    char *path;
+    struct DirectoryEntry entry;
+    int depth;
+    struct walkDir *parent;
+    int pending;                // Its own listing plus unfinished subdirectories
+    void *image;                // On-disk image read ahead, or NULL
+};
+
+struct walkDeque {
+    struct walkDir **tasks;     // Oldest at head, newest at tail - 1
+    int head;
+    int tail;
+    int capacity;
+    pthread_mutex_t lock;
+};
+
+struct walk {
+    fs_walk_fn visit;
+    void *context;
+    int flags;
+    int nthreads;
+    struct walkDeque *deques;
+    pthread_mutex_t lock;       // Guards the fields below
+    pthread_cond_t changed;
+    int queued;                 // Tasks sitting in deques
+    int outstanding;            // Tasks queued or being listed
+    int result;                 // First nonzero visitor result or error
+};
+
+struct walkWorker {
+    struct walk *walk;
+    int id;
+};
+
+static void dequePush(struct walkDeque *deque, struct walkDir *dir) {
+    pthread_mutex_lock(&deque->lock);
+    if (deque->tail == deque->capacity) {
+        int used = deque->tail - deque->head;
+        if (used * 2 > deque->capacity) {
+            deque->capacity *= 2;
+            deque->tasks = realloc(deque->tasks, deque->capacity * sizeof(struct walkDir *));
+        }
+        memmove(deque->tasks, deque->tasks + deque->head, used * sizeof(struct walkDir *));
+        deque->head = 0;
+        deque->tail = used;
+    }
+    deque->tasks[deque->tail++] = dir;
+    pthread_mutex_unlock(&deque->lock);
+}
+
+// Takes the newest task (own deque) or the oldest (stealing)
+static struct walkDir *dequeTake(struct walkDeque *deque, int steal) {
+    struct walkDir *dir = NULL;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->tail > deque->head) {
+        dir = steal ? deque->tasks[deque->head++] : deque->tasks[--deque->tail];
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return dir;
+}
+
+static void submit(struct walk *walk, int worker, struct walkDir *dir) {
+    dequePush(&walk->deques[worker], dir);
+    pthread_mutex_lock(&walk->lock);
+    walk->queued++;
+    walk->outstanding++;
+    pthread_cond_signal(&walk->changed);
+    pthread_mutex_unlock(&walk->lock);
+}
+
+// Checked for every entry, so read without taking the lock
+static int stopped(struct walk *walk) {
+    return __atomic_load_n(&walk->result, __ATOMIC_RELAXED) != 0;
+}
+
+static void stop(struct walk *walk, int result) {
+    pthread_mutex_lock(&walk->lock);
+    if (walk->result == 0) {
+        __atomic_store_n(&walk->result, result, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&walk->lock);
+}
+
+static int visit(struct walk *walk, const char *path, struct DirectoryEntry *entry, int depth) {
+    if (stopped(walk)) {
+        return -1;
+    }
+    struct fs_walkent walkent = {path, entry, depth};
+    int result = walk->visit(&walkent, walk->context);
+    if (result != 0) {
+        stop(walk, result);
+    }
+    return result;
+}
+
+// Reads the on-disk image of a directory.  Callers hold b_ioLock.
+static void *readImage(uint64_t firstBlock) {
+    void *image = malloc(vcb->blockSize);
+    if (image == NULL || journalRead(image, 1, firstBlock) != 0) {
+        free(image);
+        return NULL;
+    }
+    uint64_t blocks = dirDiskBlocksFromFirst(image);
+    void *whole = realloc(image, blocks * vcb->blockSize);
+    if (whole == NULL) {
+        free(image);
+        return NULL;
+    }
+    if (blocks > 1 && readChain(firstBlock, 1, blocks - 1, (char *)whole + vcb->blockSize) != 0) {
+        free(whole);
+        return NULL;
+    }
+    return whole;
+}
+
+// A directory whose listing and subdirectories are all done is visited
+// now under FS_WALK_DEPTH, and its parent may be finished in turn
+static void finish(struct walk *walk, struct walkDir *dir) {
+    while (dir != NULL) {
+        pthread_mutex_lock(&walk->lock);
+        int left = --dir->pending;
+        pthread_mutex_unlock(&walk->lock);
+        if (left > 0) {
+            return;
+        }
+        if (walk->flags & FS_WALK_DEPTH) {
+            visit(walk, dir->path, &dir->entry, dir->depth);
+        }
+        struct walkDir *parent = dir->parent;
+        free(dir->image);
+        free(dir->path);
+        free(dir);
+        dir = parent;
+    }
+}
+
+static char *childPath(const char *parent, const char *name) {
+    size_t length = strlen(parent);
+    char *path = malloc(length + strlen(name) + 2);
+    if (path != NULL) {
+        strcpy(path, parent);
+        if (length == 0 || parent[length - 1] != '/') {
+            strcat(path, "/");
+        }
+        strcat(path, name);
+    }
+    return path;
+}
+
+// Lists one directory: visits its files, reads ahead the subdirectories
+// this worker will take next and queues them all
+static void listDir(struct walk *walk, int worker, struct walkDir *dir) {
+    if (!(walk->flags & FS_WALK_DEPTH) && visit(walk, dir->path, &dir->entry, dir->depth) != 0) {
+        return;
+    }
+
+    void *image = dir->image;
+    dir->image = NULL;
+    if (image == NULL) {
+        pthread_mutex_lock(&b_ioLock);
+        image = readImage(dir->entry.firstBlockIndex);
+        pthread_mutex_unlock(&b_ioLock);
+        if (image == NULL) {
+            stop(walk, -1);
+            return;
+        }
+    }
+    struct DirectoryEntry *entries = image;
+    if (dirCompact()) {
+        entries = decodeDir(image);
+        free(image);
+        if (entries == NULL) {
+            stop(walk, -1);
+            return;
+        }
+    }
+
+    int numEntries = entries[0].fileSize / sizeof(struct DirectoryEntry);
+    struct walkDir **children = NULL;
+    int childCount = 0;
+    int childCap = 0;
+    for (int i = 2; i < numEntries && !stopped(walk); i++) {
+        if (!entries[i].inUse) {
+            continue;
+        }
+        char *path = childPath(dir->path, entries[i].filename);
+        if (path == NULL) {
+            stop(walk, -1);
+            break;
+        }
+        if (entries[i].fileType != 1) {
+            visit(walk, path, &entries[i], dir->depth + 1);
+            free(path);
+            continue;
+        }
+
+        if (childCount == childCap) {
+            childCap = (childCap > 0) ? childCap * 2 : 16;
+            struct walkDir **grown = realloc(children, childCap * sizeof(struct walkDir *));
+            if (grown == NULL) {
+                free(path);
+                stop(walk, -1);
+                break;
+            }
+            children = grown;
+        }
+        struct walkDir *child = calloc(1, sizeof(struct walkDir));
+        if (child == NULL) {
+            free(path);
+            stop(walk, -1);
+            break;
+        }
+        child->path = path;
+        child->entry = entries[i];
+        child->depth = dir->depth + 1;
+        child->parent = dir;
+        child->pending = 1;
+        children[childCount++] = child;
+    }
+    free(entries);
+
+    // This worker takes the newest subdirectories first, so those are read
+    // now, while nobody else can see them
+    pthread_mutex_lock(&b_ioLock);
+    for (int i = childCount - 1; i >= 0 && i >= childCount - WALK_PREFETCH; i--) {
+        children[i]->image = readImage(children[i]->entry.firstBlockIndex);
+    }
+    pthread_mutex_unlock(&b_ioLock);
+
+    pthread_mutex_lock(&walk->lock);
+    dir->pending += childCount;
+    pthread_mutex_unlock(&walk->lock);
+    for (int i = 0; i < childCount; i++) {
+        submit(walk, worker, children[i]);
+    }
+    free(children);
+}
+
+static void *walkWorker(void *arg) {
+    struct walkWorker *self = arg;
+    struct walk *walk = self->walk;
+
+    while (1) {
+        struct walkDir *dir = dequeTake(&walk->deques[self->id], 0);
+        for (int i = 1; dir == NULL && i < walk->nthreads; i++) {
+            dir = dequeTake(&walk->deques[(self->id + i) % walk->nthreads], 1);
+        }
+
+        if (dir == NULL) {
+            pthread_mutex_lock(&walk->lock);
+            while (walk->queued == 0 && walk->outstanding > 0) {
+                pthread_cond_wait(&walk->changed, &walk->lock);
+            }
+            int done = (walk->outstanding == 0);
+            pthread_mutex_unlock(&walk->lock);
+            if (done) {
+                break;
+            }
+            continue;
+        }
+
+        pthread_mutex_lock(&walk->lock);
+        walk->queued--;
+        pthread_mutex_unlock(&walk->lock);
+
+        if (!stopped(walk)) {
+            listDir(walk, self->id, dir);
+        }
+        finish(walk, dir);
+
+        pthread_mutex_lock(&walk->lock);
+        if (--walk->outstanding == 0) {
+            pthread_cond_broadcast(&walk->changed);
+        }
+        pthread_mutex_unlock(&walk->lock);
+    }
+    return NULL;
+}
+
+// Visits path and everything under it, calling visit from nthreads worker
+// threads at once (0 for one per processor).  Directories are visited
+// before their contents, or after them with FS_WALK_DEPTH.  A nonzero
+// return from visit stops the walk and is returned; -1 means path was not
+// found or a directory could not be read.
+int fs_walk(const char *path, fs_walk_fn visit, int flags, int nthreads, void *context) {
+    struct DirectoryEntry entry;
+    if (path == NULL || visit == NULL || !pathLookup(path, &entry)) {
+        return -1;
+    }
+    if (entry.fileType != 1) {
+        struct fs_walkent walkent = {path, &entry, 0};
+        return visit(&walkent, context);
+    }
+
+    if (nthreads <= 0) {
+        nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (nthreads < 1) {
+        nthreads = 1;
+    }
+    if (nthreads > WALK_MAX_THREADS) {
+        nthreads = WALK_MAX_THREADS;
+    }
+
+    struct walk walk = {0};
+    walk.visit = visit;
+    walk.context = context;
+    walk.flags = flags;
+    walk.nthreads = nthreads;
+    pthread_mutex_init(&walk.lock, NULL);
+    pthread_cond_init(&walk.changed, NULL);
+    walk.deques = calloc(nthreads, sizeof(struct walkDeque));
+    for (int i = 0; i < nthreads; i++) {
+        walk.deques[i].capacity = 64;
+        walk.deques[i].tasks = malloc(64 * sizeof(struct walkDir *));
+        pthread_mutex_init(&walk.deques[i].lock, NULL);
+    }
+
+    struct walkDir *top = calloc(1, sizeof(struct walkDir));
+    top->path = strdup(path);
+    top->entry = entry;
+    top->pending = 1;
+    submit(&walk, 0, top);
+
+    pthread_t threads[WALK_MAX_THREADS];
+    struct walkWorker workers[WALK_MAX_THREADS];
+    for (int i = 0; i < nthreads; i++) {
+        workers[i].walk = &walk;
+        workers[i].id = i;
+        pthread_create(&threads[i], NULL, walkWorker, &workers[i]);
+    }
+    for (int i = 0; i < nthreads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (int i = 0; i < nthreads; i++) {
+        free(walk.deques[i].tasks);
+        pthread_mutex_destroy(&walk.deques[i].lock);
+    }
+    free(walk.deques);
+    pthread_mutex_destroy(&walk.lock);
+    pthread_cond_destroy(&walk.changed);
+    return walk.result;
+}
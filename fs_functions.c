@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 #include "mfs.h"
 #include "fsLow.h"
 #include "vcb.h"
@@ -13,6 +14,10 @@ extern struct VolumeControlBlock* vcb;
 extern struct DirectoryEntry *rootDir;  
 extern char currentWorkingDirectory[MAX_FILENAME_LENGTH]; 
 extern struct DirectoryEntry *loadedCWD; 
+extern uint16_t *blockRefs; // Share counts for blocks of cloned files
+extern struct tableDirt fatDirt;
+extern struct tableDirt refsDirt;
+extern pthread_mutex_t b_ioLock;
 
 // Function prototypes
 int parsePath(char * path, struct DirectoryEntry ** retParent, int * index, char ** lastElementName);
@@ -20,35 +25,81 @@ int findInDirectory(struct DirectoryEntry* dir, char * name);
 void freeDir(struct DirectoryEntry * dir);
 struct DirectoryEntry* loadDir(struct DirectoryEntry* entry);
 char *collapsePath(const char *path);
-int allocateBlocks(int numBlocks, struct VolumeControlBlock vcb);
-struct DirectoryEntry* createDirectory(int numEntries, struct DirectoryEntry *parent, struct VolumeControlBlock *vcb);
+int allocateBlocks(int numBlocks, struct VolumeControlBlock *vcb);
+int allocateExtents(uint64_t numBlocks, struct extent *extents, int maxExtents);
+struct DirectoryEntry* createDirectory(int numEntries, struct DirectoryEntry *parent, struct VolumeControlBlock *vcb, uint8_t indexType);
+int writeFAT();
+int writeRefcounts();
+int writeDir(struct DirectoryEntry *dir);
+int writeDirSlot(struct DirectoryEntry *dir, int slot);
+int addDirEntry(struct DirectoryEntry **dirp, const char *name, struct DirectoryEntry *entry);
+int removeDirEntry(struct DirectoryEntry **dirp, int slot);
+int updateDirEntry(uint64_t dirBlock, uint64_t dirSize, int index, struct DirectoryEntry *entry);
+void releaseChain(uint64_t firstBlock);
+uint64_t freeChain(uint64_t firstBlock, uint64_t limit);
+uint64_t fatSpan(const struct extent *extents, int count);
+int cowBlock(struct DirectoryEntry *entry, uint64_t logicalBlock, uint64_t *physBlock);
+int readChain(uint64_t firstBlock, uint64_t startBlock, uint64_t count, void *buffer);
+int writeChain(uint64_t firstBlock, uint64_t startBlock, uint64_t count, void *buffer);
+uint64_t dirTotalBlocks(struct DirectoryEntry *dir);
+uint64_t dirInlineRoom(const char *name);
+int dirCompact();
+uint64_t dirDiskBlocks(struct DirectoryEntry *dir);
+uint64_t dirDiskBlocksFromFirst(void *firstBlock);
+uint16_t dirHeapBlocks(struct DirectoryEntry *dir);
+void *encodeDir(struct DirectoryEntry *dir);
+struct DirectoryEntry *decodeDir(void *diskImage);
+uint16_t dirIndexBlocks(int numEntries, uint8_t indexType);
+void dirTreeSeek(struct DirectoryEntry *dir, const char *from, uint32_t *leafNode, uint32_t *position);
+int dirTreeNext(struct DirectoryEntry *dir, uint32_t *leafNode, uint32_t *position);
+void dirIndexBuild(struct DirectoryEntry *dir);
+void dirIndexInsert(struct DirectoryEntry *dir, int slot);
+void dirIndexRemove(struct DirectoryEntry *dir, int slot);
+int dirIndexLookup(struct DirectoryEntry *dir, const char *name);
+int dcacheLookup(uint64_t parentBlock, const char *name, struct DirectoryEntry *entry, int *slot);
+void dcacheInsert(uint64_t parentBlock, int slot, struct DirectoryEntry *entry);
+void dcacheInvalidateDir(uint64_t parentBlock);
+int pathLookup(const char *path, struct DirectoryEntry *entry);
+void pathCacheBump(uint64_t dirBlock);
+void bloomBuild(struct DirectoryEntry *dir);
+void bloomLoad(struct DirectoryEntry *dir);
+void bloomAdd(uint64_t dirBlock, const char *name);
+void bloomRemove(uint64_t dirBlock);
+int bloomMayContain(uint64_t dirBlock, const char *name);
+struct dirReader *dirReaderOpen(uint64_t firstBlock);
+void dirReaderClose(struct dirReader *reader);
+uint64_t dirReaderCount(struct dirReader *reader);
+uint8_t dirReaderIndexType(struct dirReader *reader);
+int dirReaderEntry(struct dirReader *reader, uint64_t slot, struct DirectoryEntry *entry);
+int dirReaderUpdate(struct dirReader *reader, uint64_t slot, struct DirectoryEntry *entry);
+int dirReaderStore(struct dirReader *reader, struct DirectoryEntry *dir, const int *slots, int slotCount,
+        const uint64_t *indexBlocks, int indexCount);
+int dirLookupBlock(uint64_t dirBlock, const char *name, struct DirectoryEntry *entry);
+int b_isOpen(uint64_t dirBlock, int index);
+int b_slotOpen(uint64_t dirBlock, int index);
+int dirIsWithin(uint64_t dirBlock, uint64_t ancestor);
+void journalBegin();
+int journalEnd();
+int journalWrite(const void *buffer, uint64_t count, uint64_t lba);
+int journalRead(void *buffer, uint64_t count, uint64_t lba);
+int journalHold(uint64_t firstBlock);
+int journalReserve(uint64_t blocks);
+int journalBeginSized(uint64_t blocks);
+int allocFindRun(uint64_t numBlocks);
+void allocNoteUsed(uint64_t start, uint64_t count);
+void allocNoteFreed(uint64_t block);
+void markFAT(uint64_t first, uint64_t count);
+void markRefs(uint64_t first, uint64_t count);
 
 // ... (Your other functions, including createDirectory, parsePath, etc.) ...
-int allocateBlocks(int numBlocks, struct VolumeControlBlock vcb) {
+int allocateBlocks(int numBlocks, struct VolumeControlBlock *vcb) {
     // 1. Check if enough free blocks are available
-    if (vcb.freeBlocks < numBlocks) {
+    if (vcb->freeBlocks < numBlocks) {
         return -1; // Not enough free blocks
     }
 
-    // 2. Find contiguous free blocks in the FAT
-    int firstBlock = -1;
-    int currentBlock = vcb.dataStart; 
-    int contiguousCount = 0;
-
-    while (currentBlock <= vcb.totalBlocks && contiguousCount < numBlocks) { 
-        if (fat[currentBlock].nextBlock == FAT_FREE) { // Accessing the global 'fat'
-            if (contiguousCount == 0) {
-                firstBlock = currentBlock;
-            }
-            contiguousCount++;
-        } else {
-            // Reset if a used block is encountered
-            contiguousCount = 0;
-            firstBlock = -1;
-        }
-        currentBlock++;
-    }
-
+    // 2. Find contiguous free blocks, skipping groups that cannot hold them
+    int firstBlock = allocFindRun(numBlocks);
     if (firstBlock == -1) {
         return -1; // No contiguous blocks found
     }
@@ -69,11 +120,276 @@ int allocateBlocks(int numBlocks, struct VolumeControlBlock vcb) {
         }
     }
 
-    vcb.freeBlocks -= numBlocks;
+    markFAT(firstBlock, numBlocks);
+    vcb->freeBlocks -= numBlocks;
+    allocNoteUsed(firstBlock, numBlocks);
 
     return firstBlock;
 }
 
+// Allocates numBlocks as one chain, as a single contiguous run when the
+// free space allows it.  Otherwise the request is split into progressively
+// smaller runs that are linked together in the FAT.  Returns the number of
+// runs written to extents, or -1 with nothing allocated.
+int allocateExtents(uint64_t numBlocks, struct extent *extents, int maxExtents) {
+    uint64_t remaining = numBlocks;
+    uint64_t tryBlocks = numBlocks;
+    int extentCount = 0;
+
+    while (remaining > 0) {
+        if (tryBlocks > remaining) {
+            tryBlocks = remaining;
+        }
+        int start = (extentCount < maxExtents) ? allocateBlocks(tryBlocks, vcb) : -1;
+        if (start == -1) {
+            if (tryBlocks > 1 && extentCount < maxExtents) {
+                tryBlocks /= 2;
+                continue;
+            }
+            // Give back what was allocated so far
+            for (int i = 0; i < extentCount; i++) {
+                for (uint64_t b = 0; b < extents[i].count; b++) {
+                    fat[extents[i].start + b].nextBlock = FAT_FREE;
+                    allocNoteFreed(extents[i].start + b);
+                }
+                markFAT(extents[i].start, extents[i].count);
+                vcb->freeBlocks += extents[i].count;
+            }
+            return -1;
+        }
+
+        if (extentCount > 0) {
+            struct extent *last = &extents[extentCount - 1];
+            fat[last->start + last->count - 1].nextBlock = start;
+            markFAT(last->start + last->count - 1, 1);
+        }
+        extents[extentCount].start = start;
+        extents[extentCount].count = tryBlocks;
+        extentCount++;
+        remaining -= tryBlocks;
+    }
+    return extentCount;
+}
+
+// Blocks of the FAT holding the entries of count runs, the most that
+// linking them writes to the journal
+uint64_t fatSpan(const struct extent *extents, int count) {
+    uint64_t blocks = 0;
+    for (int i = 0; i < count; i++) {
+        uint64_t first = extents[i].start * sizeof(struct FATEntry) / vcb->blockSize;
+        uint64_t last = (extents[i].start + extents[i].count) * sizeof(struct FATEntry) / vcb->blockSize;
+        blocks += last - first + 1;
+    }
+    return blocks;
+}
+
+// Notes that entries [first, first + count) of a table of entrySize-byte
+// entries changed
+static void markDirt(struct tableDirt *dirt, uint64_t first, uint64_t count, uint64_t entrySize) {
+    if (dirt->marked == NULL || count == 0) {
+        return; // Formatting, the whole table is written
+    }
+    uint64_t last = ((first + count) * entrySize - 1) / vcb->blockSize;
+    for (uint64_t block = first * entrySize / vcb->blockSize; block <= last && block < dirt->blocks; block++) {
+        if (!dirt->marked[block]) {
+            dirt->marked[block] = 1;
+            dirt->list[dirt->count++] = block;
+        }
+    }
+}
+
+void markFAT(uint64_t first, uint64_t count) {
+    markDirt(&fatDirt, first, count, sizeof(struct FATEntry));
+}
+
+void markRefs(uint64_t first, uint64_t count) {
+    markDirt(&refsDirt, first, count, sizeof(uint16_t));
+}
+
+static int byBlock(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Sends the marked blocks of table through the journal, a run of adjacent
+// ones at a time, with the VCB whose free count changes along with them
+static int writeDirt(void *table, struct tableDirt *dirt, uint64_t startBlock) {
+    qsort(dirt->list, dirt->count, sizeof(uint64_t), byBlock);
+    for (uint64_t i = 0; i < dirt->count; ) {
+        uint64_t run = 1;
+        while (i + run < dirt->count && dirt->list[i + run] == dirt->list[i] + run) {
+            run++;
+        }
+        if (journalWrite((char *)table + dirt->list[i] * vcb->blockSize, run,
+                startBlock + dirt->list[i]) != 0) {
+            return -1; // Still marked, so written again next time
+        }
+        i += run;
+    }
+    for (uint64_t i = 0; i < dirt->count; i++) {
+        dirt->marked[dirt->list[i]] = 0;
+    }
+    dirt->count = 0;
+    return journalWrite(vcb, 1, 1);
+}
+
+// Writes the in-memory FAT back to its reserved blocks
+int writeFAT() {
+    int result;
+    if (fatDirt.marked == NULL) {
+        // Still formatting, before the tables are tracked
+        result = (LBAwrite(fat, vcb->fatBlocks, vcb->fatStart) == vcb->fatBlocks) ? 0 : -1;
+    } else {
+        result = writeDirt(fat, &fatDirt, vcb->fatStart);
+    }
+    if (result != 0) {
+        printf("Error: Failed to write FAT\n");
+    }
+    return result;
+}
+
+// Writes the block share counts back to the location recorded in the VCB
+int writeRefcounts() {
+    uint64_t refBlocks = (vcb->fatEntryCount * sizeof(uint16_t) + vcb->blockSize - 1) / vcb->blockSize;
+    int result;
+    if (refsDirt.marked == NULL) {
+        result = (LBAwrite(blockRefs, refBlocks, vcb->metadataLocation) == refBlocks) ? 0 : -1;
+    } else {
+        result = writeDirt(blockRefs, &refsDirt, vcb->metadataLocation);
+    }
+    if (result != 0) {
+        printf("Error: Failed to write block reference counts\n");
+    }
+    return result;
+}
+
+// Returns blocks of a chain to the free pool.  Blocks still shared with a
+// clone only lose one reference.  Chains only ever merge, so once a shared
+// block is reached the rest of the chain is shared as well.  With a limit,
+// stops once that many blocks of the FAT and share counts wait to be
+// written, and returns the rest of the chain; 0 once all of it is done.
+uint64_t freeChain(uint64_t firstBlock, uint64_t limit) {
+    uint64_t current = firstBlock;
+    while (current != 0 && current != FAT_EOF) {
+        uint64_t next = fat[current].nextBlock;
+        if (blockRefs[current] > 0) {
+            blockRefs[current]--;
+            markRefs(current, 1);
+        } else {
+            fat[current].nextBlock = FAT_FREE;
+            markFAT(current, 1);
+            vcb->freeBlocks++;
+            allocNoteFreed(current);
+        }
+        current = next;
+        if (limit > 0 && fatDirt.count + refsDirt.count >= limit) {
+            break;
+        }
+    }
+    return (current == FAT_EOF) ? 0 : current;
+}
+
+// Frees a chain nothing refers to any more.  Inside a journal operation
+// its blocks stay allocated until the operation has committed.
+void releaseChain(uint64_t firstBlock) {
+    if (firstBlock != 0 && firstBlock != FAT_EOF && journalHold(firstBlock)) {
+        return;
+    }
+    freeChain(firstBlock, 0);
+}
+
+// Makes blocks 0..logicalBlock of a file exclusively owned before they are
+// modified.  Since the shared blocks of any chain form a suffix, only the
+// shared part of that range is copied, into blocks allocated in as few
+// runs as the free space allows; the copies link back into the shared
+// remainder of the chain.  The entry's first block may change.
+int cowBlock(struct DirectoryEntry *entry, uint64_t logicalBlock, uint64_t *physBlock) {
+    // 1. Find the first shared block
+    uint64_t prev = 0;  // Block 0 holds the VCB, so it never appears in a chain
+    uint64_t current = entry->firstBlockIndex;
+    uint64_t first = 0;
+    for (; first <= logicalBlock; first++) {
+        if (current == 0 || current == FAT_EOF) {
+            return -1; // File is shorter than logicalBlock
+        }
+        if (blockRefs[current] > 0) {
+            break;
+        }
+        prev = current;
+        current = fat[current].nextBlock;
+    }
+    if (first > logicalBlock) {
+        *physBlock = prev;
+        return 0;
+    }
+
+    // 2. Count the share count blocks the copied range touches
+    uint64_t count = logicalBlock - first + 1;
+    uint64_t refBlocks = 0;
+    uint64_t lastRefBlock = UINT64_MAX;
+    uint64_t rest = current;
+    for (uint64_t i = 0; i < count; i++) {
+        if (rest == 0 || rest == FAT_EOF) {
+            return -1;
+        }
+        if (rest * sizeof(uint16_t) / vcb->blockSize != lastRefBlock) {
+            lastRefBlock = rest * sizeof(uint16_t) / vcb->blockSize;
+            refBlocks++;
+        }
+        rest = fat[rest].nextBlock;
+    }
+
+    // 3. Allocate the copies, and give them back if the journal cannot
+    // take the change
+    struct extent extents[COW_MAX_EXTENTS];
+    int extentCount = allocateExtents(count, extents, COW_MAX_EXTENTS);
+    if (extentCount < 0) {
+        return -1;
+    }
+    char *buffer = malloc(vcb->blockSize);
+    if (buffer == NULL || journalReserve(fatSpan(extents, extentCount) + refBlocks + 2) != 0) {
+        free(buffer);
+        freeChain(extents[0].start, 0);
+        return -1;
+    }
+
+    // 4. Copy the data
+    uint64_t source = current;
+    for (int i = 0; i < extentCount; i++) {
+        for (uint64_t b = 0; b < extents[i].count; b++) {
+            if (LBAread(buffer, 1, source) != 1 || LBAwrite(buffer, 1, extents[i].start + b) != 1) {
+                free(buffer);
+                freeChain(extents[0].start, 0);
+                return -1;
+            }
+            source = fat[source].nextBlock;
+        }
+    }
+    free(buffer);
+
+    // 5. Link the copies in and drop the file's shares of the originals
+    struct extent *last = &extents[extentCount - 1];
+    fat[last->start + last->count - 1].nextBlock = rest;
+    markFAT(last->start + last->count - 1, 1);
+    if (prev == 0) {
+        entry->firstBlockIndex = extents[0].start;
+    } else {
+        fat[prev].nextBlock = extents[0].start;
+        markFAT(prev, 1);
+    }
+    for (source = current; source != rest; source = fat[source].nextBlock) {
+        blockRefs[source]--;
+        markRefs(source, 1);
+    }
+
+    *physBlock = last->start + last->count - 1;
+    if (writeFAT() != 0 || writeRefcounts() != 0) {
+        return -1;
+    }
+    return 0;
+}
+
 int parsePath(char * path, struct DirectoryEntry ** retParent, int * index, char ** lastElementName) {
     printf("Entering parsePath with path: %s\n", path);
 
@@ -95,7 +411,6 @@ int parsePath(char * path, struct DirectoryEntry ** retParent, int * index, char
         printf("Starting at current working directory\n");
     }
 
-    struct DirectoryEntry *parent = NULL;
     char *token1, *token2, *saveptr;
 
     token1 = strtok_r(path, "/", &saveptr); // Corrected strtok_r usage
@@ -108,24 +423,65 @@ int parsePath(char * path, struct DirectoryEntry ** retParent, int * index, char
     }
 
     token2 = strtok_r(NULL, "/", &saveptr); // Corrected strtok_r usage
-    
+
+    // Intermediate components come from the dentry cache when possible, so
+    // a directory is only loaded when one of its names is not cached
+    uint64_t currentBlock = currentDir[0].firstBlockIndex;
     while (token2 != NULL) {
-        int idx = findInDirectory(currentDir, token1);
-        if (idx == -1) {
-            freeDir(currentDir);
-            return -1;
+        struct DirectoryEntry child;
+        if (dcacheLookup(currentBlock, token1, &child, NULL) != 0) {
+            int idx = -2;
+            if (currentDir == NULL) {
+                if (!bloomMayContain(currentBlock, token1)) {
+                    return -1; // Certainly missing, no need to load
+                }
+                // Only the blocks the name index points at are read
+                idx = dirLookupBlock(currentBlock, token1, &child);
+                if (idx == -2) {
+                    currentDir = loadDir(&(struct DirectoryEntry){.firstBlockIndex = currentBlock});
+                    if (currentDir == NULL) {
+                        return -1;
+                    }
+                }
+            }
+            if (idx == -2) {
+                idx = findInDirectory(currentDir, token1);
+                if (idx >= 0) {
+                    child = currentDir[idx];
+                }
+            }
+            if (idx < 0) {
+                freeDir(currentDir);
+                return -1;
+            }
+            dcacheInsert(currentBlock, idx, &child);
         }
-        if (currentDir[idx].fileType != 1) {
+        if (child.fileType != 1) {
             freeDir(currentDir);
             return -1;
         }
-        parent = currentDir;
-        currentDir = loadDir(&currentDir[idx]);
-        freeDir(parent);
+        freeDir(currentDir);
+        currentDir = NULL;
+        currentBlock = child.firstBlockIndex;
         token1 = token2;
         token2 = strtok_r(NULL, "/", &saveptr); // Corrected strtok_r usage
     }
 
+    // The caller gets the last directory itself, which is already in memory
+    // when it is the root or the current working directory
+    if (currentDir == NULL) {
+        if (currentBlock == rootDir[0].firstBlockIndex) {
+            currentDir = rootDir;
+        } else if (currentBlock == loadedCWD[0].firstBlockIndex) {
+            currentDir = loadedCWD;
+        } else {
+            currentDir = loadDir(&(struct DirectoryEntry){.firstBlockIndex = currentBlock});
+            if (currentDir == NULL) {
+                return -1;
+            }
+        }
+    }
+
     // Check if the last token exists
     int idx = findInDirectory(currentDir, token1);
     if (idx == -1) {
@@ -134,6 +490,9 @@ int parsePath(char * path, struct DirectoryEntry ** retParent, int * index, char
         *lastElementName = token1;
         return -2;                // Last token not found
     } else {
+        if (currentDir[idx].fileType == 1) {
+            dcacheInsert(currentBlock, idx, &currentDir[idx]);
+        }
         *retParent = currentDir;
         *index = idx;
         *lastElementName = token1;
@@ -149,6 +508,17 @@ int findInDirectory(struct DirectoryEntry* dir, char * name) {
         return -2;
     }
 
+    // Most names that are not there are ruled out by the filter alone
+    if (!bloomMayContain(dir[0].firstBlockIndex, name)) {
+        return -1;
+    }
+
+    // Directories with a name index answer from it directly
+    int slot = dirIndexLookup(dir, name);
+    if (slot != -2) {
+        return slot;
+    }
+
     // Calculate the actual number of entries in the directory
     int numEntries = dir[0].fileSize / sizeof(struct DirectoryEntry); 
     printf("numEntries: %d\n", numEntries);
@@ -177,6 +547,50 @@ void freeDir(struct DirectoryEntry * dir) {
 }
 
 
+// Reads or writes count blocks of the chain starting at firstBlock,
+// beginning with its logical block startBlock.  Physically contiguous
+// stretches of the chain go to the disk as one transfer.
+static int chainIO(uint64_t firstBlock, uint64_t startBlock, uint64_t count, void *buffer, int write) {
+    uint64_t current = firstBlock;
+    for (uint64_t i = 0; i < startBlock && current != 0 && current != FAT_EOF; i++) {
+        current = fat[current].nextBlock;
+    }
+
+    char *position = buffer;
+    while (count > 0) {
+        if (current == 0 || current == FAT_EOF) {
+            return -1; // Chain is shorter than the transfer
+        }
+        uint64_t run = 1;
+        while (run < count && fat[current + run - 1].nextBlock == current + run) {
+            run++;
+        }
+        // Directories are metadata, so they go through the journal
+        int result = write ? journalWrite(position, run, current) : journalRead(position, run, current);
+        if (result != 0) {
+            return -1;
+        }
+        position += run * vcb->blockSize;
+        count -= run;
+        current = fat[current + run - 1].nextBlock;
+    }
+    return 0;
+}
+
+int readChain(uint64_t firstBlock, uint64_t startBlock, uint64_t count, void *buffer) {
+    return chainIO(firstBlock, startBlock, count, buffer, 0);
+}
+
+int writeChain(uint64_t firstBlock, uint64_t startBlock, uint64_t count, void *buffer) {
+    return chainIO(firstBlock, startBlock, count, buffer, 1);
+}
+
+// Blocks a loaded directory occupies in memory: its entries followed by
+// its index.  See dirDiskBlocks for its size on disk.
+uint64_t dirTotalBlocks(struct DirectoryEntry *dir) {
+    return (dir[0].fileSize + vcb->blockSize - 1) / vcb->blockSize + dir[0].indexBlocks;
+}
+
 struct DirectoryEntry* loadDir(struct DirectoryEntry* entry) {
     printf("Entering loadDir with entry: %s\n", entry->filename); // Added print statement
 
@@ -185,24 +599,421 @@ struct DirectoryEntry* loadDir(struct DirectoryEntry* entry) {
         return NULL;
     }
 
-    int blocksNeeded = (entry->fileSize + vcb->blockSize - 1) / vcb->blockSize;
-    int bytesNeeded = blocksNeeded * vcb->blockSize;
+    // The directory's own "." entry says how large it is, so read that first
+    struct DirectoryEntry *first = malloc(vcb->blockSize);
+    if (first == NULL) {
+        fprintf(stderr, "Memory allocation failed in loadDir\n");
+        exit(1);
+    }
+    printf("Loading directory from block %lu\n", entry->firstBlockIndex); // Added print statement
+    if (journalRead(first, 1, entry->firstBlockIndex) != 0) {
+        free(first);
+        return NULL;
+    }
 
-    printf("Blocks needed: %d, Bytes needed: %d\n", blocksNeeded, bytesNeeded); // Added print statement
+    uint64_t blocksNeeded = dirDiskBlocksFromFirst(first);
+    printf("Blocks needed: %lu\n", blocksNeeded); // Added print statement
 
-    struct DirectoryEntry *new = malloc(bytesNeeded);
+    struct DirectoryEntry *new = realloc(first, blocksNeeded * vcb->blockSize);
     if (new == NULL) {
         fprintf(stderr, "Memory allocation failed in loadDir\n");
         exit(1);
     }
+    if (blocksNeeded > 1 && readChain(entry->firstBlockIndex, 1, blocksNeeded - 1,
+            (char *)new + vcb->blockSize) != 0) {
+        printf("Error: Failed to read directory\n");
+        free(new);
+        return NULL;
+    }
 
-    printf("Loading directory from block %lu\n", entry->firstBlockIndex); // Added print statement
-    LBAread(new, blocksNeeded, entry->firstBlockIndex);
+    // Compact directories are expanded into the usual entry array
+    if (dirCompact()) {
+        struct DirectoryEntry *decoded = decodeDir(new);
+        free(new);
+        if (decoded == NULL) {
+            fprintf(stderr, "Memory allocation failed in loadDir\n");
+            exit(1);
+        }
+        new = decoded;
+    }
+    bloomLoad(new);
 
     printf("Exiting loadDir: Success\n"); // Added print statement
     return new;
 }
 
+static int resizeChain(uint64_t firstBlock, uint64_t oldCount, uint64_t newCount);
+static uint64_t resizeJournalBlocks(uint64_t oldCount, uint64_t newCount);
+
+// Brings the in-memory copy in *copy up to date with dir when both are the
+// same directory, resizing the copy if the directory grew or shrank
+static void syncDirCopy(struct DirectoryEntry **copy, struct DirectoryEntry *dir, uint64_t blocks) {
+    if (*copy == NULL || *copy == dir || (*copy)[0].firstBlockIndex != dir[0].firstBlockIndex) {
+        return;
+    }
+    if (dirTotalBlocks(*copy) != blocks) {
+        struct DirectoryEntry *resized = realloc(*copy, blocks * vcb->blockSize);
+        if (resized == NULL) {
+            return;
+        }
+        *copy = resized;
+    }
+    memcpy(*copy, dir, blocks * vcb->blockSize);
+}
+
+// Slots and index blocks of one loaded directory changed since dirTrack,
+// so that writeDirChanges writes only the blocks holding them.  Directory
+// changes are serialized like the rest of the metadata, so one is tracked
+// at a time; marks on any other directory are ignored.
+static struct {
+    struct DirectoryEntry *dir;     // NULL when none is tracked
+    int whole;                      // Too many changes, or the layout moved
+    int slots[DIR_DIRT_MAX];
+    int slotCount;
+    uint64_t indexBlocks[DIR_DIRT_MAX];
+    int indexCount;
+} dirDirt;
+
+static void dirTrack(struct DirectoryEntry *dir) {
+    dirDirt.dir = dir;
+    dirDirt.whole = 0;
+    dirDirt.slotCount = 0;
+    dirDirt.indexCount = 0;
+}
+
+static void dirMarkSlot(struct DirectoryEntry *dir, int slot) {
+    if (dir != dirDirt.dir) {
+        return;
+    }
+    for (int i = 0; i < dirDirt.slotCount; i++) {
+        if (dirDirt.slots[i] == slot) {
+            return;
+        }
+    }
+    if (dirDirt.slotCount == DIR_DIRT_MAX) {
+        dirDirt.whole = 1;
+        return;
+    }
+    dirDirt.slots[dirDirt.slotCount++] = slot;
+}
+
+// Notes that length bytes at offset into the index of dir changed
+void dirMarkIndex(struct DirectoryEntry *dir, uint64_t offset, uint64_t length) {
+    if (dir != dirDirt.dir || length == 0) {
+        return;
+    }
+    for (uint64_t block = offset / vcb->blockSize; block <= (offset + length - 1) / vcb->blockSize; block++) {
+        int i = 0;
+        while (i < dirDirt.indexCount && dirDirt.indexBlocks[i] != block) {
+            i++;
+        }
+        if (i < dirDirt.indexCount) {
+            continue;
+        }
+        if (dirDirt.indexCount == DIR_DIRT_MAX) {
+            dirDirt.whole = 1;
+            return;
+        }
+        dirDirt.indexBlocks[dirDirt.indexCount++] = block;
+    }
+}
+
+// Brings the marked slots and index blocks of *copyp up to date with dir
+static void syncDirChanges(struct DirectoryEntry **copyp, struct DirectoryEntry *dir) {
+    struct DirectoryEntry *copy = *copyp;
+    if (copy == NULL || copy == dir || copy[0].firstBlockIndex != dir[0].firstBlockIndex) {
+        return;
+    }
+    if (copy[0].fileSize != dir[0].fileSize || copy[0].indexBlocks != dir[0].indexBlocks) {
+        syncDirCopy(copyp, dir, dirTotalBlocks(dir));
+        return;
+    }
+    for (int i = 0; i < dirDirt.slotCount; i++) {
+        copy[dirDirt.slots[i]] = dir[dirDirt.slots[i]];
+    }
+    uint64_t entryBytes = (dir[0].fileSize + vcb->blockSize - 1) / vcb->blockSize * vcb->blockSize;
+    for (int i = 0; i < dirDirt.indexCount; i++) {
+        uint64_t offset = entryBytes + dirDirt.indexBlocks[i] * vcb->blockSize;
+        memcpy((char *)copy + offset, (char *)dir + offset, vcb->blockSize);
+    }
+}
+
+// Writes the changes to the tracked directory dir a few blocks at a time,
+// or the whole directory if they were not tracked or no longer fit in
+// place
+static int writeDirChanges(struct DirectoryEntry *dir) {
+    if (dir != dirDirt.dir || dirDirt.whole) {
+        return writeDir(dir);
+    }
+    struct dirReader *reader = dirReaderOpen(dir[0].firstBlockIndex);
+    int result = (reader == NULL) ? -1 : dirReaderStore(reader, dir, dirDirt.slots, dirDirt.slotCount,
+            dirDirt.indexBlocks, dirDirt.indexCount);
+    dirReaderClose(reader);
+    if (result != 0) {
+        return (result < 0) ? -1 : writeDir(dir);
+    }
+
+    dcacheInvalidateDir(dir[0].firstBlockIndex);
+    pathCacheBump(dir[0].firstBlockIndex);
+    syncDirChanges(&rootDir, dir);
+    syncDirChanges(&loadedCWD, dir);
+    dirDirt.dir = NULL;
+    return 0;
+}
+
+// Writes slot of a loaded directory after a change that leaves its name
+// index alone
+int writeDirSlot(struct DirectoryEntry *dir, int slot) {
+    dirTrack(dir);
+    dirMarkSlot(dir, slot);
+    return writeDirChanges(dir);
+}
+
+// Writes a whole loaded directory back to disk, its names packed.
+// rootDir and loadedCWD are kept as separate in-memory copies, so refresh
+// them when this is the same directory loaded through another path.
+int writeDir(struct DirectoryEntry *dir) {
+    if (dir == dirDirt.dir) {
+        dirDirt.dir = NULL;
+    }
+    dcacheInvalidateDir(dir[0].firstBlockIndex);
+    pathCacheBump(dir[0].firstBlockIndex);
+
+    // A compact directory's name heap is resized as names come and go.
+    // All of it goes through the journal, with the VCB.
+    void *image = dir;
+    uint16_t oldHeapBlocks = dir[0].heapBlocks;
+    uint64_t oldBlocks = dirDiskBlocks(dir);
+    if (dirCompact()) {
+        dir[0].heapBlocks = dirHeapBlocks(dir);
+    }
+    if (journalReserve(dirDiskBlocks(dir) + resizeJournalBlocks(oldBlocks, dirDiskBlocks(dir)) + 1) != 0) {
+        dir[0].heapBlocks = oldHeapBlocks;
+        return -1;
+    }
+    if (dirCompact()) {
+        if (dir[0].heapBlocks != oldHeapBlocks &&
+                resizeChain(dir[0].firstBlockIndex, oldBlocks, dirDiskBlocks(dir)) != 0) {
+            dir[0].heapBlocks = oldHeapBlocks;
+            return -1;
+        }
+        image = encodeDir(dir);
+        if (image == NULL) {
+            return -1;
+        }
+    }
+
+    int result = writeChain(dir[0].firstBlockIndex, 0, dirDiskBlocks(dir), image);
+    if (image != dir) {
+        free(image);
+    }
+    if (result != 0) {
+        printf("Error: Failed to write directory\n");
+        return -1;
+    }
+
+    uint64_t blocksNeeded = dirTotalBlocks(dir);
+    syncDirCopy(&rootDir, dir, blocksNeeded);
+    syncDirCopy(&loadedCWD, dir, blocksNeeded);
+    return 0;
+}
+
+// Blocks of the FAT resizeChain may write, with the VCB
+static uint64_t resizeJournalBlocks(uint64_t oldCount, uint64_t newCount) {
+    uint64_t grown = (newCount > oldCount) ? newCount - oldCount : 0;
+    uint64_t runs = (grown < DIR_MAX_EXTENTS) ? grown : DIR_MAX_EXTENTS;
+    return (grown * sizeof(struct FATEntry) + vcb->blockSize - 1) / vcb->blockSize + runs + 2;
+}
+
+// Changes the length of a chain from oldCount to newCount blocks.  New
+// blocks are linked after the current last block; dropped ones are freed.
+static int resizeChain(uint64_t firstBlock, uint64_t oldCount, uint64_t newCount) {
+    uint64_t keep = (newCount < oldCount) ? newCount : oldCount;
+    uint64_t last = firstBlock;
+    for (uint64_t i = 1; i < keep; i++) {
+        last = fat[last].nextBlock;
+    }
+
+    if (newCount > oldCount) {
+        struct extent extents[DIR_MAX_EXTENTS];
+        if (allocateExtents(newCount - oldCount, extents, DIR_MAX_EXTENTS) == -1) {
+            printf("Error: Not enough free space to grow directory\n");
+            return -1;
+        }
+        fat[last].nextBlock = extents[0].start;
+        markFAT(last, 1);
+    } else if (newCount < oldCount) {
+        uint64_t rest = fat[last].nextBlock;
+        fat[last].nextBlock = FAT_EOF;
+        markFAT(last, 1);
+        releaseChain(rest);
+    }
+    return writeFAT();
+}
+
+// Gives a directory room for entryBlocks blocks of entries.  The entries
+// keep their slots, the chain is grown or trimmed, and the name index is
+// rebuilt at its new size after the entries.  The directory moves in
+// memory, so *dirp (and rootDir or loadedCWD if it was one of them) is
+// replaced; the caller writes the result.
+static int resizeDir(struct DirectoryEntry **dirp, uint64_t entryBlocks) {
+    struct DirectoryEntry *dir = *dirp;
+    uint64_t oldTotal = dirDiskBlocks(dir);
+    int numEntries = entryBlocks * vcb->blockSize / sizeof(struct DirectoryEntry);
+    uint16_t indexBlocks = dirIndexBlocks(numEntries, dir[0].indexType);
+
+    struct DirectoryEntry *resized = calloc(entryBlocks + indexBlocks, vcb->blockSize);
+    if (resized == NULL) {
+        return -1;
+    }
+    uint64_t keepBytes = numEntries * sizeof(struct DirectoryEntry);
+    if (keepBytes > dir[0].fileSize) {
+        keepBytes = dir[0].fileSize;
+    }
+    memcpy(resized, dir, keepBytes);
+    resized[0].fileSize = numEntries * sizeof(struct DirectoryEntry);
+    resized[0].indexBlocks = indexBlocks;
+    dirIndexBuild(resized);
+
+    if (journalReserve(resizeJournalBlocks(oldTotal, dirDiskBlocks(resized))) != 0 ||
+            resizeChain(dir[0].firstBlockIndex, oldTotal, dirDiskBlocks(resized)) != 0) {
+        free(resized);
+        return -1;
+    }
+
+    if (dir == rootDir) {
+        rootDir = resized;
+    }
+    if (dir == loadedCWD) {
+        loadedCWD = resized;
+    }
+    if (dir == dirDirt.dir) {
+        dirTrack(resized);
+        dirDirt.whole = 1;
+    }
+    free(dir);
+    *dirp = resized;
+    return 0;
+}
+
+// Places entry under name in the first free slot of *dirp and writes the
+// directory.  A full directory is first grown by doubling its entry
+// blocks, which may move it in memory.  Returns the slot used, or -1.
+int addDirEntry(struct DirectoryEntry **dirp, const char *name, struct DirectoryEntry *entry) {
+    if (strlen(name) >= MAX_FILENAME_LENGTH) {
+        printf("Error: Name too long: %s\n", name);
+        return -1;
+    }
+    if (entry->inlineData && entry->fileSize > dirInlineRoom(name)) {
+        printf("Error: Name too long for a file stored in its entry: %s\n", name);
+        return -1;
+    }
+
+    struct DirectoryEntry *dir = *dirp;
+    dirTrack(dir);
+    int numEntries = dir[0].fileSize / sizeof(struct DirectoryEntry);
+    int i = 0;
+    while (i < numEntries && dir[i].inUse) {
+        i++;
+    }
+    if (i == numEntries) {
+        uint64_t entryBlocks = (dir[0].fileSize + vcb->blockSize - 1) / vcb->blockSize;
+        if (resizeDir(dirp, entryBlocks * 2) != 0) {
+            printf("Error: No free entries in directory\n");
+            return -1;
+        }
+        dir = *dirp;
+    }
+
+    dir[i] = *entry;
+    strcpy(dir[i].filename, name);
+    dir[i].inUse = 1;
+    dirMarkSlot(dir, i);
+    dirIndexInsert(dir, i);
+    bloomAdd(dir[0].firstBlockIndex, name);
+    if (writeDirChanges(dir) != 0) {
+        dirIndexRemove(dir, i);
+        dir[i].inUse = 0;
+        return -1;
+    }
+    return i;
+}
+
+// Journal blocks adding an entry to dir may take, if that grows it and
+// rewrites all of it
+static uint64_t addJournalBlocks(struct DirectoryEntry *dir) {
+    int numEntries = dir[0].fileSize / sizeof(struct DirectoryEntry);
+    int i = 0;
+    while (i < numEntries && dir[i].inUse) {
+        i++;
+    }
+    uint64_t blocks = dirDiskBlocks(dir);
+    if (i < numEntries) {
+        return blocks + DIR_ENTRY_JOURNAL_BLOCKS;
+    }
+    return blocks * 2 + resizeJournalBlocks(blocks, blocks * 2) + DIR_ENTRY_JOURNAL_BLOCKS;
+}
+
+// Frees slot of *dirp and writes the directory.  Slots stay put because
+// open files refer to their entry by slot, so when the used slots fit in
+// a quarter of the directory the free tail is given back instead.
+int removeDirEntry(struct DirectoryEntry **dirp, int slot) {
+    struct DirectoryEntry *dir = *dirp;
+    dirTrack(dir);
+    dirIndexRemove(dir, slot);
+    memset(&dir[slot], 0, sizeof(struct DirectoryEntry));
+    dirMarkSlot(dir, slot);
+    bloomRemove(dir[0].firstBlockIndex);
+
+    int numEntries = dir[0].fileSize / sizeof(struct DirectoryEntry);
+    int lastUsed = numEntries - 1;
+    while (lastUsed > 0 && !dir[lastUsed].inUse) {
+        lastUsed--;
+    }
+    if ((lastUsed + 1) * 4 <= numEntries && numEntries > DIR_INITIAL_ENTRIES) {
+        uint64_t wanted = (lastUsed + 1) * 2;
+        if (wanted < DIR_INITIAL_ENTRIES) {
+            wanted = DIR_INITIAL_ENTRIES;
+        }
+        uint64_t entryBlocks = (wanted * sizeof(struct DirectoryEntry) + vcb->blockSize - 1) / vcb->blockSize;
+        if (resizeDir(dirp, entryBlocks) == 0) {
+            dir = *dirp;
+        }
+    }
+    return writeDirChanges(dir);
+}
+
+// Rewrites one entry of the directory starting at dirBlock
+int updateDirEntry(uint64_t dirBlock, uint64_t dirSize, int index, struct DirectoryEntry *entry) {
+    // Most updates rewrite just the block holding the entry
+    struct dirReader *reader = dirReaderOpen(dirBlock);
+    int result = (reader == NULL) ? 1 : dirReaderUpdate(reader, index, entry);
+    dirReaderClose(reader);
+    if (result == 0) {
+        dcacheInvalidateDir(dirBlock);
+        pathCacheBump(dirBlock);
+        if (rootDir[0].firstBlockIndex == dirBlock) {
+            rootDir[index] = *entry;
+        }
+        if (loadedCWD[0].firstBlockIndex == dirBlock) {
+            loadedCWD[index] = *entry;
+        }
+        return 0;
+    }
+    if (result < 0) {
+        return -1;
+    }
+
+    struct DirectoryEntry *dir = loadDir(&(struct DirectoryEntry){.firstBlockIndex = dirBlock, .fileSize = dirSize});
+    if (dir == NULL) {
+        return -1;
+    }
+    dir[index] = *entry;
+    result = writeDir(dir);
+    free(dir);
+    return result;
+}
+
 char *collapsePath(const char *path) {
     char *pathCopy = strdup(path); // Make a copy to work with
     char *token, *saveptr;
@@ -245,19 +1056,13 @@ char *collapsePath(const char *path) {
     return collapsedPath;
 }
 
-struct DirectoryEntry* createDirectory(int numEntries, struct DirectoryEntry *parent, struct VolumeControlBlock *vcb) {
+struct DirectoryEntry* createDirectory(int numEntries, struct DirectoryEntry *parent, struct VolumeControlBlock *vcb, uint8_t indexType) {
     int bytesNeeded = numEntries * sizeof(struct DirectoryEntry);
     int blocksNeeded = (bytesNeeded + (vcb->blockSize - 1)) / vcb->blockSize;
-
-    // Allocate blocks for the directory
-    int dirLocation = allocateBlocks(blocksNeeded, *vcb); // Assuming you have an allocateBlocks function
-    if (dirLocation == -1) {
-        perror("Error allocating blocks for directory");
-        return NULL; // Failed to allocate blocks
-    }
+    uint16_t indexBlocks = dirIndexBlocks(numEntries, indexType);
 
     // Allocate memory for the directory entries
-    struct DirectoryEntry *newDir = malloc(blocksNeeded * vcb->blockSize);
+    struct DirectoryEntry *newDir = malloc((blocksNeeded + indexBlocks) * vcb->blockSize);
     if (newDir == NULL) {
         perror("Error allocating memory for directory");
         return NULL; // Failed to allocate memory
@@ -270,12 +1075,23 @@ struct DirectoryEntry* createDirectory(int numEntries, struct DirectoryEntry *pa
 
     // Set up "." entry
     strcpy(newDir[0].filename, ".");
-    newDir[0].firstBlockIndex = dirLocation;
     newDir[0].fileType = 1; // Directory type
     newDir[0].fileSize = numEntries * sizeof(struct DirectoryEntry);
     newDir[0].creationTime = time(NULL);
+    newDir[0].indexBlocks = indexBlocks;
+    newDir[0].heapBlocks = dirCompact() ? 1 : 0;
+    newDir[0].indexType = indexType;
     // ... set other metadata for "." ...
 
+    // Allocate blocks for the directory as it is laid out on disk
+    int dirLocation = allocateBlocks(dirDiskBlocks(newDir), vcb); // Assuming you have an allocateBlocks function
+    if (dirLocation == -1) {
+        perror("Error allocating blocks for directory");
+        free(newDir);
+        return NULL; // Failed to allocate blocks
+    }
+    newDir[0].firstBlockIndex = dirLocation;
+
     // Set up ".." entry
     if (parent != NULL) {
         strcpy(newDir[1].filename, "..");
@@ -294,8 +1110,13 @@ struct DirectoryEntry* createDirectory(int numEntries, struct DirectoryEntry *pa
         // ... set other metadata for ".." ...
     }
 
+    newDir[0].inUse = 1;
+    newDir[1].inUse = 1;
+    dirIndexBuild(newDir);
+    bloomBuild(newDir); // Replaces any filter left from a directory that was here
+
     // Write the directory to disk
-    LBAwrite(newDir, blocksNeeded, dirLocation);
+    writeDir(newDir);
 
     return newDir; 
 }
@@ -305,17 +1126,22 @@ struct DirectoryEntry* createDirectory(int numEntries, struct DirectoryEntry *pa
 
 
 // Directory Operations
-int fs_mkdir(const char *pathname, mode_t mode) {
+static int doMkdir(const char *pathname, mode_t mode) {
     printf("Entering fs_mkdir with pathname: %s\n", pathname); // Debug
 
     // 1. Parse the path to get the parent directory
     struct DirectoryEntry *parent = NULL;
     int index;
     char *lastElementName;
-    int result = parsePath((char *)pathname, &parent, &index, &lastElementName);
+    char *pathCopy = strdup(pathname); // parsePath tokenizes in place
+    int result = parsePath(pathCopy, &parent, &index, &lastElementName);
 
     printf("parsePath result: %d\n", result); // Debug
     if (result != -2) {  
+        if (result == 0) {
+            freeDir(parent);
+        }
+        free(pathCopy);
         printf("Exiting fs_mkdir: Path not found or invalid\n"); // Debug
         return -1; 
     }
@@ -334,9 +1160,11 @@ int fs_mkdir(const char *pathname, mode_t mode) {
         printf("  Parent directory is NULL\n"); // Debug
     }
 
-    struct DirectoryEntry* newDir = createDirectory(51, parent, vcb); 
+    uint8_t indexType = (mode & FS_DIR_ORDERED) ? DIR_INDEX_BTREE : DIR_INDEX_HASH;
+    struct DirectoryEntry* newDir = createDirectory(DIR_INITIAL_ENTRIES, parent, vcb, indexType); 
     if (newDir == NULL) {                                             
         freeDir(parent);
+        free(pathCopy);
         printf("Exiting fs_mkdir: Failed to create directory\n"); 
         return -1; 
     }
@@ -346,38 +1174,23 @@ int fs_mkdir(const char *pathname, mode_t mode) {
 
     // 4. Update the parent directory with the new entry
     if (parent != NULL) { 
-        int freeEntryIndex = -1;
-        int numEntries = parent[0].fileSize / sizeof(struct DirectoryEntry);
-        for (int i = 0; i < numEntries; i++) {
-            if (!parent[i].inUse) {
-                freeEntryIndex = i;
-                break;
-            }
-        }
-
-        if (freeEntryIndex == -1) {
-            free(newDir); // Free newDir if no free entry is found
-            freeDir(parent);
-            printf("Exiting fs_mkdir: No free entries in parent directory\n"); 
-            return -1;
-        }
-
         printf("Updating parent directory...\n"); 
-        strcpy(parent[freeEntryIndex].filename, lastElementName);
-        parent[freeEntryIndex].fileSize = 0; 
-        parent[freeEntryIndex].firstBlockIndex = newDirLocation;
-        parent[freeEntryIndex].creationTime = time(NULL);
-        parent[freeEntryIndex].lastModifiedTime = parent[freeEntryIndex].creationTime;
-        parent[freeEntryIndex].fileType = 1; 
-        parent[freeEntryIndex].inUse = 1;
-
-        int blocksNeeded = (parent[0].fileSize + vcb->blockSize - 1) / vcb->blockSize;
-        if (LBAwrite(parent, blocksNeeded, parent[0].firstBlockIndex) != blocksNeeded) {
-            free(newDir); // Free newDir if LBAwrite fails
+        struct DirectoryEntry entry = {0};
+        entry.fileSize = newDir[0].fileSize;  // Children load the directory by this size
+        entry.firstBlockIndex = newDirLocation;
+        entry.creationTime = time(NULL);
+        entry.lastModifiedTime = entry.creationTime;
+        entry.fileType = 1; 
+
+        if (addDirEntry(&parent, lastElementName, &entry) == -1) {
+            releaseChain(newDirLocation); // Nothing refers to its blocks
+            free(newDir); // Free newDir if the parent could not take the entry
             freeDir(parent);
-            printf("Exiting fs_mkdir: Failed to write directory\n"); 
-            return -1; 
+            free(pathCopy);
+            printf("Exiting fs_mkdir: Failed to update parent directory\n"); 
+            return -1;
         }
+        writeFAT();
         printf("Success! Directory created!\n"); 
 
     } else {
@@ -386,12 +1199,80 @@ int fs_mkdir(const char *pathname, mode_t mode) {
 
     free(newDir); // Free newDir after updating the parent
     freeDir(parent);
+    free(pathCopy);
     return 0;
 }
 
-int fs_rmdir(const char *pathname) {
-    // TODO: Implement directory removal
-    return 0;
+// Takes the entry at path out of its parent directory and returns it in
+// removed.  The caller releases its blocks.  ".", "..", the root, the
+// current directory and files open in b_io are refused.
+int unlinkEntry(const char *path, struct DirectoryEntry *removed) {
+    struct DirectoryEntry *parent;
+    int index;
+    char *lastElementName;
+    char *pathCopy = strdup(path);
+    int result = parsePath(pathCopy, &parent, &index, &lastElementName);
+    if (result != 0 || lastElementName == NULL || index < 2) {
+        if (result != -1) {
+            freeDir(parent);
+        }
+        free(pathCopy);
+        return -1;
+    }
+
+    struct DirectoryEntry entry = parent[index];
+    if ((entry.fileType == 1 && entry.firstBlockIndex == loadedCWD[0].firstBlockIndex) ||
+            (entry.fileType != 1 && b_isOpen(parent[0].firstBlockIndex, index))) {
+        printf("Error: %s is in use\n", path);
+        freeDir(parent);
+        free(pathCopy);
+        return -1;
+    }
+
+    result = removeDirEntry(&parent, index);
+    freeDir(parent);
+    free(pathCopy);
+    if (result == 0) {
+        *removed = entry;
+    }
+    return result;
+}
+
+// Drops every cached name of a directory that is being freed, since its
+// blocks may soon hold another one
+void forgetDir(uint64_t dirBlock) {
+    dcacheInvalidateDir(dirBlock);
+    pathCacheBump(dirBlock);
+}
+
+// Removes an empty directory
+static int doRmdir(const char *pathname) {
+    struct DirectoryEntry entry;
+    if (!pathLookup(pathname, &entry) || entry.fileType != 1) {
+        return -1;
+    }
+
+    struct dirReader *reader = dirReaderOpen(entry.firstBlockIndex);
+    if (reader == NULL) {
+        return -1;
+    }
+    int empty = 1;
+    struct DirectoryEntry child;
+    for (uint64_t i = 2; i < dirReaderCount(reader) && empty; i++) {
+        empty = (dirReaderEntry(reader, i, &child) == 0);
+    }
+    dirReaderClose(reader);
+    if (!empty) {
+        printf("Error: Directory %s is not empty\n", pathname);
+        return -1;
+    }
+
+    if (unlinkEntry(pathname, &entry) != 0) {
+        return -1;
+    }
+    forgetDir(entry.firstBlockIndex);
+    releaseChain(entry.firstBlockIndex);
+    return writeFAT();
 }
 
 fdDir * fs_opendir(const char *pathname) {
@@ -399,11 +1280,17 @@ fdDir * fs_opendir(const char *pathname) {
     struct DirectoryEntry *parent;
     int index;
     char *lastElementName;
-    int result = parsePath((char *)pathname, &parent, &index, &lastElementName);
+    char *pathCopy = strdup(pathname); // parsePath tokenizes in place
+    int result = parsePath(pathCopy, &parent, &index, &lastElementName);
+    free(pathCopy);
 
     if (result == -1) {
         return NULL; // Path not found
     }
+    if (result == -2) {
+        freeDir(parent);
+        return NULL; // Last element not found
+    }
 
     // 2. Check if it's a directory
     if (parent[index].fileType != 1) {
@@ -428,50 +1315,113 @@ fdDir * fs_opendir(const char *pathname) {
         return NULL; // Memory allocation error
     }
 
-    // Load the directory contents into memory (using parent)
-    dirp->directory = loadDir(&parent[index]); 
-    if (dirp->directory  == NULL) {
+    // Unordered directories are listed a block at a time.  Ordered ones are
+    // loaded, since they are listed by walking the B+tree leaves.
+    dirp->directory = NULL;
+    dirp->reader = dirReaderOpen(parent[index].firstBlockIndex);
+    if (dirp->reader == NULL) {
         free(dirp->di);
         free(dirp);
         freeDir(parent);
-        return NULL; // Failed to load directory contents
+        return NULL; // Failed to read the directory
+    }
+    if (dirReaderIndexType(dirp->reader) == DIR_INDEX_BTREE) {
+        dirReaderClose(dirp->reader);
+        dirp->reader = NULL;
+        dirp->directory = loadDir(&parent[index]);
+        if (dirp->directory == NULL) {
+            free(dirp->di);
+            free(dirp);
+            freeDir(parent);
+            return NULL; // Failed to load directory contents
+        }
+        dirTreeSeek(dirp->directory, NULL, &dirp->orderedLeaf, &dirp->dirEntryPosition);
     }
 
     freeDir(parent);
     return dirp;
 }
 
+// Copies the next entry to list to entry.  Returns 0, or -1 at the end of
+// the directory.
+static int nextDirEntry(fdDir *dirp, struct DirectoryEntry *entry) {
+    if (dirp->reader != NULL) {
+        uint64_t numEntries = dirReaderCount(dirp->reader);
+        while (dirp->dirEntryPosition < numEntries) {
+            int used = dirReaderEntry(dirp->reader, dirp->dirEntryPosition++, entry);
+            if (used < 0) {
+                return -1;
+            }
+            if (used) {
+                return 0;
+            }
+        }
+        return -1;
+    }
+
+    int slot = dirTreeNext(dirp->directory, &dirp->orderedLeaf, &dirp->dirEntryPosition);
+    if (slot < 0) {
+        return -1;
+    }
+    *entry = dirp->directory[slot];
+    return 0;
+}
+
 struct fs_diriteminfo *fs_readdir(fdDir *dirp) {
     if (dirp == NULL || dirp->di == NULL) {
         return NULL; // Invalid input
     }
 
-    // Access directory contents directly from dirp
-    struct DirectoryEntry *dirContents = dirp->directory; 
-    if (dirContents == NULL) {
+    if (dirp->directory == NULL && dirp->reader == NULL) {
         return NULL; // Directory not open
     }
 
-    int numEntries = dirContents[0].fileSize / sizeof(struct DirectoryEntry);
-
     // Find the next valid entry
-    while (dirp->dirEntryPosition < numEntries && !dirContents[dirp->dirEntryPosition].inUse) {
-        dirp->dirEntryPosition++;
-    }
-
-    if (dirp->dirEntryPosition >= numEntries) {
+    struct DirectoryEntry entry;
+    if (nextDirEntry(dirp, &entry) != 0) {
         return NULL; // End of directory
     }
 
     // Populate dirp->di with the directory entry information
     dirp->di->d_reclen = sizeof(struct fs_diriteminfo);
-    dirp->di->fileType = dirContents[dirp->dirEntryPosition].fileType;
-    strcpy(dirp->di->d_name, dirContents[dirp->dirEntryPosition].filename);
-
-    dirp->dirEntryPosition++;
+    dirp->di->fileType = entry.fileType;
+    strcpy(dirp->di->d_name, entry.filename);
     return dirp->di;
 }
 
+// Batched fs_readdir that also returns each entry's size and times, so
+// listings need no per-entry path lookups
+int fs_readdirplus(fdDir *dirp, struct fs_direntplus *entries, int max) {
+    if (dirp == NULL || (dirp->directory == NULL && dirp->reader == NULL) || entries == NULL) {
+        return -1; // Invalid input
+    }
+
+    int count = 0;
+    struct DirectoryEntry entry;
+    while (count < max && nextDirEntry(dirp, &entry) == 0) {
+        entries[count].fileType = entry.fileType;
+        strcpy(entries[count].d_name, entry.filename);
+        entries[count].st_size = entry.fileSize;
+        entries[count].st_modtime = entry.lastModifiedTime;
+        entries[count].st_createtime = entry.creationTime;
+        count++;
+    }
+    return count;
+}
+
+// Moves the listing of an ordered directory to the first name not below
+// name, for prefix and range scans.  Returns -1 for unordered directories.
+int fs_seekdir(fdDir *dirp, const char *name) {
+    if (dirp == NULL || dirp->directory == NULL || name == NULL) {
+        return -1; // Invalid input
+    }
+    if (dirp->directory[0].indexType != DIR_INDEX_BTREE) {
+        return -1; // Slot order means nothing to seek by
+    }
+    dirTreeSeek(dirp->directory, name, &dirp->orderedLeaf, &dirp->dirEntryPosition);
+    return 0;
+}
+
 int fs_closedir(fdDir *dirp) {
     if (dirp == NULL) {
         return 0; // Nothing to do
@@ -484,6 +1434,7 @@ int fs_closedir(fdDir *dirp) {
     if (dirp->directory != NULL) {
         free(dirp->directory);
     }
+    dirReaderClose(dirp->reader);
 
     free(dirp);
     return 0;
@@ -508,11 +1459,16 @@ int fs_setcwd(char *pathname) {
     struct DirectoryEntry *parent;
     int index;
     char *lastElementName;
-    int result = parsePath(pathname, &parent, &index, &lastElementName);
+    char *pathCopy = strdup(pathname); // pathname is needed intact below
+    int result = parsePath(pathCopy, &parent, &index, &lastElementName);
+    free(pathCopy);
 
-    if (result == -1 || index == -1) {
-        freeDir(parent); // Free parent if parsePath fails
-        return -1; // Path not found or invalid
+    if (result == -1) {
+        return -1; // Path not found or invalid, parent already freed
+    }
+    if (index == -1) {
+        freeDir(parent);
+        return -1; // Last element not found
     }
 
     // 2. Check if the last element is a directory
@@ -556,46 +1512,349 @@ int fs_setcwd(char *pathname) {
 }
 // File Operations
 int fs_isFile(char * filename) {
-    // 1. Parse the path
-    struct DirectoryEntry *parent;
-    int index;
-    char *lastElementName;
-    int result = parsePath(filename, &parent, &index, &lastElementName);
+    struct DirectoryEntry entry;
+    return pathLookup(filename, &entry) && entry.fileType == 0;
+}
 
-    if (result == -1) {
-        return 0; // Path not found
+int fs_isDir(char * pathname) {
+    struct DirectoryEntry entry;
+    return pathLookup(pathname, &entry) && entry.fileType == 1;
+}
+
+static int doDelete(char* filename) {
+    struct DirectoryEntry entry;
+    if (!pathLookup(filename, &entry) || entry.fileType != 0) {
+        return -1;
+    }
+    if (unlinkEntry(filename, &entry) != 0) {
+        return -1;
     }
 
-    // 2. Check if it's a file
-    int isFile = (parent[index].fileType == 0);
-    freeDir(parent);
-    return isFile;
+    // Inline files have no blocks; shared blocks only lose a reference
+    releaseChain(entry.firstBlockIndex);
+    if (writeFAT() != 0) {
+        return -1;
+    }
+    return writeRefcounts();
 }
 
-int fs_isDir(char * pathname) {
-    // 1. Parse the path
+// File Stats
+int fs_stat(const char *path, struct fs_stat *buf) {
+    struct DirectoryEntry entry;
+    if (!pathLookup(path, &entry)) {
+        return -1; // Path not found
+    }
+
+    uint64_t blocks = 0;
+    for (uint64_t block = entry.firstBlockIndex; block != 0 && block != FAT_EOF;
+            block = fat[block].nextBlock) {
+        blocks++;
+    }
+
+    buf->st_size = entry.fileSize;
+    buf->st_blksize = vcb->blockSize;
+    buf->st_blocks = blocks * vcb->blockSize / 512;
+    buf->st_accesstime = entry.lastModifiedTime; // Access times are not kept
+    buf->st_modtime = entry.lastModifiedTime;
+    buf->st_createtime = entry.creationTime;
+    return 0;
+}
+
+// Blocks of the share count table the blocks of a chain have counts in
+static uint64_t chainRefBlocks(uint64_t firstBlock) {
+    uint64_t blocks = 0;
+    uint64_t lastBlock = UINT64_MAX;
+    for (uint64_t block = firstBlock; block != 0 && block != FAT_EOF; block = fat[block].nextBlock) {
+        if (block * sizeof(uint16_t) / vcb->blockSize != lastBlock) {
+            lastBlock = block * sizeof(uint16_t) / vcb->blockSize;
+            blocks++;
+        }
+    }
+    return blocks;
+}
+
+// Reflink copy: the new file shares every data block with the source and
+// each block's share count goes up by one.  Blocks are only copied later,
+// by cowBlock, when either file writes to them.
+static int doClone(const char *srcPath, const char *destPath) {
+    // 1. Find the source file
     struct DirectoryEntry *parent;
     int index;
     char *lastElementName;
-    int result = parsePath(pathname, &parent, &index, &lastElementName);
+    char *pathCopy = strdup(srcPath);
+    int result = parsePath(pathCopy, &parent, &index, &lastElementName);
+    if (result == -1) {
+        free(pathCopy);
+        return -1; // Path not found
+    }
+    if (result != 0 || lastElementName == NULL || parent[index].fileType != 0) {
+        freeDir(parent);
+        free(pathCopy);
+        return -1; // Source missing or not a file
+    }
+    // An open file may have data not yet in its entry or its blocks, which
+    // the clone would miss
+    if (b_slotOpen(parent[0].firstBlockIndex, index)) {
+        printf("Error: %s is in use\n", srcPath);
+        freeDir(parent);
+        free(pathCopy);
+        return -1;
+    }
+    struct DirectoryEntry source = parent[index];
+    freeDir(parent);
+    free(pathCopy);
+
+    // 2. Make sure no block is already at its maximum share count, and
+    // that the journal has room for the counts if the file grew since
+    for (uint64_t block = source.firstBlockIndex; block != 0 && block != FAT_EOF;
+            block = fat[block].nextBlock) {
+        if (blockRefs[block] == UINT16_MAX) {
+            printf("Error: Block %lu has too many clones\n", block);
+            return -1;
+        }
+    }
+    if (journalReserve(chainRefBlocks(source.firstBlockIndex) + DIR_ENTRY_JOURNAL_BLOCKS) != 0) {
+        return -1;
+    }
 
+    // 3. The destination must not exist yet
+    pathCopy = strdup(destPath);
+    result = parsePath(pathCopy, &parent, &index, &lastElementName);
     if (result == -1) {
-        return 0; // Path not found
+        free(pathCopy);
+        return -1;
+    }
+    if (result != -2) {
+        freeDir(parent);
+        free(pathCopy);
+        return -1; // Destination already exists
+    }
+
+    // 4. Share the blocks and add the new entry
+    for (uint64_t block = source.firstBlockIndex; block != 0 && block != FAT_EOF;
+            block = fat[block].nextBlock) {
+        blockRefs[block]++;
+        markRefs(block, 1);
+    }
+
+    struct DirectoryEntry entry = source;
+    entry.creationTime = time(NULL);
+    entry.lastModifiedTime = entry.creationTime;
+    if (addDirEntry(&parent, lastElementName, &entry) == -1) {
+        for (uint64_t block = source.firstBlockIndex; block != 0 && block != FAT_EOF;
+                block = fat[block].nextBlock) {
+            blockRefs[block]--;
+            markRefs(block, 1);
+        }
+        freeDir(parent);
+        free(pathCopy);
+        return -1;
     }
 
-    // 2. Check if it's a directory
-    int isDir = (parent[index].fileType == 1);
     freeDir(parent);
-    return isDir;
+    free(pathCopy);
+    return writeRefcounts();
 }
 
-int fs_delete(char* filename) {
-    // TODO: Implement file deletion
+// Gives entry a new name.  Inline data stays where it is, at the end of
+// the field, so the new name must leave room for it.
+static int renameEntry(struct DirectoryEntry *entry, const char *name) {
+    if (strlen(name) >= MAX_FILENAME_LENGTH ||
+            (entry->inlineData && entry->fileSize > dirInlineRoom(name))) {
+        printf("Error: Name too long: %s\n", name);
+        return -1;
+    }
+    uint64_t keep = entry->inlineData ? entry->fileSize : 0;
+    memset(entry->filename, 0, MAX_FILENAME_LENGTH - keep);
+    strcpy(entry->filename, name);
     return 0;
 }
 
-// File Stats
-int fs_stat(const char *path, struct fs_stat *buf) {
-    // TODO: Implement file stats
-    return 0;
-}
\ No newline at end of file
+// Puts entry, already renamed, in place of slot oldIndex of *oldParentp:
+// into slot newIndex of *newParentp when it replaces a file there, or a
+// new slot when newIndex is -1.  Either directory may move in memory.
+static int moveEntry(struct DirectoryEntry **oldParentp, int oldIndex,
+        struct DirectoryEntry **newParentp, int newIndex, struct DirectoryEntry *entry) {
+    uint64_t oldBlock = (*oldParentp)[0].firstBlockIndex;
+    uint64_t newBlock = (*newParentp)[0].firstBlockIndex;
+
+    if (newBlock == oldBlock) {
+        struct DirectoryEntry *dir = *oldParentp;
+        dirTrack(dir);
+        if (newIndex >= 0) {
+            dirIndexRemove(dir, newIndex);
+            memset(&dir[newIndex], 0, sizeof(struct DirectoryEntry));
+            dirMarkSlot(dir, newIndex);
+            bloomRemove(oldBlock);
+        }
+        dirIndexRemove(dir, oldIndex);
+        dir[oldIndex] = *entry;
+        dirMarkSlot(dir, oldIndex);
+        dirIndexInsert(dir, oldIndex);
+        bloomAdd(oldBlock, entry->filename);
+        bloomRemove(oldBlock);
+        return writeDirChanges(dir);
+    }
+
+    int result;
+    if (newIndex >= 0) {
+        (*newParentp)[newIndex] = *entry; // Same name, so the index is unchanged
+        result = writeDirSlot(*newParentp, newIndex);
+    } else {
+        result = (addDirEntry(newParentp, entry->filename, entry) == -1) ? -1 : 0;
+    }
+
+    // A directory's ".." now leads to its new parent
+    if (result == 0 && entry->fileType == 1) {
+        struct dirReader *reader = dirReaderOpen(entry->firstBlockIndex);
+        struct DirectoryEntry dotDot;
+        result = (reader != NULL && dirReaderEntry(reader, 1, &dotDot) == 1) ? 0 : -1;
+        dirReaderClose(reader);
+        if (result == 0) {
+            dotDot.firstBlockIndex = newBlock;
+            dotDot.fileSize = (*newParentp)[0].fileSize;
+            result = updateDirEntry(entry->firstBlockIndex, entry->fileSize, 1, &dotDot);
+        }
+    }
+    if (result == 0) {
+        result = removeDirEntry(oldParentp, oldIndex);
+    }
+    return result;
+}
+
+// Moves the entry at oldPath to newPath without touching its data blocks.
+// A file already at newPath is replaced.  Within one directory this is a
+// single directory write.  Across directories the entry reaches its new
+// parent before it leaves the old one; the journal commits both together.
+static int doRename(const char *oldPath, const char *newPath) {
+    // 1. Find the entry to move
+    struct DirectoryEntry *oldParent;
+    int oldIndex;
+    char *oldName;
+    char *oldCopy = strdup(oldPath);
+    int result = parsePath(oldCopy, &oldParent, &oldIndex, &oldName);
+    if (result != 0 || oldName == NULL || oldIndex < 2) {
+        if (result != -1) {
+            freeDir(oldParent);
+        }
+        free(oldCopy);
+        return -1;
+    }
+    struct DirectoryEntry entry = oldParent[oldIndex];
+    uint64_t oldBlock = oldParent[0].firstBlockIndex;
+    if ((entry.fileType == 1 && dirIsWithin(loadedCWD[0].firstBlockIndex, entry.firstBlockIndex)) ||
+            (entry.fileType != 1 && b_isOpen(oldBlock, oldIndex))) {
+        printf("Error: %s is in use\n", oldPath);
+        freeDir(oldParent);
+        free(oldCopy);
+        return -1;
+    }
+
+    // 2. Find where it goes
+    struct DirectoryEntry *newParent;
+    int newIndex;
+    char *newName;
+    char *newCopy = strdup(newPath);
+    result = parsePath(newCopy, &newParent, &newIndex, &newName);
+    if (result == -1 || newName == NULL) {
+        if (result != -1) {
+            freeDir(newParent);
+        }
+        freeDir(oldParent);
+        free(oldCopy);
+        free(newCopy);
+        return -1;
+    }
+    uint64_t newBlock = newParent[0].firstBlockIndex;
+    int exists = (result == 0);
+
+    // 3. Move it.  Only a file can replace another file.
+    struct DirectoryEntry replaced = {0};
+    result = 0;
+    if (exists && newBlock == oldBlock && newIndex == oldIndex) {
+        // Already there
+    } else if (exists && (newIndex < 2 || entry.fileType == 1 ||
+            newParent[newIndex].fileType == 1 || b_isOpen(newBlock, newIndex))) {
+        printf("Error: %s already exists\n", newPath);
+        result = -1;
+    } else if (entry.fileType == 1 && dirIsWithin(newBlock, entry.firstBlockIndex)) {
+        printf("Error: Cannot move %s into itself\n", oldPath);
+        result = -1;
+    } else if (renameEntry(&entry, newName) != 0) {
+        result = -1;
+    } else if (newBlock != oldBlock &&
+            journalReserve(dirDiskBlocks(oldParent) + addJournalBlocks(newParent)) != 0) {
+        // Either directory may be rewritten whole, and the entry must not
+        // reach the new one unless it can also leave the old one
+        result = -1;
+    } else {
+        if (exists) {
+            replaced = newParent[newIndex];
+        }
+        result = moveEntry(&oldParent, oldIndex, &newParent, exists ? newIndex : -1, &entry);
+    }
+
+    // The replaced file's blocks go once nothing refers to them
+    if (result == 0 && replaced.inUse) {
+        releaseChain(replaced.firstBlockIndex);
+        if (writeFAT() != 0 || writeRefcounts() != 0) {
+            result = -1;
+        }
+    }
+
+    if (newParent != oldParent) {
+        freeDir(newParent);
+    }
+    freeDir(oldParent);
+    free(oldCopy);
+    free(newCopy);
+    return result;
+}
+
+
+// Each operation's metadata writes are one journal transaction
+static int journaled(int result) {
+    if (journalEnd() != 0) {
+        return -1;
+    }
+    return result;
+}
+
+int fs_mkdir(const char *pathname, mode_t mode) {
+    journalBegin();
+    return journaled(doMkdir(pathname, mode));
+}
+
+int fs_rmdir(const char *pathname) {
+    journalBegin();
+    return journaled(doRmdir(pathname));
+}
+
+int fs_delete(char* filename) {
+    journalBegin();
+    return journaled(doDelete(filename));
+}
+
+// The clone holds b_ioLock throughout, so no file it looks at is opened
+// or written meanwhile.  Every share count of the source changes, so the
+// operation reserves their blocks besides those of the new entry.
+int fs_clone(const char *srcPath, const char *destPath) {
+    struct DirectoryEntry source;
+    pthread_mutex_lock(&b_ioLock);
+    uint64_t refBlocks = (pathLookup(srcPath, &source) == 1) ? chainRefBlocks(source.firstBlockIndex) : 0;
+    pthread_mutex_unlock(&b_ioLock);
+
+    // Outside b_ioLock, since it may wait for a commit
+    if (journalBeginSized(refBlocks + DIR_ENTRY_JOURNAL_BLOCKS) != 0) {
+        return journaled(-1);
+    }
+    pthread_mutex_lock(&b_ioLock);
+    int result = doClone(srcPath, destPath);
+    pthread_mutex_unlock(&b_ioLock);
+    return journaled(result);
+}
+
+int fs_rename(const char *oldPath, const char *newPath) {
+    journalBegin();
+    return journaled(doRename(oldPath, newPath));
+}
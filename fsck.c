@@ -0,0 +1,605 @@
+/**************************************************************
+* Class::  CSC-415-0# Spring 2024
+* Name::
+* Student IDs::
+* GitHub-Name::
+* Group-Name::
+* Project:: Basic File System
+*
+* File:: fsck.c
+*
+* Description:: Offline consistency checker for a volume file.
+*   Pass 1 checks the VCB and every FAT entry, pass 2 walks the
+*   directory tree and follows each entry's chain, counting the
+*   chains through every block, and pass 3 compares those counts
+*   with the FAT and the share counts to find cross-linked,
+*   leaked and orphaned blocks.  Passes 1 and 3 split the FAT
+*   between threads; in pass 2 the threads take directories from
+*   a shared queue and follow chains in memory, reading the disk
+*   one directory at a time under b_ioLock.  With -r, the
+*   journal is replayed first and what can be fixed is written
+*   back.  Leaked blocks are only freed, and share counts only
+*   lowered, when every directory could be read.
+*
+*   Usage: fsck volumeFile [-r] [-t threads]
+*   Exit status is 0 when clean, 1 when every error was fixed, 4
+*   when errors remain and 8 when the volume could not be read.
+*
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include "mfs.h"
+#include "vcb.h"
+#include "fsLow.h"
+
+#define FSCK_MAX_THREADS 64
+#define FSCK_CLEAN 0
+#define FSCK_FIXED 1
+#define FSCK_ERRORS 4
+#define FSCK_FAILED 8
+
+extern struct VolumeControlBlock* vcb;
+extern struct FATEntry* fat;
+extern uint16_t *blockRefs;
+extern pthread_mutex_t b_ioLock;
+
+int loadFAT(uint64_t blockSize);
+int loadRefcounts(uint64_t blockSize);
+int journalRecover();
+void journalClose();
+uint64_t dirDiskBlocksFromFirst(void *firstBlock);
+struct dirReader *dirReaderOpen(uint64_t firstBlock);
+void dirReaderClose(struct dirReader *reader);
+uint64_t dirReaderCount(struct dirReader *reader);
+int dirReaderEntry(struct dirReader *reader, uint64_t slot, struct DirectoryEntry *entry);
+int dirReaderUpdate(struct dirReader *reader, uint64_t slot, struct DirectoryEntry *entry);
+
+// Problems found, each counted once; fixed ones are also counted in fixed
+struct findings {
+    uint64_t badPointers;       // FAT entries pointing outside the data area
+    uint64_t brokenChains;      // Chains running into a free or invalid block
+    uint64_t shortChains;
+    uint64_t longChains;
+    uint64_t crossLinked;       // Blocks in more chains than their share count allows
+    uint64_t leaked;            // Allocated blocks no chain reaches
+    uint64_t orphanChains;      // Leaked chains, counted by their first block
+    uint64_t badShares;         // Share counts that disagree with the chains
+    uint64_t badDots;           // "." or ".." not pointing where it should
+    uint64_t dirLinks;          // Directories reached more than once
+    uint64_t badEntries;        // Entries that cannot be read or followed
+    uint64_t badFreeCount;
+    uint64_t fixed;
+    uint64_t files;
+    uint64_t dirs;
+};
+
+static struct findings found;
+static int repair = 0;
+static int treeRead;            // Pass 2 reached every entry, so counts of 0 are real
+static int nthreads;
+static uint32_t *seen;          // Chains found through each block
+static uint64_t *hasPred;       // Bit per block: some FAT entry points to it
+static uint64_t *dirClaimed;    // Bit per block: a directory starting here was checked
+
+#define COUNT(field) __atomic_fetch_add(&found.field, 1, __ATOMIC_RELAXED)
+
+static double elapsedSeconds(struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static int validBlock(uint64_t block) {
+    return block >= vcb->dataStart && block < vcb->totalBlocks;
+}
+
+// Runs pass over the data area split between the threads, returning the
+// free blocks the pass counted
+struct range {
+    uint64_t lo;
+    uint64_t hi;
+    uint64_t freeBlocks;
+};
+
+static uint64_t runSplit(void *(*pass)(void *)) {
+    pthread_t threads[FSCK_MAX_THREADS];
+    struct range ranges[FSCK_MAX_THREADS];
+    uint64_t span = vcb->totalBlocks - vcb->dataStart;
+    uint64_t total = 0;
+    for (int i = 0; i < nthreads; i++) {
+        ranges[i].lo = vcb->dataStart + span * i / nthreads;
+        ranges[i].hi = vcb->dataStart + span * (i + 1) / nthreads;
+        ranges[i].freeBlocks = 0;
+        pthread_create(&threads[i], NULL, pass, &ranges[i]);
+    }
+    for (int i = 0; i < nthreads; i++) {
+        pthread_join(threads[i], NULL);
+        total += ranges[i].freeBlocks;
+    }
+    return total;
+}
+
+//================ PASS 1: VCB AND FAT ================
+
+static int checkVCB(uint64_t volumeBlocks, uint64_t blockSize) {
+    const char *problem = NULL;
+    uint64_t refBlocks = (vcb->fatEntryCount * sizeof(uint16_t) + blockSize - 1) / blockSize;
+    if (vcb->signature != FS_SIGNATURE) {
+        problem = "bad signature";
+    } else if (vcb->blockSize != blockSize) {
+        problem = "block size differs from the partition's";
+    } else if (vcb->totalBlocks == 0 || vcb->totalBlocks > volumeBlocks) {
+        problem = "more blocks than the partition holds";
+    } else if (vcb->fatStart < 2 || vcb->dataStart >= vcb->totalBlocks ||
+            (vcb->fatStart < vcb->dataStart && vcb->fatStart + vcb->fatBlocks > vcb->dataStart) ||
+            vcb->fatStart + vcb->fatBlocks > vcb->totalBlocks) {
+        problem = "FAT and data area overlap or lie outside the volume";
+    } else if (vcb->fatEntryCount < vcb->totalBlocks ||
+            vcb->fatBlocks * blockSize < vcb->fatEntryCount * sizeof(struct FATEntry)) {
+        problem = "FAT too small for the volume";
+    } else if (!validBlock(vcb->rootDirectory)) {
+        problem = "root directory outside the data area";
+    } else if (vcb->metadataLocation != 0 && (!validBlock(vcb->metadataLocation) ||
+            vcb->metadataLocation + refBlocks > vcb->totalBlocks)) {
+        problem = "share counts outside the data area";
+    } else if (vcb->journalStart != 0 && (!validBlock(vcb->journalStart) ||
+            vcb->journalStart + vcb->journalBlocks > vcb->totalBlocks)) {
+        problem = "journal outside the data area";
+    } else if (vcb->allocSummaryStart != 0 && !validBlock(vcb->allocSummaryStart)) {
+        problem = "free space summaries outside the data area";
+    } else if (vcb->fsVersion != FS_VERSION_WIDE_DIRS && vcb->fsVersion != FS_VERSION_COMPACT_DIRS) {
+        problem = "unknown directory format";
+    }
+    if (problem != NULL) {
+        printf("VCB: %s, cannot check this volume\n", problem);
+        return -1;
+    }
+    return 0;
+}
+
+// Checks that every entry is free, the end of a chain or a block of the
+// data area, and notes which blocks have a predecessor
+static void *checkFAT(void *arg) {
+    struct range *range = arg;
+    for (uint64_t block = range->lo; block < range->hi; block++) {
+        uint64_t next = fat[block].nextBlock;
+        if (next == FAT_FREE) {
+            range->freeBlocks++;
+        } else if (next != FAT_EOF && !validBlock(next)) {
+            printf("Block %lu points to %lu, outside the data area\n", block, next);
+            COUNT(badPointers);
+            if (repair) {
+                fat[block].nextBlock = FAT_EOF;
+                COUNT(fixed);
+            }
+        } else if (next != FAT_EOF) {
+            __atomic_fetch_or(&hasPred[next / 64], 1ULL << (next % 64), __ATOMIC_RELAXED);
+        }
+    }
+    return NULL;
+}
+
+//================ PASS 2: DIRECTORY TREE ================
+
+// Follows the chain at first, counting it in every block it passes.
+// Chains of the wrong length are reported but left alone: past a
+// cross-link the blocks may belong to the other file.  Returns the number
+// of blocks counted.
+static uint64_t markChain(uint64_t first, uint64_t expected, int isDir, const char *what) {
+    uint64_t length = 0;
+    uint64_t limit = vcb->totalBlocks - vcb->dataStart; // Only a loop is longer
+    int crossed = 0;
+    for (uint64_t block = first; block != FAT_EOF; block = fat[block].nextBlock) {
+        if (!validBlock(block) || fat[block].nextBlock == FAT_FREE) {
+            // Pointers out of the data area were reported by pass 1
+            if (length == 0 || validBlock(block)) {
+                printf("%s: chain runs into %s block %lu\n", what,
+                        validBlock(block) ? "free" : "invalid", block);
+                COUNT(brokenChains);
+            }
+            break;
+        }
+        if (length == limit) {
+            printf("%s: chain loops\n", what);
+            COUNT(longChains);
+            return length;
+        }
+        uint32_t prior = __atomic_fetch_add(&seen[block], 1, __ATOMIC_RELAXED);
+        if (!crossed && (prior > blockRefs[block] || (isDir && blockRefs[block] > 0))) {
+            printf("%s: block %lu is also in another chain\n", what, block);
+            crossed = 1;
+        }
+        length++;
+    }
+    if (length < expected) {
+        printf("%s: %lu blocks, needs %lu\n", what, length, expected);
+        COUNT(shortChains);
+    } else if (length > expected) {
+        printf("%s: %lu blocks, needs only %lu\n", what, length, expected);
+        COUNT(longChains);
+    }
+    return length;
+}
+
+struct dirJob {
+    uint64_t block;
+    uint64_t parent;
+    char *path;
+    struct dirJob *next;
+};
+
+static pthread_mutex_t queueLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queueChanged = PTHREAD_COND_INITIALIZER;
+static struct dirJob *queue = NULL;
+static uint64_t outstanding = 0;    // Queued or being checked
+
+static void pushDir(uint64_t block, uint64_t parent, char *path) {
+    struct dirJob *job = malloc(sizeof(struct dirJob));
+    if (job == NULL) {
+        printf("%s: out of memory, not checked\n", path);
+        free(path);
+        return;
+    }
+    job->block = block;
+    job->parent = parent;
+    job->path = path;
+    pthread_mutex_lock(&queueLock);
+    job->next = queue;
+    queue = job;
+    outstanding++;
+    pthread_cond_signal(&queueChanged);
+    pthread_mutex_unlock(&queueLock);
+}
+
+static char *childPath(const char *parent, const char *name) {
+    char *path = malloc(strlen(parent) + strlen(name) + 2);
+    if (path != NULL) {
+        sprintf(path, "%s%s%s", parent, (parent[strlen(parent) - 1] == '/') ? "" : "/", name);
+    }
+    return path;
+}
+
+// Reads the directory's entries and checks "." and "..".  Returns the
+// entries with inUse set on the readable ones, and the blocks the
+// directory should occupy.
+static struct DirectoryEntry *readDir(struct dirJob *job, uint64_t *count, uint64_t *expected) {
+    struct DirectoryEntry *entries = NULL;
+    char *first = malloc(vcb->blockSize);
+    pthread_mutex_lock(&b_ioLock);
+    struct dirReader *reader = (first != NULL) ? dirReaderOpen(job->block) : NULL;
+    if (reader != NULL && LBAread(first, 1, job->block) == 1) {
+        *count = dirReaderCount(reader);
+        *expected = dirDiskBlocksFromFirst(first);
+        entries = calloc(*count > 2 ? *count : 2, sizeof(struct DirectoryEntry));
+    }
+    for (uint64_t slot = 0; entries != NULL && slot < *count; slot++) {
+        if (dirReaderEntry(reader, slot, &entries[slot]) < 0) {
+            printf("%s: entry %lu cannot be read\n", job->path, slot);
+            COUNT(badEntries);
+            entries[slot].inUse = 0;
+        }
+    }
+
+    if (entries != NULL) {
+        if (entries[0].firstBlockIndex != job->block) {
+            printf("%s: \".\" points to %lu, not %lu\n", job->path, entries[0].firstBlockIndex, job->block);
+            COUNT(badDots);
+        }
+        if (entries[1].firstBlockIndex != job->parent) {
+            printf("%s: \"..\" points to %lu, not %lu\n", job->path, entries[1].firstBlockIndex, job->parent);
+            COUNT(badDots);
+            if (repair && entries[1].inUse) {
+                entries[1].firstBlockIndex = job->parent;
+                if (dirReaderUpdate(reader, 1, &entries[1]) == 0) {
+                    COUNT(fixed);
+                }
+            }
+        }
+    } else {
+        printf("%s: directory cannot be read\n", job->path);
+        COUNT(badEntries);
+    }
+    dirReaderClose(reader);
+    pthread_mutex_unlock(&b_ioLock);
+    free(first);
+    return entries;
+}
+
+static void checkDir(struct dirJob *job) {
+    // The first link to reach a directory checks it; any later one is a
+    // second link to it, or a loop
+    uint64_t bit = 1ULL << (job->block % 64);
+    if (__atomic_fetch_or(&dirClaimed[job->block / 64], bit, __ATOMIC_RELAXED) & bit) {
+        printf("%s: directory is linked more than once\n", job->path);
+        COUNT(dirLinks);
+        return;
+    }
+    uint64_t count = 0;
+    uint64_t expected = 0;
+    struct DirectoryEntry *entries = readDir(job, &count, &expected);
+    if (entries == NULL) {
+        return;
+    }
+    markChain(job->block, expected, 1, job->path);
+    COUNT(dirs);
+
+    for (uint64_t slot = 2; slot < count; slot++) {
+        struct DirectoryEntry *entry = &entries[slot];
+        if (!entry->inUse) {
+            continue;
+        }
+        char *path = childPath(job->path, entry->filename);
+        if (path == NULL) {
+            continue;
+        }
+        if (entry->fileType == 1) {
+            if (!validBlock(entry->firstBlockIndex)) {
+                printf("%s: directory starts at invalid block %lu\n", path, entry->firstBlockIndex);
+                COUNT(badEntries);
+                free(path);
+            } else {
+                pushDir(entry->firstBlockIndex, job->block, path);
+            }
+            continue;
+        }
+
+        // Empty and inline files own no blocks
+        COUNT(files);
+        uint64_t expectedBlocks = entry->inlineData ? 0 :
+                (entry->fileSize + vcb->blockSize - 1) / vcb->blockSize;
+        if (entry->firstBlockIndex == 0) {
+            if (expectedBlocks > 0) {
+                printf("%s: %lu bytes but no blocks\n", path, entry->fileSize);
+                COUNT(shortChains);
+            }
+        } else {
+            markChain(entry->firstBlockIndex, expectedBlocks, 0, path);
+        }
+        free(path);
+    }
+    free(entries);
+}
+
+static void *dirWorker(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&queueLock);
+    while (1) {
+        while (queue == NULL && outstanding > 0) {
+            pthread_cond_wait(&queueChanged, &queueLock);
+        }
+        if (queue == NULL) {
+            break; // Every directory is done
+        }
+        struct dirJob *job = queue;
+        queue = job->next;
+        pthread_mutex_unlock(&queueLock);
+
+        checkDir(job);
+        free(job->path);
+        free(job);
+
+        pthread_mutex_lock(&queueLock);
+        if (--outstanding == 0) {
+            pthread_cond_broadcast(&queueChanged);
+        }
+    }
+    pthread_mutex_unlock(&queueLock);
+    return NULL;
+}
+
+static void checkTree() {
+    // Regions the file system keeps in the data area are chains as well
+    uint64_t refBlocks = (vcb->fatEntryCount * sizeof(uint16_t) + vcb->blockSize - 1) / vcb->blockSize;
+    uint64_t summaryBlocks = (vcb->allocGroups * sizeof(struct allocGroup) + vcb->blockSize - 1) / vcb->blockSize;
+    if (vcb->fatStart >= vcb->dataStart) {
+        markChain(vcb->fatStart, vcb->fatBlocks, 1, "FAT"); // Moved by a grow
+    }
+    if (vcb->metadataLocation != 0) {
+        markChain(vcb->metadataLocation, refBlocks, 1, "share counts");
+    }
+    if (vcb->journalStart != 0) {
+        markChain(vcb->journalStart, vcb->journalBlocks, 1, "journal");
+    }
+    if (vcb->allocSummaryStart != 0) {
+        markChain(vcb->allocSummaryStart, summaryBlocks, 1, "free space summaries");
+    }
+
+    pushDir(vcb->rootDirectory, vcb->rootDirectory, strdup("/"));
+    pthread_t threads[FSCK_MAX_THREADS];
+    for (int i = 0; i < nthreads; i++) {
+        pthread_create(&threads[i], NULL, dirWorker, NULL);
+    }
+    for (int i = 0; i < nthreads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+//================ PASS 3: BLOCK COUNTS ================
+
+// Compares each block's FAT entry and share count with the chains found
+// through it
+static void *checkBlocks(void *arg) {
+    struct range *range = arg;
+    for (uint64_t block = range->lo; block < range->hi; block++) {
+        int isFree = (fat[block].nextBlock == FAT_FREE);
+        uint32_t chains = seen[block];
+        if (!isFree && chains == 0) {
+            COUNT(leaked);
+            if (!(hasPred[block / 64] & (1ULL << (block % 64)))) {
+                COUNT(orphanChains);
+            }
+            // Part of the tree that could not be read may be what holds it
+            if (repair && treeRead) {
+                fat[block].nextBlock = FAT_FREE;
+                blockRefs[block] = 0;
+                isFree = 1;
+                COUNT(fixed);
+            }
+        } else if (!isFree && blockRefs[block] != chains - 1) {
+            if (chains - 1 > blockRefs[block]) {
+                COUNT(crossLinked);
+            } else {
+                COUNT(badShares);
+            }
+            // Cross-linked blocks become shared, copied on the next write.
+            // A count is only lowered if no chain was missed.
+            if (repair && chains - 1 <= UINT16_MAX && (treeRead || chains - 1 > blockRefs[block])) {
+                blockRefs[block] = chains - 1;
+                COUNT(fixed);
+            }
+        } else if (isFree && blockRefs[block] != 0) {
+            COUNT(badShares);
+            if (repair) {
+                blockRefs[block] = 0;
+                COUNT(fixed);
+            }
+        }
+        if (isFree) {
+            range->freeBlocks++;
+        }
+    }
+    return NULL;
+}
+
+//================ MAIN ================
+
+static int writeBack() {
+    uint64_t refBlocks = (vcb->fatEntryCount * sizeof(uint16_t) + vcb->blockSize - 1) / vcb->blockSize;
+    vcb->cleanUnmount = 0; // The free space summaries are rebuilt at mount
+    if (LBAwrite(fat, vcb->fatBlocks, vcb->fatStart) != vcb->fatBlocks ||
+            (vcb->metadataLocation != 0 &&
+            LBAwrite(blockRefs, refBlocks, vcb->metadataLocation) != refBlocks) ||
+            LBAwrite(vcb, 1, 1) != 1) {
+        printf("Error: Failed to write the repairs\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int loadTables(uint64_t blockSize) {
+    if (loadFAT(blockSize) != 0) {
+        return -1;
+    }
+    if (vcb->metadataLocation != 0) {
+        return loadRefcounts(blockSize);
+    }
+    // Formatted before clones, so nothing is shared
+    blockRefs = calloc(vcb->fatEntryCount, sizeof(uint16_t));
+    return (blockRefs == NULL) ? -1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+    char *filename = NULL;
+    nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-r") == 0) {
+            repair = 1;
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            nthreads = atoi(argv[++i]);
+        } else {
+            filename = argv[i];
+        }
+    }
+    if (filename == NULL) {
+        printf("Usage: fsck volumeFile [-r] [-t threads]\n");
+        return FSCK_FAILED;
+    }
+    if (nthreads < 1) {
+        nthreads = 1;
+    }
+    if (nthreads > FSCK_MAX_THREADS) {
+        nthreads = FSCK_MAX_THREADS;
+    }
+
+    // startPartitionSystem would create a missing volume
+    if (access(filename, R_OK | W_OK) != 0) {
+        printf("Cannot open %s\n", filename);
+        return FSCK_FAILED;
+    }
+    uint64_t volumeSize = 0;
+    uint64_t blockSize = 0;
+    if (startPartitionSystem(filename, &volumeSize, &blockSize) != PART_NOERROR) {
+        printf("Cannot open %s\n", filename);
+        return FSCK_FAILED;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    vcb = malloc(blockSize);
+    if (vcb == NULL || LBAread(vcb, 1, 1) != 1 || checkVCB(volumeSize / blockSize, blockSize) != 0) {
+        closePartitionSystem();
+        return FSCK_FAILED;
+    }
+    if (vcb->journalStart != 0 && !vcb->cleanUnmount) {
+        if (repair) {
+            if (journalRecover() != 0) {
+                printf("Error: Unable to replay the journal\n");
+                closePartitionSystem();
+                return FSCK_FAILED;
+            }
+            journalClose();
+        } else {
+            printf("Volume was not unmounted cleanly; its journal is replayed at mount,\n"
+                    "so the last changes may show as errors here\n");
+        }
+    }
+    if (loadTables(blockSize) != 0) {
+        closePartitionSystem();
+        return FSCK_FAILED;
+    }
+    seen = calloc(vcb->totalBlocks, sizeof(uint32_t));
+    hasPred = calloc(vcb->totalBlocks / 64 + 1, sizeof(uint64_t));
+    dirClaimed = calloc(vcb->totalBlocks / 64 + 1, sizeof(uint64_t));
+    if (seen == NULL || hasPred == NULL || dirClaimed == NULL) {
+        printf("Error: Not enough memory to check %lu blocks\n", vcb->totalBlocks);
+        closePartitionSystem();
+        return FSCK_FAILED;
+    }
+    printf("Checking %s: %lu blocks of %lu bytes, %d threads\n",
+            filename, vcb->totalBlocks, vcb->blockSize, nthreads);
+
+    runSplit(checkFAT);
+    printf("Pass 1: FAT checked (%.3fs)\n", elapsedSeconds(&start));
+    checkTree();
+    printf("Pass 2: %lu directories and %lu files checked (%.3fs)\n",
+            found.dirs, found.files, elapsedSeconds(&start));
+    treeRead = (found.badEntries == 0);
+    if (repair && !treeRead) {
+        printf("Some entries could not be read, so leaked blocks are only reported\n");
+    }
+    uint64_t freeBlocks = runSplit(checkBlocks);
+    if (freeBlocks != vcb->freeBlocks) {
+        printf("Free block count is %lu, should be %lu\n", vcb->freeBlocks, freeBlocks);
+        COUNT(badFreeCount);
+        if (repair) {
+            vcb->freeBlocks = freeBlocks;
+            COUNT(fixed);
+        }
+    }
+    printf("Pass 3: block counts checked (%.3fs)\n", elapsedSeconds(&start));
+
+    if (found.leaked > 0) {
+        printf("%lu leaked blocks in %lu orphaned chains\n", found.leaked, found.orphanChains);
+    }
+    if (found.crossLinked > 0 || found.badShares > 0) {
+        printf("%lu cross-linked blocks, %lu wrong share counts\n", found.crossLinked, found.badShares);
+    }
+    uint64_t errors = found.badPointers + found.brokenChains + found.shortChains + found.longChains +
+            found.crossLinked + found.leaked + found.badShares + found.badDots + found.dirLinks +
+            found.badEntries + found.badFreeCount;
+    if (repair && found.fixed > 0 && writeBack() != 0) {
+        found.fixed = 0;
+    }
+    closePartitionSystem();
+
+    printf("%lu errors, %lu fixed, %lu/%lu blocks free\n", errors, found.fixed, freeBlocks, vcb->totalBlocks);
+    if (errors == 0) {
+        return FSCK_CLEAN;
+    }
+    return (found.fixed >= errors) ? FSCK_FIXED : FSCK_ERRORS;
+}
@@ -36,6 +36,7 @@
 #define DOUBLE_QUOTE	0x22
 #define BUFFERLEN		200
 #define DIRMAX_LEN		4096
+#define DIRPLUS_BATCH	64
 
 /****   SET THESE TO 1 WHEN READY TO TEST THAT COMMAND ****/
 #define CMDLS_ON	1
@@ -49,6 +50,9 @@
 #define CMDPWD_ON	1
 #define CMDTOUCH_ON	1
 #define CMDCAT_ON	1
+#define CMDDEFRAG_ON	1
+#define CMDTRIM_ON	1
+#define CMDGROW_ON	1
 
 
 typedef struct dispatch_t
@@ -68,6 +72,9 @@ int cmd_touch (int argcnt, char *argvec[]);
 int cmd_cat (int argcnt, char *argvec[]);
 int cmd_cp2l (int argcnt, char *argvec[]);
 int cmd_cp2fs (int argcnt, char *argvec[]);
+int cmd_defrag (int argcnt, char *argvec[]);
+int cmd_trim (int argcnt, char *argvec[]);
+int cmd_grow (int argcnt, char *argvec[]);
 int cmd_cd (int argcnt, char *argvec[]);
 int cmd_pwd (int argcnt, char *argvec[]);
 int cmd_history (int argcnt, char *argvec[]);
@@ -83,6 +90,9 @@ dispatch_t dispatchTable[] = {
         {"cat", cmd_cat, "Limited version of cat that displace the file to the console"},
 	{"cp2l", cmd_cp2l, "Copies a file from the test file system to the linux file system"},
 	{"cp2fs", cmd_cp2fs, "Copies a file from the Linux file system to the test file system"},
+	{"defrag", cmd_defrag, "Defragments in the background - [start [blocks/sec] | stop | status]"},
+	{"trim", cmd_trim, "Gives free blocks back to the host - [every seconds | off]"},
+	{"grow", cmd_grow, "Grows the volume while mounted - volumeSize"},
 	{"cd", cmd_cd, "Changes directory"},
 	{"pwd", cmd_pwd, "Prints the working directory"},
 	{"history", cmd_history, "Prints out the history"},
@@ -91,6 +101,8 @@ dispatch_t dispatchTable[] = {
 
 static int dispatchcount = sizeof (dispatchTable) / sizeof (dispatch_t);
 
+static char * volumeFileName;	//the host file holding the volume
+
 // Display files for use by ls command
 int displayFiles (fdDir * dirp, int flall, int fllong)
 	{
@@ -98,26 +110,29 @@ int displayFiles (fdDir * dirp, int flall, int fllong)
 	if (dirp == NULL)	//get out if error
 		return (-1);
 	
-	struct fs_diriteminfo * di;
-	struct fs_stat statbuf;
+	//entries come back with their stats in batches, straight from the
+	//loaded directory, so -l costs no extra lookups per file
+	struct fs_direntplus entries[DIRPLUS_BATCH];
+	int count;
 	
-	di = fs_readdir (dirp);
 	printf("\n");
-	while (di != NULL) 
+	while ((count = fs_readdirplus (dirp, entries, DIRPLUS_BATCH)) > 0) 
 		{
-		if ((di->d_name[0] != '.') || (flall)) //if not all and starts with '.' it is hidden
+		for (int i = 0; i < count; i++)
 			{
-			if (fllong)
-				{
-				fs_stat (di->d_name, &statbuf);
-				printf ("%s    %9ld   %s\n", fs_isDir(di->d_name)?"D":"-", statbuf.st_size, di->d_name);
-				}
-			else
+			if ((entries[i].d_name[0] != '.') || (flall)) //if not all and starts with '.' it is hidden
 				{
-				printf ("%s\n", di->d_name);
+				if (fllong)
+					{
+					printf ("%s    %9ld   %s\n", (entries[i].fileType == 1)?"D":"-",
+						entries[i].st_size, entries[i].d_name);
+					}
+				else
+					{
+					printf ("%s\n", entries[i].d_name);
+					}
 				}
 			}
-		di = fs_readdir (dirp);
 		}
 	fs_closedir (dirp);
 #endif
@@ -327,6 +342,12 @@ int cmd_cp (int argcnt, char *argvec[])
 	int readcnt;
 	char buf[BUFFERLEN];
 	
+	if ((argcnt == 4) && (strcmp (argvec[1], "-r") == 0))
+		{
+		//whole tree, copied by a pool of threads
+		return (fs_copytree (argvec[2], argvec[3], 0));
+		}
+
 	switch (argcnt)
 		{
 		case 2:	//only one name provided
@@ -341,13 +362,18 @@ int cmd_cp (int argcnt, char *argvec[])
 		
 		default:
 			printf("Usage: cp srcfile [destfile]\n");
+			printf("       cp -r srcpath destpath\n");
 			return (-1);
 		}
 	
 	
+	//share the source's blocks, they are only copied once either file changes
+	if (fs_clone (src, dest) == 0)
+		return 0;
+
 	testfs_src_fd = b_open (src, O_RDONLY);
 	testfs_dest_fd = b_open (dest, O_WRONLY | O_CREAT | O_TRUNC);
-	do 
+	do
 		{
 		readcnt = b_read (testfs_src_fd, buf, BUFFERLEN);
 		b_write (testfs_dest_fd, buf, readcnt);
@@ -364,8 +390,29 @@ int cmd_cp (int argcnt, char *argvec[])
 int cmd_mv (int argcnt, char *argvec[])
 	{
 #if (CMDMV_ON == 1)				
-	return -99;
-	// **** TODO ****  For you to implement	
+	if (argcnt != 3)
+		{
+		printf("Usage: mv source dest\n");
+		return (-1);
+		}
+
+	char * src = argvec[1];
+	char * dest = argvec[2];
+	char target[DIRMAX_LEN];
+
+	//moving onto a directory puts the source inside it
+	if (fs_isDir (dest))
+		{
+		char * name = strrchr (src, '/');
+		name = (name == NULL) ? src : name + 1;
+		int len = strlen (dest);
+		snprintf (target, DIRMAX_LEN, "%s%s%s", dest,
+			((len > 0) && (dest[len - 1] == '/')) ? "" : "/", name);
+		dest = target;
+		}
+
+	//only the directory entry moves, the data stays where it is
+	return (fs_rename (src, dest));
 #endif
 	return 0;
 	}
@@ -377,9 +424,14 @@ int cmd_mv (int argcnt, char *argvec[])
 int cmd_md (int argcnt, char *argvec[])
 	{
 #if (CMDMD_ON == 1)				
+	if (argcnt == 3 && strcmp(argvec[1], "-s") == 0)
+		{
+		// Sorted directory, listed in name order
+		return(fs_mkdir(argvec[2], 0777 | FS_DIR_ORDERED));
+		}
 	if (argcnt != 2)
 		{
-		printf("Usage: md pathname\n");
+		printf("Usage: md [-s] pathname\n");
 		return -1;
 		}
 	else
@@ -396,17 +448,20 @@ int cmd_md (int argcnt, char *argvec[])
 int cmd_rm (int argcnt, char *argvec[])
 	{
 #if (CMDRM_ON == 1)
-	if (argcnt != 2)
+	int recursive = (argcnt == 3) && (strcmp (argvec[1], "-r") == 0);
+	if ((argcnt != 2) && !recursive)
 		{
-		printf ("Usage: rm path\n");
+		printf ("Usage: rm [-r] path\n");
 		return -1;
 		}
 		
-	char * path = argvec[1];	
+	char * path = argvec[argcnt - 1];	
 	
 	//must determine if file or directory
 	if (fs_isDir (path))
 		{
+		if (recursive)
+			return (fs_rmtree (path, 0));
 		return (fs_rmdir (path));
 		}		
 	if (fs_isFile (path))
@@ -419,18 +474,26 @@ int cmd_rm (int argcnt, char *argvec[])
 	return -1;
 	}
 	
+// Reports the size and speed of a bulk copy
+void printTransferStats (struct fs_transferstats * stats)
+	{
+	double mbytes = stats->bytes / (1024.0 * 1024.0);
+	if (stats->seconds > 0)
+		printf ("%lu bytes in %.3f s (%.2f MB/s)\n", stats->bytes, stats->seconds,
+			mbytes / stats->seconds);
+	else
+		printf ("%lu bytes\n", stats->bytes);
+	}
+
 /****************************************************
 *  Copy file from test file system to Linux commmand
 ****************************************************/
 int cmd_cp2l (int argcnt, char *argvec[])
 	{
 #if (CMDCP2L_ON == 1)				
-	int testfs_fd;
-	int linux_fd;
 	char * src;
 	char * dest;
-	int readcnt;
-	char buf[BUFFERLEN];
+	struct fs_transferstats stats;
 	
 	switch (argcnt)
 		{
@@ -450,15 +513,12 @@ int cmd_cp2l (int argcnt, char *argvec[])
 		}
 	
 	
-	testfs_fd = b_open (src, O_RDONLY);
-	linux_fd = open (dest, O_WRONLY | O_CREAT | O_TRUNC, PERMISSIONS);
-	do 
+	if (fs_exportFile (src, dest, &stats) != 0)
 		{
-		readcnt = b_read (testfs_fd, buf, BUFFERLEN);
-		write (linux_fd, buf, readcnt);
-		} while (readcnt == BUFFERLEN);
-	b_close (testfs_fd);
-	close (linux_fd);
+		printf ("Failed to copy %s to %s\n", src, dest);
+		return (-1);
+		}
+	printTransferStats (&stats);
 #endif
 	return 0;
 	}
@@ -469,12 +529,9 @@ int cmd_cp2l (int argcnt, char *argvec[])
 int cmd_cp2fs (int argcnt, char *argvec[])
 	{
 #if (CMDCP2FS_ON == 1)				
-	int testfs_fd;
-	int linux_fd;
 	char * src;
 	char * dest;
-	int readcnt;
-	char buf[BUFFERLEN];
+	struct fs_transferstats stats;
 	
 	switch (argcnt)
 		{
@@ -494,19 +551,138 @@ int cmd_cp2fs (int argcnt, char *argvec[])
 		}
 	
 	
-	testfs_fd = b_open (dest, O_WRONLY | O_CREAT | O_TRUNC);
-	linux_fd = open (src, O_RDONLY);
-	do 
+	if (fs_importFile (src, dest, &stats) != 0)
 		{
-		readcnt = read (linux_fd, buf, BUFFERLEN);
-		b_write (testfs_fd, buf, readcnt);
-		} while (readcnt == BUFFERLEN);
-	b_close (testfs_fd);
-	close (linux_fd);
+		printf ("Failed to copy %s to %s\n", src, dest);
+		return (-1);
+		}
+	printTransferStats (&stats);
 #endif
 	return 0;
 	}
 	
+// Prints one line of defragmenter statistics
+void printDefragStats (char * label, struct fs_defragstats * stats)
+	{
+	printf ("%s: %llu files, %llu fragmented, %.2f extents per file; "
+		"%llu free runs, longest %llu blocks\n", label,
+		(ull_t) stats->files, (ull_t) stats->fragmentedFiles,
+		(stats->files > 0) ? (double) stats->extents / stats->files : 0.0,
+		(ull_t) stats->freeExtents, (ull_t) stats->largestFree);
+	}
+
+/****************************************************
+*  Defragment commmand
+****************************************************/
+int cmd_defrag (int argcnt, char *argvec[])
+	{
+#if (CMDDEFRAG_ON == 1)
+	struct fs_defragstats before;
+	struct fs_defragstats now;
+
+	if (argcnt == 1)
+		{
+		if (fs_defragScore (&now) != 0)
+			return (-1);
+		printDefragStats ("Volume", &now);
+		return 0;
+		}
+	if ((strcmp (argvec[1], "start") == 0) && (argcnt <= 3))
+		{
+		int rate = (argcnt == 3) ? atoi (argvec[2]) : 0;
+		if (fs_defragStart (rate) != 0)
+			{
+			printf ("Defragmenter is already running\n");
+			return (-1);
+			}
+		return 0;
+		}
+	if (((strcmp (argvec[1], "stop") == 0) || (strcmp (argvec[1], "status") == 0))
+		&& (argcnt == 2))
+		{
+		if ((strcmp (argvec[1], "stop") == 0) && (fs_defragStop () != 0))
+			printf ("Defragmenter is not running\n");
+		int running = fs_defragStatus (&before, &now);
+		if (running < 0)
+			return (-1);
+		printf ("Defragmenter is %s, moved %llu files, %llu blocks\n",
+			running ? "running" : "stopped",
+			(ull_t) now.filesMoved, (ull_t) now.blocksMoved);
+		printDefragStats ("Before", &before);
+		printDefragStats ("Now", &now);
+		return 0;
+		}
+	printf ("Usage: defrag [start [blocksPerSecond] | stop | status]\n");
+#endif
+	return -1;
+	}
+	
+/****************************************************
+*  Trim commmand
+****************************************************/
+int cmd_trim (int argcnt, char *argvec[])
+	{
+#if (CMDTRIM_ON == 1)
+	if ((argcnt == 3) && (strcmp (argvec[1], "every") == 0) && (atoi (argvec[2]) > 0))
+		{
+		if (fs_trimEvery (atoi (argvec[2])) != 0)
+			{
+			printf ("Trim is still stopping, try again\n");
+			return (-1);
+			}
+		return 0;
+		}
+	if ((argcnt == 2) && (strcmp (argvec[1], "off") == 0))
+		return (fs_trimEvery (0));
+	if (argcnt != 1)
+		{
+		printf ("Usage: trim [every seconds | off]\n");
+		return (-1);
+		}
+
+	int64_t punched = fs_trim ();
+	if (punched < 0)
+		{
+		printf ("Trim is not available\n");
+		return (-1);
+		}
+	struct stat hostStat;
+	printf ("Trimmed %lld free blocks", (long long) punched);
+	if (stat (volumeFileName, &hostStat) == 0)
+		printf ("; %s uses %lld KB of %lld KB on the host", volumeFileName,
+			(long long) hostStat.st_blocks / 2, (long long) hostStat.st_size / 1024);
+	printf ("\n");
+#endif
+	return 0;
+	}
+
+/****************************************************
+*  Grow commmand
+****************************************************/
+int cmd_grow (int argcnt, char *argvec[])
+	{
+#if (CMDGROW_ON == 1)
+	if (argcnt != 2)
+		{
+		printf ("Usage: grow volumeSize\n");
+		return (-1);
+		}
+
+	//sized in bytes like the volume given at startup
+	struct fs_stat rootStat;
+	if (fs_stat ("/", &rootStat) != 0)
+		return (-1);
+	uint64_t totalBlocks = strtoull (argvec[1], NULL, 10) / rootStat.st_blksize;
+	if (fs_growVolume (volumeFileName, totalBlocks) != 0)
+		{
+		printf ("Failed to grow the volume\n");
+		return (-1);
+		}
+	printf ("Volume now has %llu blocks\n", (ull_t) totalBlocks);
+#endif
+	return 0;
+	}
+
 /****************************************************
 *  cd commmand
 ****************************************************/
@@ -694,7 +870,10 @@ void processcommand (char * cmd)
 		{
 		if (strcmp(dispatchTable[i].command, cmdv[0]) == 0)
 			{
+			//the defragmenter runs between commands, never during one
+			fs_lockVolume ();
 			dispatchTable[i].func(cmdc,cmdv);
+			fs_unlockVolume ();
 			free (cmdv);
 			cmdv = NULL;
 			return;
@@ -748,6 +927,10 @@ int main (int argc, char * argv[])
 		return (retVal);
 		}
 
+	//freed blocks are punched out of the volume file as they build up
+	volumeFileName = filename;
+	fs_discardOpen (filename);
+
 	if (argc > 4)
 		if(strcmp("lowtest", argv[4]) == 0)
 			runFSLowTest();
@@ -811,6 +994,21 @@ int main (int argc, char * argv[])
         printf ("| cp2l                 |    ON    |\n");  
 #else
         printf ("| cp2l                 |    OFF   |\n");
+#endif
+#if (CMDDEFRAG_ON == 1)
+        printf ("| defrag               |    ON    |\n");  
+#else
+        printf ("| defrag               |    OFF   |\n");
+#endif
+#if (CMDTRIM_ON == 1)
+        printf ("| trim                 |    ON    |\n");  
+#else
+        printf ("| trim                 |    OFF   |\n");
+#endif
+#if (CMDGROW_ON == 1)
+        printf ("| grow                 |    ON    |\n");  
+#else
+        printf ("| grow                 |    OFF   |\n");
 #endif
         printf ("|---------------------------------|\n");
 
@@ -831,6 +1029,7 @@ int main (int argc, char * argv[])
 			{
 			free (cmd);
 			cmd = NULL;
+			b_aio_shutdown();
 			exitFileSystem();
 			closePartitionSystem();
 			// exit while loop and terminate shell
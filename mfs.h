@@ -73,19 +73,27 @@ struct DirectoryEntry {
     uint8_t fileType;                     // 0 for file, 1 for directory
     uint8_t inUse;                        // 0 for free, 1 for in use
     uint16_t linkCount;                   // Number of hard links
-    char padding[6];                      // Padding to maintain 64 bytes
+    uint16_t indexBlocks;                 // "." only: name index blocks after the entries
+    uint16_t heapBlocks;                  // "." only: name heap blocks of a compact directory
+    uint8_t indexType;                    // "." only: DIR_INDEX_HASH or DIR_INDEX_BTREE
+    uint8_t inlineData;                   // File data sits at the end of filename, no blocks
 };
 
 typedef struct
     {
     /*****TO DO:  Fill in this structure with what your open/read directory needs  *****/
     unsigned short  d_reclen;       /* length of this record */
-    unsigned short  dirEntryPosition;   /* which directory entry position, like file pos */
+    uint32_t        dirEntryPosition;   /* which directory entry position, like file pos */
     //DE *  directory;          /* Pointer to the loaded directory you want to iterate */
     struct fs_diriteminfo * di;     /* Pointer to the structure you return from read */
     struct DirectoryEntry *directory;
+    uint32_t        orderedLeaf;        /* leaf being listed, ordered directories only */
+    struct dirReader *reader;           /* reads unordered directories block by block */
     } fdDir;
 
+// fs_mkdir mode flag: keep the directory sorted by name
+#define FS_DIR_ORDERED  0x10000
+
 // Key directory functions
 int fs_mkdir(const char *pathname, mode_t mode);
 int fs_rmdir(const char *pathname);
@@ -95,12 +103,17 @@ fdDir * fs_opendir(const char *pathname);
 struct fs_diriteminfo *fs_readdir(fdDir *dirp);
 int fs_closedir(fdDir *dirp);
 
+// Ordered directories only: continue listing at the first name >= name
+int fs_seekdir(fdDir *dirp, const char *name);
+
 // Misc directory functions
 char * fs_getcwd(char *pathname, size_t size);
 int fs_setcwd(char *pathname);   //linux chdir
 int fs_isFile(char * filename); //return 1 if file, 0 otherwise
 int fs_isDir(char * pathname);      //return 1 if directory, 0 otherwise
 int fs_delete(char* filename);  //removes a file
+int fs_clone(const char *srcPath, const char *destPath); //copy sharing data blocks
+int fs_rename(const char *oldPath, const char *newPath); //moves an entry, data stays put
 
 
 // This is the structure that is filled in from a call to fs_stat
@@ -118,4 +131,88 @@ struct fs_stat
 
 int fs_stat(const char *path, struct fs_stat *buf);
 
+// Filled in by fs_readdirplus: a directory entry together with its stats,
+// taken from the already loaded directory
+struct fs_direntplus
+    {
+    unsigned char fileType;
+    char      d_name[256];      /* filename max filename is 255 characters */
+    off_t     st_size;          /* total size, in bytes */
+    time_t    st_modtime;       /* time of last modification */
+    time_t    st_createtime;    /* time of creation */
+    };
+
+// Returns up to max entries from the same position as fs_readdir, 0 at the end
+int fs_readdirplus(fdDir *dirp, struct fs_direntplus *entries, int max);
+
+// Passed to an fs_walk visitor for every entry under the starting path
+struct fs_walkent
+    {
+    const char *path;           /* the path given to fs_walk, then names below it */
+    const struct DirectoryEntry *entry;
+    int       depth;            /* 0 for the starting path */
+    };
+
+// Returning nonzero from a visitor stops the walk, and fs_walk returns that
+// value.  Visitors run on several threads at once.
+typedef int (*fs_walk_fn) (const struct fs_walkent *ent, void *context);
+
+#define FS_WALK_DEPTH   0x1     /* visit directories after their contents */
+
+// Visits every entry under path with nthreads workers (0 for one per CPU)
+int fs_walk(const char *path, fs_walk_fn visit, int flags, int nthreads, void *context);
+
+// Recursive remove and copy of a whole tree, walked with nthreads workers
+int fs_rmtree(const char *path, int nthreads);
+int fs_copytree(const char *srcPath, const char *destPath, int nthreads);
+
+// Filled in by the bulk transfer functions so callers can report throughput
+struct fs_transferstats
+    {
+    uint64_t  bytes;            /* bytes copied */
+    double    seconds;          /* wall clock time of the copy */
+    };
+
+// Bulk copies between the Linux file system and this one
+int fs_importFile(const char *linuxPath, const char *fsPath, struct fs_transferstats *stats);
+int fs_exportFile(const char *fsPath, const char *linuxPath, struct fs_transferstats *stats);
+
+// Fragmentation of the files on the volume and of its free space
+struct fs_defragstats
+    {
+    uint64_t  files;            /* files with blocks of their own */
+    uint64_t  fragmentedFiles;  /* files in more than one extent */
+    uint64_t  extents;          /* runs of contiguous blocks over all files */
+    uint64_t  freeExtents;      /* runs of free blocks */
+    uint64_t  largestFree;      /* blocks in the longest free run */
+    uint64_t  filesMoved;       /* relocated by the defragmenter */
+    uint64_t  blocksMoved;
+    };
+
+// Measures the volume as it is now
+int fs_defragScore(struct fs_defragstats *stats);
+
+// Background defragmenter, copying at most blocksPerSecond blocks a second.
+// While it runs, every other call into the file system must be made holding
+// fs_lockVolume.  Status fills before with the score at start and now with
+// the current one; stop asks the service to finish and does not wait.
+int fs_defragStart(int blocksPerSecond);
+int fs_defragStatus(struct fs_defragstats *before, struct fs_defragstats *now);
+int fs_defragStop();
+void fs_lockVolume();
+void fs_unlockVolume();
+
+// Punches freed blocks out of volumeFile, the file backing the volume, so
+// it only takes host space for live data.  Frees are batched; a trim
+// punches every free run now, and fs_trimEvery does so periodically (0
+// stops).  Both are called with fs_lockVolume held.
+int fs_discardOpen(const char *volumeFile);
+int64_t fs_trim();
+int fs_trimEvery(int seconds);
+
+// Grows the mounted volume in volumeFile to totalBlocks, with fs_lockVolume
+// held.  Moving tables need room in the new blocks, so a grow too small for
+// them is refused.
+int fs_growVolume(const char *volumeFile, uint64_t totalBlocks);
+
 #endif
\ No newline at end of file
@@ -43,6 +43,89 @@ struct VolumeControlBlock {
     /* Metadata */
     uint64_t metadataLocation;     // Location of additional metadata
     uint32_t fsVersion;            // File system version number
-    unsigned char reserved[64];     // Reserved for future use
+    uint64_t journalStart;         // Metadata journal, 0 on older volumes
+    uint64_t journalBlocks;
+    uint64_t allocSummaryStart;    // Per-group free space, 0 on older volumes
+    uint32_t allocGroups;
+    uint32_t cleanUnmount;         // Summaries on disk match the FAT
+    unsigned char reserved[32];     // Reserved for future use
+};
+
+// Directory formats, recorded in vcb->fsVersion
+#define FS_VERSION_WIDE_DIRS 0      // Whole DirectoryEntry structs on disk
+#define FS_VERSION_COMPACT_DIRS 1   // DirSlot array plus a packed name heap
+
+// On-disk directory slot of FS_VERSION_COMPACT_DIRS volumes.  A compact
+// directory is its slots, then the name heap, then the name index.  The
+// "." slot also describes that layout and the heap's free space.  Names
+// are placed in DIR_HEAP_UNIT chunks and stay put until they change; a
+// freed chunk holds a DirHeapFree and joins the free list.
+struct DirSlot {
+    uint32_t hash;              // dirNameHash of the name
+    uint32_t nameOffset;        // Offset of the name in the name heap
+    uint64_t fileSize;          // "." holds the size of the slot array
+    uint64_t firstBlockIndex;
+    time_t creationTime;
+    time_t lastModifiedTime;
+    uint16_t nameLength;
+    uint8_t fileType;
+    uint8_t inUse;
+    uint16_t linkCount;
+    uint16_t indexBlocks;       // "." only
+    uint16_t heapBlocks;        // "." only
+    uint8_t indexType;          // "." only
+    uint8_t inlineData;         // fileSize bytes of data follow the name in the heap
+    uint32_t heapEnd;           // "." only: heap bytes handed out, 0 if never tracked
+    uint32_t heapFree;          // "." only: first free chunk, DIR_HEAP_NONE if none
+    uint32_t heapLive;          // "." only: heap bytes in use
+};
+
+#define DIR_HEAP_UNIT 8
+#define DIR_HEAP_NONE 0xFFFFFFFF
+#define DIR_HEAP_FIT_TRIES 4    // Free chunks looked at before appending
+struct DirHeapFree {
+    uint32_t next;              // Offset of the next free chunk, or DIR_HEAP_NONE
+    uint32_t size;
+};
+
+// Directories start with this many entries and grow as they fill
+#define DIR_INITIAL_ENTRIES 51
+#define DIR_MAX_EXTENTS 64
+#define DIR_DIRT_MAX 32         // Changed slots or index blocks tracked per write
+#define DIR_ENTRY_JOURNAL_BLOCKS 16 // Journal blocks one entry change takes, short of a resize
+
+// Kinds of directory name index, recorded in "."
+#define DIR_INDEX_HASH 0
+#define DIR_INDEX_BTREE 1
+
+// One slot of a directory's hashed name index
+#define DIR_INDEX_EMPTY 0xFFFFFFFF
+struct DirIndexSlot {
+    uint32_t hash;      // dirNameHash of the entry's name
+    uint32_t slot;      // Entry number in the directory, or DIR_INDEX_EMPTY
+};
+
+// Free space summary of one group of ALLOC_GROUP_BLOCKS blocks, saved at
+// unmount so the allocator can skip full groups without a FAT scan
+#define ALLOC_GROUP_BLOCKS 1024
+struct allocGroup {
+    uint32_t freeBlocks;
+    uint32_t largestFree;       // Longest free run inside the group, or more
+};
+
+// A run of physically contiguous blocks
+struct extent {
+    uint64_t start;
+    uint64_t count;
+};
+#define COW_MAX_EXTENTS 64      // Runs the copies one cowBlock makes may be split into
+
+// Blocks of an in-memory table changed since it was last written.  The
+// list holds each changed block once, in the order first changed.
+struct tableDirt {
+    uint8_t *marked;            // A byte per block of the table
+    uint64_t *list;
+    uint64_t count;
+    uint64_t blocks;
 };
 #endif